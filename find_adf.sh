@@ -1,18 +1,23 @@
 #!/usr/bin/bash
 #
 # Find all .adf Amiga disk images, mount them temporarily and search their content for valid ILBM images.
+# One server does all the decoding, the client only hands it the paths.
 #
 
 DIR=/tmp/adf_mount
 VERBOSITY=-
+SOCKET=/tmp/ilbm_cli.$$.sock
 
 mkdir -p $DIR
 
+./ilbm_cli $VERBOSITY --serve $SOCKET 2>/dev/null &
+SERVER=$!
+
 find "$1" -name *.adf \
     -exec sudo mount -t affs -o loop "{}" $DIR ';'\
     -exec echo "  * {}" ';'\
     -exec sudo chmod a+r $DIR ';'\
-    -exec sh -c "find $DIR -exec ./ilbm_cli $VERBOSITY {\} \;" 2>/dev/null ';'\
+    -exec sh -c "find $DIR -type f | ./ilbm_cli --client $SOCKET -" 2>/dev/null ';'\
     -exec sudo umount $DIR ';'
 
 while `sudo umount $DIR 2>/dev/null`
@@ -20,4 +25,6 @@ do
     echo -n ""
 done
 
-rm -rf $DIR
\ No newline at end of file
+kill $SERVER
+
+rm -rf $DIR
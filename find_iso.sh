@@ -1,21 +1,15 @@
 #!/usr/bin/bash
 
-# Find all .iso disk images, mount them temporarily and search their content for valid ILBM images.
+# Find all .iso disk images and search their content for valid ILBM images.
+# ilbm_cli walks the ISO9660 directory tree itself, no mounting or root required.
+# One server does all the decoding, the client only hands it the paths.
 
-DIR=/tmp/iso_mount
 VERBOSITY=-
+SOCKET=/tmp/ilbm_cli.$$.sock
 
-mkdir -p $DIR
+./ilbm_cli $VERBOSITY --serve $SOCKET 2>/dev/null &
+SERVER=$!
 
-find "$1" -name *.iso \
-    -exec sudo mount "{}" $DIR ';'\
-    -exec echo "  * {}" ';'\
-    -exec sh -c "find $DIR -exec ./ilbm_cli $VERBOSITY {\} \;" 2>/dev/null ';'\
-    -exec sudo umount $DIR ';'
+find "$1" -iname *.iso | ./ilbm_cli --client $SOCKET - 2>/dev/null
 
-while `sudo umount $DIR 2>/dev/null`
-do
-    echo -n ""
-done
-
-rm -rf $DIR
\ No newline at end of file
+kill $SERVER
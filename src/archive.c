@@ -0,0 +1,704 @@
+/* archive.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "archive.h"
+
+const char * archive_type_strs[] = { "gzip", "LHA" };
+
+/* -lh4- to -lh7- share one format: LZSS over a 4-64 KiB window, with the literals/lengths
+ * and the distances coded by static Huffman tables that are sent at the start of each block. */
+#define LZH_NC   510
+#define LZH_NT   19
+#define LZH_TBIT 5
+#define LZH_CBIT 9
+#define LZH_NPT  32
+
+struct {
+    const uint8_t * src;
+    size_t          size;
+    size_t          pos;
+    uint32_t        bits;
+    int             count;
+    uint32_t        np;
+    uint32_t        pbit;
+    uint32_t        blocksize;
+    uint8_t         c_len[LZH_NC];
+    uint8_t         pt_len[LZH_NPT];
+    uint16_t        c_table[4096];
+    uint16_t        pt_table[256];
+    uint16_t        left[2 * LZH_NC - 1];
+    uint16_t        right[2 * LZH_NC - 1];
+} typedef archive_lzh;
+
+static uint16_t archive_le16(const uint8_t * p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t archive_le32(const uint8_t * p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+archive * archive_open(const char * filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < 22){
+        close(fd);
+        return NULL;
+    }
+
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+        close(fd);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const uint8_t * head = (const uint8_t *)map;
+    ARCHIVE_TYPE type = ARCHIVE_EOL;
+    if(head[0] == 0x1f && head[1] == 0x8b && head[2] == 8){
+        type = ARCHIVE_GZIP;
+    }else
+    if(head[2] == '-' && head[3] == 'l' && head[6] == '-'){
+        type = ARCHIVE_LHA;
+    }
+
+    archive * p_arc = type != ARCHIVE_EOL ? (archive *)calloc(1, sizeof(archive)) : NULL;
+    if(p_arc == NULL){
+        munmap(map, st.st_size);
+        close(fd);
+        return NULL;
+    }
+    p_arc->fd = fd;
+    p_arc->map = head;
+    p_arc->map_size = st.st_size;
+    p_arc->type = type;
+
+    p_arc->piece = (uint8_t *)malloc(ARCHIVE_PIECE_SIZE);
+    if(p_arc->piece == NULL){
+        archive_close(p_arc);
+        return NULL;
+    }
+
+    /* gzip members without a stored name are called like the archive without ".gz" */
+    const char * name = strrchr(filename, '/');
+    name = name != NULL ? name + 1 : filename;
+    const char * ext = strrchr(name, '.');
+    snprintf(p_arc->name, sizeof(p_arc->name), "%.*s", (int)(ext != NULL && ext != name ? ext - name : (long)strlen(name)), name);
+
+    for(uint32_t i = 0; i < 256; i++){
+        uint16_t crc = i;
+        for(int bit = 0; bit < 8; bit++){
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+        }
+        p_arc->crc16_table[i] = crc;
+    }
+
+    return p_arc;
+}
+
+void archive_close(archive * p_arc) {
+    if(p_arc == NULL){
+        return;
+    }
+    free(p_arc->piece);
+    munmap((void *)p_arc->map, p_arc->map_size);
+    close(p_arc->fd);
+    free(p_arc);
+}
+
+static int archive_walk_gzip(archive * p_arc, archive_begin_cb begin, archive_data_cb data, archive_end_cb end, void * user) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, -MAX_WBITS) != Z_OK){
+        return -1;
+    }
+
+    const uint8_t * map = p_arc->map;
+    const size_t    size = p_arc->map_size;
+    size_t          pos = 0;
+    int             ret = 0;
+
+    /* Concatenated gzip streams are separate members */
+    while(pos + 18 <= size && map[pos] == 0x1f && map[pos + 1] == 0x8b && map[pos + 2] == 8){
+        const uint8_t flags = map[pos + 3];
+        size_t p = pos + 10;
+
+        char path[ARCHIVE_MAX_PATH];
+        snprintf(path, sizeof(path), "%s", p_arc->name);
+
+        if(flags & 4){
+            p += 2 + archive_le16(map + p);
+        }
+        if((flags & 8) && p < size){
+            const uint8_t * term = (const uint8_t *)memchr(map + p, 0, size - p);
+            if(term == NULL){
+                ret = -1;
+                break;
+            }
+            snprintf(path, sizeof(path), "%s", (const char *)map + p);
+            p = term - map + 1;
+        }
+        if((flags & 16) && p < size){
+            const uint8_t * term = (const uint8_t *)memchr(map + p, 0, size - p);
+            if(term == NULL){
+                ret = -1;
+                break;
+            }
+            p = term - map + 1;
+        }
+        if(flags & 2){
+            p += 2;
+        }
+        if(p >= size){
+            ret = -1;
+            break;
+        }
+
+        p_arc->member_cnt++;
+
+        /* A skipped member still has to be inflated, deflate doesn't store where it ends */
+        int skip = begin(user, path, 0) != 0;
+        int drop = skip;
+
+        inflateReset(&zs);
+        zs.next_in = (Bytef *)(map + p);
+        zs.avail_in = size - p < 0xffffffffu ? size - p : 0xffffffffu;
+
+        uLong crc = crc32(0, NULL, 0);
+        int z_ret;
+        do{
+            zs.next_out = p_arc->piece;
+            zs.avail_out = ARCHIVE_PIECE_SIZE;
+            z_ret = inflate(&zs, Z_NO_FLUSH);
+
+            size_t got = ARCHIVE_PIECE_SIZE - zs.avail_out;
+            crc = crc32(crc, p_arc->piece, got);
+            if(got > 0 && !drop && data(user, p_arc->piece, got) != 0){
+                drop = 1;
+            }
+        }while(z_ret == Z_OK && (zs.avail_in > 0 || zs.avail_out == 0));
+
+        int status = -1;
+        p = (const uint8_t *)zs.next_in - map;
+        if(z_ret == Z_STREAM_END && p + 8 <= size){
+            status = archive_le32(map + p) == (uint32_t)crc && archive_le32(map + p + 4) == (uint32_t)zs.total_out ? 0 : -1;
+        }
+        if(!skip){
+            end(user, status);
+        }
+        if(z_ret != Z_STREAM_END){
+            ret = -1;
+            break;
+        }
+        pos = p + 8;
+    }
+
+    inflateEnd(&zs);
+
+    return ret;
+}
+
+static void lzh_fill(archive_lzh * z) {
+    while(z->count <= 24){
+        uint32_t byte = z->pos < z->size ? z->src[z->pos] : 0;
+        z->pos++;
+        z->bits |= byte << (24 - z->count);
+        z->count += 8;
+    }
+}
+
+/* Up to 16 bits are always available after lzh_fill() */
+static uint32_t lzh_peek(archive_lzh * z, uint32_t n) {
+    return z->bits >> (32 - n);
+}
+
+static void lzh_skip(archive_lzh * z, uint32_t n) {
+    z->bits <<= n;
+    z->count -= n;
+    lzh_fill(z);
+}
+
+static uint32_t lzh_get(archive_lzh * z, uint32_t n) {
+    if(n == 0){
+        return 0;
+    }
+    uint32_t v = lzh_peek(z, n);
+    lzh_skip(z, n);
+    return v;
+}
+
+/* Canonical codes from the bit lengths: codes up to tablebits long are looked up directly,
+ * longer ones continue as a binary tree in left/right. */
+static int lzh_make_table(archive_lzh * z, uint32_t nchar, const uint8_t * bitlen, uint32_t tablebits, uint16_t * table) {
+    uint32_t count[17], weight[17], start[18];
+
+    memset(count, 0, sizeof(count));
+    for(uint32_t i = 0; i < nchar; i++){
+        if(bitlen[i] > 16){
+            return -1;
+        }
+        count[bitlen[i]]++;
+    }
+
+    start[1] = 0;
+    for(uint32_t i = 1; i <= 16; i++){
+        start[i + 1] = start[i] + (count[i] << (16 - i));
+    }
+    if(start[17] != (1u << 16)){
+        return -1;
+    }
+
+    const uint32_t jutbits = 16 - tablebits;
+    for(uint32_t i = 1; i <= 16; i++){
+        if(i <= tablebits){
+            start[i] >>= jutbits;
+            weight[i] = 1u << (tablebits - i);
+        }else{
+            weight[i] = 1u << (16 - i);
+        }
+    }
+    for(uint32_t i = start[tablebits + 1] >> jutbits; i < (1u << tablebits); i++){
+        table[i] = 0;
+    }
+
+    uint32_t avail = nchar;
+    const uint32_t mask = 1u << (15 - tablebits);
+    for(uint32_t ch = 0; ch < nchar; ch++){
+        const uint32_t len = bitlen[ch];
+        if(len == 0){
+            continue;
+        }
+        const uint32_t next_code = start[len] + weight[len];
+        if(len <= tablebits){
+            for(uint32_t i = start[len]; i < next_code; i++){
+                table[i] = ch;
+            }
+        }else{
+            uint32_t k = start[len];
+            uint16_t * p = &table[k >> jutbits];
+            for(uint32_t i = len - tablebits; i > 0; i--){
+                if(*p == 0){
+                    if(avail >= 2 * nchar - 1){
+                        return -1;
+                    }
+                    z->right[avail] = z->left[avail] = 0;
+                    *p = avail++;
+                }
+                p = (k & mask) ? &z->right[*p] : &z->left[*p];
+                k <<= 1;
+            }
+            *p = ch;
+        }
+        start[len] = next_code;
+    }
+
+    return 0;
+}
+
+static int lzh_read_pt_len(archive_lzh * z, uint32_t nn, uint32_t nbit, int i_special) {
+    uint32_t n = lzh_get(z, nbit);
+    if(n == 0){
+        uint32_t c = lzh_get(z, nbit);
+        if(c >= nn){
+            return -1;
+        }
+        memset(z->pt_len, 0, nn);
+        for(uint32_t i = 0; i < 256; i++){
+            z->pt_table[i] = c;
+        }
+        return 0;
+    }
+    if(n > nn){
+        return -1;
+    }
+
+    uint32_t i = 0;
+    while(i < n){
+        /* 0-6 in three bits, longer lengths continue in unary */
+        uint32_t c = lzh_peek(z, 3);
+        if(c == 7){
+            uint32_t mask = 1u << 12;
+            while(lzh_peek(z, 16) & mask){
+                mask >>= 1;
+                if(++c > 16){
+                    return -1;
+                }
+            }
+        }
+        lzh_skip(z, c < 7 ? 3 : c - 3);
+        z->pt_len[i++] = c;
+
+        if((int)i == i_special){
+            c = lzh_get(z, 2);
+            while(c-- > 0 && i < nn){
+                z->pt_len[i++] = 0;
+            }
+        }
+    }
+    while(i < nn){
+        z->pt_len[i++] = 0;
+    }
+
+    return lzh_make_table(z, nn, z->pt_len, 8, z->pt_table);
+}
+
+static int lzh_read_c_len(archive_lzh * z) {
+    uint32_t n = lzh_get(z, LZH_CBIT);
+    if(n == 0){
+        uint32_t c = lzh_get(z, LZH_CBIT);
+        if(c >= LZH_NC){
+            return -1;
+        }
+        memset(z->c_len, 0, LZH_NC);
+        for(uint32_t i = 0; i < 4096; i++){
+            z->c_table[i] = c;
+        }
+        return 0;
+    }
+    if(n > LZH_NC){
+        return -1;
+    }
+
+    uint32_t i = 0;
+    while(i < n){
+        uint32_t c = z->pt_table[lzh_peek(z, 8)];
+        if(c >= LZH_NT){
+            uint32_t mask = 1u << 7;
+            do{
+                c = (lzh_peek(z, 16) & mask) ? z->right[c] : z->left[c];
+                mask >>= 1;
+            }while(c >= LZH_NT && mask != 0);
+            if(c >= LZH_NT){
+                return -1;
+            }
+        }
+        lzh_skip(z, z->pt_len[c]);
+
+        /* 0-2 are runs of unused codes: one, 3-18 or 20-531 */
+        if(c <= 2){
+            c = c == 0 ? 1 : c == 1 ? lzh_get(z, 4) + 3 : lzh_get(z, LZH_CBIT) + 20;
+            while(c-- > 0 && i < LZH_NC){
+                z->c_len[i++] = 0;
+            }
+        }else{
+            z->c_len[i++] = c - 2;
+        }
+    }
+    while(i < LZH_NC){
+        z->c_len[i++] = 0;
+    }
+
+    return lzh_make_table(z, LZH_NC, z->c_len, 12, z->c_table);
+}
+
+/* A literal (0-255) or a match length + 253, -1 for broken data */
+static int lzh_decode_c(archive_lzh * z) {
+    if(z->blocksize == 0){
+        z->blocksize = lzh_get(z, 16);
+        if(lzh_read_pt_len(z, LZH_NT, LZH_TBIT, 3) != 0 || lzh_read_c_len(z) != 0 || lzh_read_pt_len(z, z->np, z->pbit, -1) != 0){
+            return -1;
+        }
+    }
+    z->blocksize--;
+
+    uint32_t j = z->c_table[lzh_peek(z, 12)];
+    if(j < LZH_NC){
+        lzh_skip(z, z->c_len[j]);
+        return j;
+    }
+
+    lzh_skip(z, 12);
+    uint32_t mask = 1u << 15;
+    do{
+        j = (lzh_peek(z, 16) & mask) ? z->right[j] : z->left[j];
+        mask >>= 1;
+    }while(j >= LZH_NC && mask != 0);
+    if(j >= LZH_NC || z->c_len[j] < 12){
+        return -1;
+    }
+    lzh_skip(z, z->c_len[j] - 12);
+
+    return j;
+}
+
+static int lzh_decode_p(archive_lzh * z) {
+    uint32_t j = z->pt_table[lzh_peek(z, 8)];
+    if(j < z->np){
+        lzh_skip(z, z->pt_len[j]);
+    }else{
+        lzh_skip(z, 8);
+        uint32_t mask = 1u << 15;
+        do{
+            j = (lzh_peek(z, 16) & mask) ? z->right[j] : z->left[j];
+            mask >>= 1;
+        }while(j >= z->np && mask != 0);
+        if(j >= z->np || z->pt_len[j] < 8){
+            return -1;
+        }
+        lzh_skip(z, z->pt_len[j] - 8);
+    }
+
+    return j != 0 ? (1 << (j - 1)) + lzh_get(z, j - 1) : 0;
+}
+
+static uint16_t archive_crc16(archive * p_arc, uint16_t crc, const uint8_t * data, size_t size) {
+    for(size_t i = 0; i < size; i++){
+        crc = (crc >> 8) ^ p_arc->crc16_table[(crc ^ data[i]) & 0xff];
+    }
+    return crc;
+}
+
+/* The piece buffer doubles as the window: it holds the last 64 KiB, more than any method
+ * reaches back, and is handed out whenever it has been filled once. */
+static int archive_unlzh(archive * p_arc, archive_lzh * z, const uint8_t * src, uint32_t packed, uint32_t original, uint32_t dicbit, archive_data_cb data, void * user, uint16_t * p_crc) {
+    uint8_t * text = p_arc->piece;
+    const uint32_t text_mask = ARCHIVE_PIECE_SIZE - 1;
+    int drop = 0;
+
+    z->src = src;
+    z->size = packed;
+    z->pos = 0;
+    z->bits = 0;
+    z->count = 0;
+    z->np = dicbit <= 13 ? 14 : dicbit + 1;
+    z->pbit = dicbit <= 13 ? 4 : 5;
+    z->blocksize = 0;
+    lzh_fill(z);
+
+    /* Matches may reach back before the start, the encoder sees spaces there */
+    memset(text, ' ', ARCHIVE_PIECE_SIZE);
+
+    uint32_t loc = 0;
+    uint32_t done = 0;
+    while(done < original){
+        int c = lzh_decode_c(z);
+        if(c < 0){
+            return -1;
+        }
+
+        uint32_t len = 1;
+        uint32_t from = 0;
+        if(c >= 256){
+            int dist = lzh_decode_p(z);
+            if(dist < 0){
+                return -1;
+            }
+            len = c - 256 + 3;
+            from = (loc - dist - 1) & text_mask;
+        }
+        if(len > original - done){
+            len = original - done;
+        }
+
+        for(uint32_t k = 0; k < len; k++){
+            text[loc] = c < 256 ? c : text[from];
+            from = (from + 1) & text_mask;
+            if(++loc == ARCHIVE_PIECE_SIZE){
+                *p_crc = archive_crc16(p_arc, *p_crc, text, loc);
+                drop = drop || data(user, text, loc) != 0;
+                if(drop){
+                    return 1;
+                }
+                loc = 0;
+            }
+        }
+        done += len;
+
+        if(z->pos > z->size + 4){
+            return -1;
+        }
+    }
+
+    if(loc > 0){
+        *p_crc = archive_crc16(p_arc, *p_crc, text, loc);
+        if(data(user, text, loc) != 0){
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Level 1 and 2 headers carry the name and the directory in extended headers: type, data
+ * and the size of the next extended header. Directories are separated by 0xff. */
+static void archive_lha_ext(const uint8_t * ext, uint32_t ext_size, char * name, char * dir) {
+    if(ext_size < 3){
+        return;
+    }
+    const uint8_t * field = ext + 1;
+    const uint32_t len = ext_size - 3 < ARCHIVE_MAX_PATH - 2 ? ext_size - 3 : ARCHIVE_MAX_PATH - 2;
+
+    if(ext[0] == 0x01){
+        memcpy(name, field, len);
+        name[len] = 0;
+    }else
+    if(ext[0] == 0x02){
+        for(uint32_t i = 0; i < len; i++){
+            dir[i] = field[i] == 0xff ? '/' : field[i];
+        }
+        dir[len] = 0;
+        if(len > 0 && dir[len - 1] != '/'){
+            dir[len] = '/';
+            dir[len + 1] = 0;
+        }
+    }
+}
+
+static int archive_walk_lha(archive * p_arc, archive_begin_cb begin, archive_data_cb data, archive_end_cb end, void * user) {
+    archive_lzh * z = (archive_lzh *)malloc(sizeof(archive_lzh));
+    if(z == NULL){
+        return -1;
+    }
+
+    const uint8_t * map = p_arc->map;
+    const size_t    size = p_arc->map_size;
+    size_t          pos = 0;
+    int             ret = 0;
+
+    while(pos + 24 <= size){
+        const uint8_t * h = map + pos;
+        const uint32_t level = h[20];
+        /* A zero header size ends the archive, level 2 sizes are 16 bits and may have a zero low byte */
+        if(h[0] == 0 && (level != 2 || h[1] == 0)){
+            break;
+        }
+        uint32_t packed = archive_le32(h + 7);
+        const uint32_t original = archive_le32(h + 11);
+        uint16_t crc = 0;
+        size_t data_pos;
+
+        char name[ARCHIVE_MAX_PATH] = "";
+        char dir[ARCHIVE_MAX_PATH] = "";
+
+        if(level == 0 || level == 1){
+            const size_t head_size = h[0] + 2;
+            const uint32_t name_len = h[21];
+            if(pos + head_size > size || 22 + name_len + 2 > head_size){
+                ret = -1;
+                break;
+            }
+            for(uint32_t i = 0; i < name_len; i++){
+                name[i] = h[22 + i] == '\\' ? '/' : h[22 + i];
+            }
+            name[name_len] = 0;
+            crc = archive_le16(h + 22 + name_len);
+            data_pos = pos + head_size;
+
+            /* The packed size of level 1 includes the extended headers that follow */
+            if(level == 1){
+                uint32_t next_size = archive_le16(h + head_size - 2);
+                while(next_size != 0 && data_pos + next_size <= size && next_size <= packed){
+                    archive_lha_ext(map + data_pos, next_size, name, dir);
+                    packed -= next_size;
+                    data_pos += next_size;
+                    next_size = archive_le16(map + data_pos - 2);
+                }
+            }
+        }else
+        if(level == 2){
+            const size_t head_size = archive_le16(h);
+            if(head_size < 26 || pos + head_size > size){
+                ret = -1;
+                break;
+            }
+            crc = archive_le16(h + 21);
+            size_t ext_pos = pos + 26;
+            uint32_t next_size = archive_le16(h + 24);
+            while(next_size != 0 && ext_pos + next_size <= pos + head_size){
+                archive_lha_ext(map + ext_pos, next_size, name, dir);
+                ext_pos += next_size;
+                next_size = archive_le16(map + ext_pos - 2);
+            }
+            data_pos = pos + head_size;
+        }else{
+            ret = -1;
+            break;
+        }
+
+        if(data_pos + packed > size){
+            ret = -1;
+            break;
+        }
+        pos = data_pos + packed;
+
+        uint32_t dicbit = 0;
+        if(memcmp(h + 2, "-lh0-", 5) == 0 || memcmp(h + 2, "-lz4-", 5) == 0){
+            dicbit = 0;
+        }else
+        if(memcmp(h + 2, "-lh", 3) == 0 && h[5] >= '4' && h[5] <= '7' && h[6] == '-'){
+            static const uint32_t dicbits[] = { 12, 13, 15, 16 };
+            dicbit = dicbits[h[5] - '4'];
+        }else{
+            /* -lhd- is a directory entry */
+            if(memcmp(h + 2, "-lhd-", 5) != 0){
+                p_arc->member_cnt++;
+                p_arc->unsupported_cnt++;
+            }
+            continue;
+        }
+
+        p_arc->member_cnt++;
+
+        char path[ARCHIVE_MAX_PATH * 2];
+        snprintf(path, sizeof(path), "%s%s", dir, name);
+        if(begin(user, path, original) != 0){
+            continue;
+        }
+
+        uint16_t crc_got = 0;
+        int status;
+        if(dicbit == 0){
+            status = 0;
+            for(uint32_t done = 0; done < packed && status == 0; done += ARCHIVE_PIECE_SIZE){
+                uint32_t n = packed - done < ARCHIVE_PIECE_SIZE ? packed - done : ARCHIVE_PIECE_SIZE;
+                crc_got = archive_crc16(p_arc, crc_got, map + data_pos + done, n);
+                status = data(user, map + data_pos + done, n) != 0 ? 1 : 0;
+            }
+        }else{
+            status = archive_unlzh(p_arc, z, map + data_pos, packed, original, dicbit, data, user, &crc_got);
+        }
+
+        /* A member dropped by the callback was not unpacked to the end, its CRC can't be checked */
+        end(user, status < 0 || (status == 0 && crc_got != crc) ? -1 : 0);
+    }
+
+    free(z);
+
+    return ret;
+}
+
+int archive_walk(archive * p_arc, archive_begin_cb begin, archive_data_cb data, archive_end_cb end, void * user) {
+    switch(p_arc->type){
+        case ARCHIVE_GZIP: return archive_walk_gzip(p_arc, begin, data, end, user);
+        case ARCHIVE_LHA: return archive_walk_lha(p_arc, begin, data, end, user);
+        default: return -1;
+    }
+}
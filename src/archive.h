@@ -0,0 +1,69 @@
+/* archive.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ARCHIVE_MAX_PATH   1024
+#define ARCHIVE_PIECE_SIZE 65536
+
+enum {
+    ARCHIVE_GZIP,
+    ARCHIVE_LHA,
+    ARCHIVE_EOL
+} typedef ARCHIVE_TYPE;
+
+extern const char * archive_type_strs[];
+
+/* A member starts, size is its unpacked size (0 for gzip, which doesn't tell). A non-zero
+ * return value skips the member without unpacking it. */
+typedef int (*archive_begin_cb)(void * user, const char * path, uint32_t size);
+
+/* The next piece of the unpacked member. Pieces are ARCHIVE_PIECE_SIZE bytes, only the last
+ * one may be shorter, and are only valid during the call. A non-zero return value drops the
+ * rest of the member. */
+typedef int (*archive_data_cb)(void * user, const uint8_t * data, size_t size);
+
+/* The member is done, status is -1 if it was damaged or failed its CRC */
+typedef void (*archive_end_cb)(void * user, int status);
+
+struct {
+    int             fd;
+    const uint8_t * map;
+    size_t          map_size;
+    ARCHIVE_TYPE    type;
+    char            name[ARCHIVE_MAX_PATH];
+    uint8_t *       piece;
+    uint16_t        crc16_table[256];
+    uint32_t        member_cnt;
+    uint32_t        unsupported_cnt;
+} typedef archive;
+
+/* Recognizes gzip and LHA (levels 0-2) by their headers, not by the file name */
+archive * archive_open(const char * filename);
+
+/* Unpacks the members one after another, gzip and LHA -lh0-, -lz4- and -lh4- to -lh7-.
+ * Members with other methods are counted in unsupported_cnt and skipped. */
+int archive_walk(archive * p_arc, archive_begin_cb begin, archive_data_cb data, archive_end_cb end, void * user);
+
+void archive_close(archive * p_arc);
+
+#endif
@@ -0,0 +1,281 @@
+/* carve.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "carve.h"
+
+/* FORM and the renamed FORM of the obfuscated NEO files, all 4 bytes */
+static const char carve_magics[][5] = { "FORM", "NEO!" };
+
+#define CARVE_MAGIC_CNT (sizeof(carve_magics) / sizeof(carve_magics[0]))
+
+static inline int carve_is_magic(const uint8_t * p) {
+    for(uint32_t k = 0; k < CARVE_MAGIC_CNT; k++){
+        if(memcmp(p, carve_magics[k], 4) == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline int carve_is_id(const uint8_t * p) {
+    for(uint32_t i = 0; i < 4; i++){
+        if(p[i] < 0x20 || p[i] > 0x7e){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline uint32_t carve_be32(const uint8_t * p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static size_t carve_scan_scalar(const uint8_t * data, size_t size, size_t pos) {
+    for(; pos + 4 <= size; pos++){
+        if(carve_is_magic(&data[pos])){
+            return pos;
+        }
+    }
+    return size;
+}
+
+/* Each position is tested against the first and the last byte of every magic at once, only
+ * the few passing both are compared in full. The kernel is picked once at load time. */
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__ELF__)
+#define CARVE_SIMD_DISPATCH
+
+#include <immintrin.h>
+
+typedef size_t (*carve_scan_fn)(const uint8_t * data, size_t size, size_t pos);
+
+__attribute__((target("sse2")))
+static size_t carve_scan_sse2(const uint8_t * data, size_t size, size_t pos) {
+    __m128i first[CARVE_MAGIC_CNT];
+    __m128i last[CARVE_MAGIC_CNT];
+    for(uint32_t k = 0; k < CARVE_MAGIC_CNT; k++){
+        first[k] = _mm_set1_epi8(carve_magics[k][0]);
+        last[k] = _mm_set1_epi8(carve_magics[k][3]);
+    }
+
+    for(; pos + 16 + 3 <= size; pos += 16){
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)(data + pos));
+        const __m128i v3 = _mm_loadu_si128((const __m128i *)(data + pos + 3));
+        __m128i m = _mm_setzero_si128();
+        for(uint32_t k = 0; k < CARVE_MAGIC_CNT; k++){
+            m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(v0, first[k]), _mm_cmpeq_epi8(v3, last[k])));
+        }
+        for(uint32_t bits = _mm_movemask_epi8(m); bits != 0; bits &= bits - 1){
+            const size_t hit = pos + __builtin_ctz(bits);
+            if(carve_is_magic(&data[hit])){
+                return hit;
+            }
+        }
+    }
+    return carve_scan_scalar(data, size, pos);
+}
+
+__attribute__((target("avx2")))
+static size_t carve_scan_avx2(const uint8_t * data, size_t size, size_t pos) {
+    __m256i first[CARVE_MAGIC_CNT];
+    __m256i last[CARVE_MAGIC_CNT];
+    for(uint32_t k = 0; k < CARVE_MAGIC_CNT; k++){
+        first[k] = _mm256_set1_epi8(carve_magics[k][0]);
+        last[k] = _mm256_set1_epi8(carve_magics[k][3]);
+    }
+
+    /* 64 positions per round, two independent compare chains keep the load ports busy */
+    for(; pos + 64 + 3 <= size; pos += 64){
+        const __m256i a0 = _mm256_loadu_si256((const __m256i *)(data + pos));
+        const __m256i a3 = _mm256_loadu_si256((const __m256i *)(data + pos + 3));
+        const __m256i b0 = _mm256_loadu_si256((const __m256i *)(data + pos + 32));
+        const __m256i b3 = _mm256_loadu_si256((const __m256i *)(data + pos + 35));
+        __m256i ma = _mm256_setzero_si256();
+        __m256i mb = _mm256_setzero_si256();
+        for(uint32_t k = 0; k < CARVE_MAGIC_CNT; k++){
+            ma = _mm256_or_si256(ma, _mm256_and_si256(_mm256_cmpeq_epi8(a0, first[k]), _mm256_cmpeq_epi8(a3, last[k])));
+            mb = _mm256_or_si256(mb, _mm256_and_si256(_mm256_cmpeq_epi8(b0, first[k]), _mm256_cmpeq_epi8(b3, last[k])));
+        }
+        uint64_t bits = (uint32_t)_mm256_movemask_epi8(ma) | (uint64_t)(uint32_t)_mm256_movemask_epi8(mb) << 32;
+        for(; bits != 0; bits &= bits - 1){
+            const size_t hit = pos + __builtin_ctzll(bits);
+            if(carve_is_magic(&data[hit])){
+                return hit;
+            }
+        }
+    }
+    return carve_scan_sse2(data, size, pos);
+}
+
+static carve_scan_fn carve_scan_kernel = carve_scan_sse2;
+static const char *  carve_simd = "sse2";
+
+/* Not an ifunc resolver, which would run before a sanitizer runtime is set up */
+__attribute__((constructor))
+static void carve_simd_init(void) {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        carve_scan_kernel = carve_scan_avx2;
+        carve_simd = "avx2";
+    }
+}
+
+size_t carve_scan(const uint8_t * data, size_t size, size_t pos) {
+    return carve_scan_kernel(data, size, pos);
+}
+#else
+size_t carve_scan(const uint8_t * data, size_t size, size_t pos) {
+    return carve_scan_scalar(data, size, pos);
+}
+#endif
+
+const char * carve_simd_name(void) {
+#ifdef CARVE_SIMD_DISPATCH
+    return carve_simd;
+#else
+    return "scalar";
+#endif
+}
+
+carve * carve_open(const char * filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0){
+        close(fd);
+        return NULL;
+    }
+
+    carve * p_carve = (carve *)calloc(1, sizeof(carve));
+    if(p_carve == NULL){
+        close(fd);
+        return NULL;
+    }
+    p_carve->fd = fd;
+
+    /* Too small to hold an image, walks over nothing */
+    if(st.st_size < 12){
+        return p_carve;
+    }
+
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+        carve_close(p_carve);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    p_carve->map = (const uint8_t *)map;
+    p_carve->map_size = st.st_size;
+
+    return p_carve;
+}
+
+/* Follows the chunk headers behind the FORM type and returns where the image ends, 0 if the
+ * chunks don't hold together. With a FORM size that fits the file they have to fill it;
+ * without one they are followed until the chain breaks, another FORM starts or the file
+ * ends, which keeps images cut off at the end of the file. */
+static size_t carve_extent(const uint8_t * data, size_t size, size_t pos) {
+    if(pos + 12 + 8 > size || !carve_is_id(&data[pos + 8])){
+        return 0;
+    }
+
+    const uint64_t form_end = pos + 8 + (uint64_t)carve_be32(&data[pos + 4]);
+    const int sized = form_end >= pos + 12 + 8 && form_end <= size;
+    const uint64_t limit = sized ? form_end : size;
+
+    uint64_t at = pos + 12;
+    uint64_t last_end = at;
+    uint32_t chunk_cnt = 0;
+    while(at + 8 <= limit){
+        if(!carve_is_id(&data[at]) || (!sized && carve_is_magic(&data[at]))){
+            break;
+        }
+        const uint64_t chunk_end = at + 8 + carve_be32(&data[at + 4]);
+        if(chunk_end > limit){
+            if(sized){
+                return 0;
+            }
+            at = size;
+            chunk_cnt++;
+            break;
+        }
+        last_end = chunk_end;
+        at = chunk_end + ((chunk_end - at) & 1);
+        chunk_cnt++;
+    }
+    /* A last odd chunk written without its pad byte, the next image may start right after it */
+    if(!sized && at != last_end && at < size && !(at + 8 <= size && carve_is_id(&data[at]))){
+        at = last_end;
+    }
+
+    if(chunk_cnt < 2){
+        return 0;
+    }
+    if(sized){
+        return at + 8 > form_end ? form_end : 0;
+    }
+    return at < size ? at : size;
+}
+
+int carve_walk(carve * p_carve, ilbm_ctx * p_ctx, carve_found_cb found, void * user) {
+    const uint8_t * data = p_carve->map;
+    const size_t size = p_carve->map_size;
+
+    size_t pos = 0;
+    while((pos = carve_scan(data, size, pos)) < size){
+        p_carve->hit_cnt++;
+
+        /* Too big for the limits is still an image worth reporting */
+        ilbm_estimate est;
+        const size_t end = carve_extent(data, size, pos);
+        const ILBM_ERROR error = end != 0 ? ilbm_preflight(p_ctx, data + pos, end - pos, ILBM_FORMAT_AUTO, &est) : ILBM_ERROR_FORM_MISSING;
+        if(error != ILBM_OK && error != ILBM_ERROR_LIMIT){
+            pos++;
+            continue;
+        }
+
+        p_carve->found_cnt++;
+        if(found(user, pos, data + pos, end - pos) != 0){
+            break;
+        }
+        pos = end;
+    }
+
+    return 0;
+}
+
+void carve_close(carve * p_carve) {
+    if(p_carve == NULL){
+        return;
+    }
+    if(p_carve->map != NULL){
+        munmap((void *)p_carve->map, p_carve->map_size);
+    }
+    close(p_carve->fd);
+    free(p_carve);
+}
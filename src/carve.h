@@ -0,0 +1,54 @@
+/* carve.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CARVE_H
+#define CARVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libilbm.h"
+
+/* A FORM found in the file that passed the structure checks, data points into the mapping
+ * and stays valid until carve_close(). A non-zero return value stops the walk. */
+typedef int (*carve_found_cb)(void * user, uint64_t offset, const uint8_t * data, size_t size);
+
+struct {
+    int             fd;
+    const uint8_t * map;
+    size_t          map_size;
+    uint64_t        hit_cnt;
+    uint32_t        found_cnt;
+} typedef carve;
+
+carve * carve_open(const char * filename);
+
+/* Returns the offset of the next "FORM" or other known FORM magic at or after pos, size if
+ * there is none */
+size_t carve_scan(const uint8_t * data, size_t size, size_t pos);
+
+/* Scans the whole file for embedded images. A hit is kept when its chunks chain up to the
+ * FORM size (or, for writers that leave it at 0, up to where the chain breaks) and
+ * ilbm_preflight() finds a header it could decode. Scanning resumes behind each image. */
+int carve_walk(carve * p_carve, ilbm_ctx * p_ctx, carve_found_cb found, void * user);
+
+void carve_close(carve * p_carve);
+
+const char * carve_simd_name(void);
+
+#endif
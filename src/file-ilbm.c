@@ -29,8 +29,12 @@
 
 int read_image(const char * filename);
 
+int read_thumbnail(const char * filename, int thumb_size, int * p_width, int * p_height, int * p_type);
+
 const char LOAD_PROCEDURE_ILBM[] = "file-load-ilbm";
 
+const char LOAD_THUMB_PROCEDURE_ILBM[] = "file-load-ilbm-thumb";
+
 const char BINARY_NAME[] = "file-ilbm";
 
 const char BULLET_CHAR[] = "\xE2\x80\xA2";
@@ -48,6 +52,19 @@ static const GimpParamDef load_return_values[] = {
     { GIMP_PDB_IMAGE, "image", "Output image" }
 };
 
+static const GimpParamDef thumb_arguments[] = {
+    { GIMP_PDB_STRING, "filename",   "The name of the file to load" },
+    { GIMP_PDB_INT32,  "thumb-size", "Preferred thumbnail size" }
+};
+
+static const GimpParamDef thumb_return_values[] = {
+    { GIMP_PDB_IMAGE, "image",        "Thumbnail image" },
+    { GIMP_PDB_INT32, "image-width",  "Width of full-sized image" },
+    { GIMP_PDB_INT32, "image-height", "Height of full-sized image" },
+    { GIMP_PDB_INT32, "image-type",   "Type of full-sized image" },
+    { GIMP_PDB_INT32, "num-layers",   "Number of layers in full-sized image" }
+};
+
 GimpPlugInInfo PLUG_IN_INFO = {
     NULL,
     NULL,
@@ -80,11 +97,26 @@ static void query(void) {
         p_magic += snprintf(p_magic, sizeof(magics) - (p_magic - &magics[0]), "0,long,0x%02x%02x%02x%02x,", ilbm_magics[i][0], ilbm_magics[i][1], ilbm_magics[i][2], ilbm_magics[i][3]);
     }        
 
+    gimp_install_procedure(LOAD_THUMB_PROCEDURE_ILBM,
+                           "Load ILBM image thumbnails",
+                           "Load a downscaled preview of an ILBM image",
+                           "--",
+                           "Copyright Sascha Klick",
+                           "2024",
+                           NULL,
+                           NULL,
+                           GIMP_PLUGIN,
+                           G_N_ELEMENTS(thumb_arguments),
+                           G_N_ELEMENTS(thumb_return_values),
+                           thumb_arguments,
+                           thumb_return_values);
+
     gimp_register_magic_load_handler(LOAD_PROCEDURE_ILBM, "lbm,ilbm,pbm", "", magics);                
+    gimp_register_thumbnail_loader(LOAD_PROCEDURE_ILBM, LOAD_THUMB_PROCEDURE_ILBM);
 }
 
 static void run(const gchar * plugin_procedure_name, gint nparams, const GimpParam * param, gint * nreturn_vals, GimpParam ** return_vals) {
-    static GimpParam return_values[2];
+    static GimpParam return_values[6];
     GimpRunMode   run_mode;
 
     *nreturn_vals = 1;
@@ -118,6 +150,36 @@ static void run(const gchar * plugin_procedure_name, gint nparams, const GimpPar
         }
     }
             
+    else if(!strcmp(plugin_procedure_name, LOAD_THUMB_PROCEDURE_ILBM)) {
+        int new_image_id, width, height, type;
+
+        if(nparams != 2) {
+            return_values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
+            return;
+        }
+
+        new_image_id = read_thumbnail(param[0].data.d_string, param[1].data.d_int32, &width, &height, &type);
+
+        if(new_image_id == -1) {
+            return_values[0].data.d_status = GIMP_PDB_EXECUTION_ERROR;            
+        }
+
+        else {
+            *nreturn_vals = 6;
+
+            return_values[1].type         = GIMP_PDB_IMAGE;
+            return_values[1].data.d_image = new_image_id;
+            return_values[2].type         = GIMP_PDB_INT32;
+            return_values[2].data.d_int32 = width;
+            return_values[3].type         = GIMP_PDB_INT32;
+            return_values[3].data.d_int32 = height;
+            return_values[4].type         = GIMP_PDB_INT32;
+            return_values[4].data.d_int32 = type;
+            return_values[5].type         = GIMP_PDB_INT32;
+            return_values[5].data.d_int32 = 1;
+        }
+    }
+            
     else {
         return_values[0].data.d_status = GIMP_PDB_CALLING_ERROR;
     }
@@ -125,7 +187,6 @@ static void run(const gchar * plugin_procedure_name, gint nparams, const GimpPar
 }
 
 #include "libilbm.h"
-#include "libilbm.c"
 
 int read_image(const char * filename) {
     gint32 new_image_id,
@@ -151,6 +212,9 @@ int read_image(const char * filename) {
     uint32_t msg_i = 0;
     char msg[4096];
 
+    uint8_t * scratch = NULL;
+    size_t    scratch_size = 0;
+
     new_image_id = -1;
 
     ilbm_image * p_img = p_first;
@@ -169,40 +233,53 @@ int read_image(const char * filename) {
             bool alpha_as_mask = true;
 
             if(new_image_id == -1){
-                new_image_id = gimp_image_new(p_img->width, p_img->height, GIMP_INDEXED);
+                new_image_id = gimp_image_new(p_img->width, p_img->height, p_img->true_color ? GIMP_RGB : GIMP_INDEXED);
             }
 
-            new_layer_id = gimp_layer_new(new_image_id, "Image", p_img->width, p_img->height, p_img->alpha && !alpha_as_mask ? GIMP_INDEXEDA_IMAGE : GIMP_INDEXED_IMAGE, 100, GIMP_INDEXED_IMAGE);    
-            drawable = gimp_drawable_get(new_layer_id);                                
-            gimp_image_set_colormap(new_image_id, &(p_img->palette[0]), p_img->color_count);                
-            gimp_pixel_rgn_init(&rgn, drawable, 0, 0, p_img->width, p_img->height, true, false);    
-            if(p_img->alpha){
-                if(alpha_as_mask){
-                    gimp_pixel_rgn_set_rect(&rgn, p_img->pixels, 0, 0, p_img->width, p_img->height);
-                    
-                    gint32 mask_id = gimp_layer_create_mask(new_layer_id, GIMP_ADD_MASK_WHITE);
-
-                    gimp_layer_add_mask(new_layer_id, mask_id);
+            if(p_img->true_color){
+                /* 24 planes are decoded to RGBA with the mask already in the alpha byte */
+                new_layer_id = gimp_layer_new(new_image_id, "Image", p_img->width, p_img->height, GIMP_RGBA_IMAGE, 100, GIMP_NORMAL_MODE);
+                drawable = gimp_drawable_get(new_layer_id);
+                gimp_pixel_rgn_init(&rgn, drawable, 0, 0, p_img->width, p_img->height, true, false);
+                gimp_pixel_rgn_set_rect(&rgn, p_img->pixels, 0, 0, p_img->width, p_img->height);
+            }else{
+                new_layer_id = gimp_layer_new(new_image_id, "Image", p_img->width, p_img->height, p_img->alpha && !alpha_as_mask ? GIMP_INDEXEDA_IMAGE : GIMP_INDEXED_IMAGE, 100, GIMP_NORMAL_MODE);    
+                drawable = gimp_drawable_get(new_layer_id);                                
+                gimp_image_set_colormap(new_image_id, &(p_img->palette[0]), p_img->color_count);                
+                gimp_pixel_rgn_init(&rgn, drawable, 0, 0, p_img->width, p_img->height, true, false);    
+                if(p_img->alpha){
+                    if(alpha_as_mask){
+                        gimp_pixel_rgn_set_rect(&rgn, p_img->pixels, 0, 0, p_img->width, p_img->height);
                     
-                    const uint8_t black[] = { 0x00, 0x00, 0x00 };
-                    for(uint32_t i = 0; i < p_img->size; i++){
-                        if(p_img->alpha[i] == 0){                        
-                            gimp_drawable_set_pixel(mask_id, i % p_img->width, i / p_img->width, 1, black);                                                        
+                        gint32 mask_id = gimp_layer_create_mask(new_layer_id, GIMP_ADD_MASK_WHITE);
+
+                        gimp_layer_add_mask(new_layer_id, mask_id);
+
+                        /* alpha already holds 0x00/0xff per pixel, which is the mask channel's layout */
+                        GimpDrawable * mask = gimp_drawable_get(mask_id);
+                        GimpPixelRgn mask_rgn;
+                        gimp_pixel_rgn_init(&mask_rgn, mask, 0, 0, p_img->width, p_img->height, true, false);
+                        gimp_pixel_rgn_set_rect(&mask_rgn, p_img->alpha, 0, 0, p_img->width, p_img->height);
+                        gimp_drawable_flush(mask);
+                        gimp_drawable_detach(mask);
+                    }else{
+                        if(scratch_size < 2 * p_img->size){
+                            uint8_t * p_new = (uint8_t *)realloc(scratch, 2 * p_img->size);
+                            if(p_new == NULL){
+                                break;
+                            }
+                            scratch = p_new;
+                            scratch_size = 2 * p_img->size;
                         }
-                    }                    
-                }else{
-                    uint8_t * pixels = (uint8_t *)malloc(2 * p_img->size);
-                    if(pixels == NULL){
-                        break;
-                    }
-                    for(uint32_t i = 0; i < p_img->size; i++){
-                        pixels[i * 2 + 0] = p_img->pixels[i];
-                        pixels[i * 2 + 1] = p_img->alpha[i];
+                        for(uint32_t i = 0; i < p_img->size; i++){
+                            scratch[i * 2 + 0] = p_img->pixels[i];
+                            scratch[i * 2 + 1] = p_img->alpha[i];
+                        }
+                        gimp_pixel_rgn_set_rect(&rgn, scratch, 0, 0, p_img->width, p_img->height);
                     }
-                    gimp_pixel_rgn_set_rect(&rgn, pixels, 0, 0, p_img->width, p_img->height);
+                }else{
+                    gimp_pixel_rgn_set_rect(&rgn, p_img->pixels, 0, 0, p_img->width, p_img->height);
                 }
-            }else{
-                gimp_pixel_rgn_set_rect(&rgn, p_img->pixels, 0, 0, p_img->width, p_img->height);
             }
             gimp_drawable_flush(drawable);
             gimp_drawable_detach(drawable);    
@@ -240,7 +317,129 @@ int read_image(const char * filename) {
         gimp_message(msg);
     }
 
+    free(scratch);
+
+    ilbm_free(p_first);
+
+    return new_image_id;
+}
+
+/* Puts one pixel of a planar decode together from its bits, the way the decoder would have
+ * converted it: 24 planes are RGB, otherwise an index with the mask plane or trans_clr as alpha */
+static uint8_t * thumb_pixel(const ilbm_image * p_img, uint32_t x, uint32_t y, uint8_t * p_out) {
+    const size_t plane_size = (size_t)p_img->row_bytes * p_img->height;
+    const uint8_t * src = &p_img->planes[(size_t)y * p_img->row_bytes + (x >> 3)];
+    const uint8_t bit = 0x80 >> (x & 7);
+    const uint32_t num_planes = p_img->head.num_planes;
+
+    uint32_t value = 0;
+    for(uint32_t p = 0; p < num_planes; p++){
+        value |= (src[p * plane_size] & bit ? 1u : 0u) << p;
+    }
+    const uint8_t opaque = p_img->head.mask == 1 ? (src[num_planes * plane_size] & bit ? 0xff : 0x00) :
+                           p_img->head.mask == 2 && num_planes != 24 ? (value == (uint8_t)p_img->head.trans_clr ? 0x00 : 0xff) : 0xff;
+
+    if(p_img->true_color){
+        *p_out++ = value;
+        *p_out++ = value >> 8;
+        *p_out++ = value >> 16;
+        *p_out++ = opaque;
+    }else{
+        *p_out++ = value;
+        if(p_img->head.mask != 0){
+            *p_out++ = opaque;
+        }
+    }
+
+    return p_out;
+}
+
+int read_thumbnail(const char * filename, int thumb_size, int * p_width, int * p_height, int * p_type) {
+    FILE * file_p = fopen(filename, "rb");
+    if(file_p == NULL){
+        return -1;
+    }
+    
+    /* ILBM bodies are only unpacked, no planar to chunky conversion of pixels the thumbnail
+     * doesn't show. PBM bodies are chunky already and still end up in pixels. */
+    ilbm_ctx ctx;
+    ilbm_ctx_init(&ctx);
+    ctx.planar = 1;
+
+    ilbm_image * p_img = ilbm_read_ctx(&ctx, file_p, ILBM_FORMAT_AUTO);
+
+    ilbm_ctx_release(&ctx);
+
+    fclose(file_p);
+
+    if(p_img == NULL) {
+        return -1;
+    }
+    if(p_img->error != ILBM_OK || thumb_size <= 0) {
+        ilbm_free(p_img);
+        return -1;
+    }
+
+    *p_width  = p_img->width;
+    *p_height = p_img->height;
+    const int has_alpha = p_img->planes != NULL ? p_img->head.mask != 0 : p_img->alpha != NULL;
+    *p_type   = p_img->true_color ? GIMP_RGBA_IMAGE : has_alpha ? GIMP_INDEXEDA_IMAGE : GIMP_INDEXED_IMAGE;
+
+    /* Only the thumbnail sized drawable is sent to the core, sampled nearest-neighbour from the decoded indices. */
+    uint32_t max_dim = p_img->width > p_img->height ? p_img->width : p_img->height;
+    uint32_t t_width  = p_img->width;
+    uint32_t t_height = p_img->height;
+    if(max_dim > (uint32_t)thumb_size){
+        t_width  = p_img->width * thumb_size / max_dim;
+        t_height = p_img->height * thumb_size / max_dim;
+        if(t_width == 0) t_width = 1;
+        if(t_height == 0) t_height = 1;
+    }
+
+    const uint32_t bpp = p_img->true_color ? 4 : has_alpha ? 2 : 1;
+    uint8_t * pixels = (uint8_t *)malloc(t_width * t_height * bpp);
+    if(pixels == NULL){
+        ilbm_free(p_img);
+        return -1;
+    }
+
+    uint8_t * p_out = pixels;
+    for(uint32_t row = 0; row < t_height; row++){
+        const uint32_t row_i = (row * p_img->height / t_height) * p_img->width;
+        for(uint32_t col = 0; col < t_width; col++){
+            if(p_img->planes != NULL){
+                p_out = thumb_pixel(p_img, col * p_img->width / t_width, row * p_img->height / t_height, p_out);
+                continue;
+            }
+            const uint32_t p_i = row_i + col * p_img->width / t_width;
+            if(p_img->true_color){
+                memcpy(p_out, &p_img->pixels[p_i * 4], 4);
+                p_out += 4;
+                continue;
+            }
+            *p_out++ = p_img->pixels[p_i];
+            if(p_img->alpha){
+                *p_out++ = p_img->alpha[p_i];
+            }
+        }
+    }
+
+    gint32 new_image_id = gimp_image_new(t_width, t_height, p_img->true_color ? GIMP_RGB : GIMP_INDEXED);
+    if(!p_img->true_color){
+        gimp_image_set_colormap(new_image_id, &(p_img->palette[0]), p_img->color_count);                
+    }
+
+    gint32 new_layer_id = gimp_layer_new(new_image_id, "Thumbnail", t_width, t_height, *p_type, 100, GIMP_NORMAL_MODE);    
+    GimpDrawable * drawable = gimp_drawable_get(new_layer_id);                                
+    GimpPixelRgn rgn;
+    gimp_pixel_rgn_init(&rgn, drawable, 0, 0, t_width, t_height, true, false);    
+    gimp_pixel_rgn_set_rect(&rgn, pixels, 0, 0, t_width, t_height);
+    gimp_drawable_flush(drawable);
+    gimp_drawable_detach(drawable);    
+    gimp_image_insert_layer(new_image_id, new_layer_id, -1, 0);   
+
+    free(pixels);
     ilbm_free(p_img);
 
     return new_image_id;
-}
\ No newline at end of file
+}
@@ -0,0 +1,582 @@
+/* ilbm_atlas.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ilbm_atlas.h"
+#include "ilbm_export.h"
+
+#define ATLAS_CELL_STACK 256
+
+static inline int slice_opaque(const uint8_t * alpha, uint32_t x0, uint32_t x1) {
+    for(; x0 < x1; x0++){
+        if(alpha[x0] != 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint32_t ilbm_slice(ilbm_image * p_img, ilbm_rect * cells, uint32_t cell_max) {
+    const uint32_t width = p_img->width;
+    const uint8_t * alpha = p_img->alpha;
+
+    if(alpha == NULL){
+        if(cell_max > 0){
+            cells[0] = (ilbm_rect){ 0, 0, width, p_img->height };
+        }
+        return 1;
+    }
+
+    /* The decoder already found the box around the opaque pixels when it collected stats */
+    uint32_t x0 = 0;
+    uint32_t y0 = 0;
+    uint32_t x1 = width;
+    uint32_t y1 = p_img->height;
+    if(p_img->histogram != NULL){
+        x0 = p_img->opaque_x0;
+        y0 = p_img->opaque_y0;
+        x1 = p_img->opaque_x1;
+        y1 = p_img->opaque_y1;
+    }
+    if(x0 >= x1 || y0 >= y1){
+        return 0;
+    }
+
+    uint8_t * cols = (uint8_t *)malloc(width);
+    if(cols == NULL){
+        return 0;
+    }
+
+    uint32_t cell_cnt = 0;
+    for(uint32_t y = y0; y < y1; ){
+        while(y < y1 && !slice_opaque(&alpha[y * width], x0, x1)) y++;
+        const uint32_t band_y0 = y;
+        while(y < y1 && slice_opaque(&alpha[y * width], x0, x1)) y++;
+        const uint32_t band_y1 = y;
+        if(band_y0 == band_y1){
+            break;
+        }
+
+        memset(&cols[x0], 0, x1 - x0);
+        for(uint32_t row_no = band_y0; row_no < band_y1; row_no++){
+            const uint8_t * a = &alpha[row_no * width];
+            for(uint32_t x = x0; x < x1; x++){
+                cols[x] |= a[x];
+            }
+        }
+
+        for(uint32_t x = x0; x < x1; ){
+            while(x < x1 && cols[x] == 0) x++;
+            const uint32_t cell_x0 = x;
+            while(x < x1 && cols[x] != 0) x++;
+            if(cell_x0 == x){
+                break;
+            }
+
+            /* Every column of the cell is opaque somewhere in the band, both loops stop */
+            uint32_t cell_y0 = band_y0;
+            uint32_t cell_y1 = band_y1;
+            while(!slice_opaque(&alpha[cell_y0 * width], cell_x0, x)) cell_y0++;
+            while(!slice_opaque(&alpha[(cell_y1 - 1) * width], cell_x0, x)) cell_y1--;
+
+            if(cell_cnt < cell_max){
+                cells[cell_cnt] = (ilbm_rect){ cell_x0, cell_y0, x - cell_x0, cell_y1 - cell_y0 };
+            }
+            cell_cnt++;
+        }
+    }
+
+    free(cols);
+
+    return cell_cnt;
+}
+
+void ilbm_atlas_init(ilbm_atlas * p_atlas, uint32_t size) {
+    memset(p_atlas, 0, sizeof(ilbm_atlas));
+    pthread_mutex_init(&p_atlas->lock, NULL);
+    p_atlas->size = size ? size : ILBM_ATLAS_SIZE;
+}
+
+void ilbm_atlas_release(ilbm_atlas * p_atlas) {
+    for(uint32_t i = 0; i < p_atlas->sprite_cnt; i++){
+        free(p_atlas->sprites[i].path);
+        free(p_atlas->sprites[i].pixels);
+    }
+    free(p_atlas->sprites);
+    free(p_atlas->groups);
+    pthread_mutex_destroy(&p_atlas->lock);
+    memset(p_atlas, 0, sizeof(ilbm_atlas));
+}
+
+/* A transparent color that no opaque pixel of the cells uses: the one from BMHD if it's free,
+ * else the highest free index, -1 if all 256 are taken */
+static int32_t atlas_trans_clr(ilbm_image * p_img, const ilbm_rect * cells, uint32_t cell_cnt) {
+    if(p_img->alpha == NULL){
+        return -1;
+    }
+    if(p_img->head.mask == 2){
+        return p_img->head.trans_clr < 256 ? p_img->head.trans_clr : -1;
+    }
+
+    uint8_t used[256];
+    memset(used, 0, sizeof(used));
+    for(uint32_t i = 0; i < cell_cnt; i++){
+        for(uint32_t y = cells[i].y; y < cells[i].y + cells[i].height; y++){
+            const uint8_t * src = &p_img->pixels[y * p_img->width];
+            const uint8_t * alpha = &p_img->alpha[y * p_img->width];
+            for(uint32_t x = cells[i].x; x < cells[i].x + cells[i].width; x++){
+                used[src[x]] |= alpha[x] != 0;
+            }
+        }
+    }
+
+    if(p_img->head.trans_clr < 256 && !used[p_img->head.trans_clr]){
+        return p_img->head.trans_clr;
+    }
+    for(int32_t i = 255; i >= 0; i--){
+        if(!used[i]){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int atlas_grow(ilbm_atlas * p_atlas, uint32_t sprite_add) {
+    if(p_atlas->group_cnt == p_atlas->group_max){
+        const uint32_t group_max = p_atlas->group_max ? p_atlas->group_max * 2 : 16;
+        ilbm_atlas_group * groups = (ilbm_atlas_group *)realloc(p_atlas->groups, group_max * sizeof(ilbm_atlas_group));
+        if(groups == NULL){
+            return -1;
+        }
+        p_atlas->groups = groups;
+        p_atlas->group_max = group_max;
+    }
+
+    if(p_atlas->sprite_cnt + sprite_add > p_atlas->sprite_max){
+        uint32_t sprite_max = p_atlas->sprite_max ? p_atlas->sprite_max : 1024;
+        while(sprite_max < p_atlas->sprite_cnt + sprite_add){
+            sprite_max *= 2;
+        }
+        ilbm_atlas_sprite * sprites = (ilbm_atlas_sprite *)realloc(p_atlas->sprites, sprite_max * sizeof(ilbm_atlas_sprite));
+        if(sprites == NULL){
+            return -1;
+        }
+        p_atlas->sprites = sprites;
+        p_atlas->sprite_max = sprite_max;
+    }
+
+    return 0;
+}
+
+int ilbm_atlas_add(ilbm_atlas * p_atlas, ilbm_image * p_img, const char * path) {
+    if(p_img == NULL || p_img->error != ILBM_OK || p_img->pixels == NULL || p_img->true_color || p_img->palette == NULL){
+        return -1;
+    }
+
+    ilbm_rect cell_stack[ATLAS_CELL_STACK];
+    ilbm_rect * cells = cell_stack;
+    uint32_t cell_cnt = ilbm_slice(p_img, cells, ATLAS_CELL_STACK);
+    if(cell_cnt > ATLAS_CELL_STACK){
+        cells = (ilbm_rect *)malloc(cell_cnt * sizeof(ilbm_rect));
+        if(cells == NULL){
+            return -1;
+        }
+        ilbm_slice(p_img, cells, cell_cnt);
+    }
+
+    ilbm_atlas_group group;
+    memset(&group, 0, sizeof(group));
+    memcpy(group.palette, p_img->palette, (p_img->color_count < 256 ? p_img->color_count : 256) * 3);
+    group.trans_clr = atlas_trans_clr(p_img, cells, cell_cnt);
+
+    /* The pixels are copied before taking the lock, only the bookkeeping is serialized */
+    ilbm_atlas_sprite * sprites = (ilbm_atlas_sprite *)calloc(cell_cnt + 1, sizeof(ilbm_atlas_sprite));
+    int ret = sprites != NULL ? (int)cell_cnt : -1;
+    for(uint32_t i = 0; ret >= 0 && i < cell_cnt; i++){
+        const ilbm_rect * p_cell = &cells[i];
+        ilbm_atlas_sprite * p_sprite = &sprites[i];
+
+        p_sprite->path = strdup(path);
+        p_sprite->pixels = (uint8_t *)malloc(p_cell->width * p_cell->height);
+        if(p_sprite->path == NULL || p_sprite->pixels == NULL){
+            ret = -1;
+            break;
+        }
+        p_sprite->cell = i;
+        p_sprite->src = *p_cell;
+        p_sprite->has_hot = p_img->has_grab;
+        p_sprite->hot_x = p_img->grab_x - (int32_t)p_cell->x;
+        p_sprite->hot_y = p_img->grab_y - (int32_t)p_cell->y;
+
+        for(uint32_t y = 0; y < p_cell->height; y++){
+            const uint32_t row_i = (p_cell->y + y) * p_img->width + p_cell->x;
+            uint8_t * dst = &p_sprite->pixels[y * p_cell->width];
+            memcpy(dst, &p_img->pixels[row_i], p_cell->width);
+            if(p_img->alpha != NULL && group.trans_clr >= 0){
+                const uint8_t * alpha = &p_img->alpha[row_i];
+                for(uint32_t x = 0; x < p_cell->width; x++){
+                    dst[x] = alpha[x] ? dst[x] : group.trans_clr;
+                }
+            }
+        }
+    }
+
+    if(cells != cell_stack){
+        free(cells);
+    }
+
+    if(ret > 0){
+        pthread_mutex_lock(&p_atlas->lock);
+
+        if(atlas_grow(p_atlas, cell_cnt) == 0){
+            uint32_t group_i = 0;
+            while(group_i < p_atlas->group_cnt && memcmp(&p_atlas->groups[group_i], &group, sizeof(group)) != 0){
+                group_i++;
+            }
+            if(group_i == p_atlas->group_cnt){
+                p_atlas->groups[p_atlas->group_cnt++] = group;
+            }
+            for(uint32_t i = 0; i < cell_cnt; i++){
+                sprites[i].group = group_i;
+                p_atlas->sprites[p_atlas->sprite_cnt++] = sprites[i];
+            }
+        }else{
+            ret = -1;
+        }
+
+        pthread_mutex_unlock(&p_atlas->lock);
+    }
+
+    if(ret < 0 && sprites != NULL){
+        for(uint32_t i = 0; i < cell_cnt; i++){
+            free(sprites[i].path);
+            free(sprites[i].pixels);
+        }
+    }
+    free(sprites);
+
+    return ret;
+}
+
+/* The skyline is the top edge of everything placed so far, as segments left to right */
+struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+} typedef skyline_seg;
+
+struct {
+    skyline_seg * segs;
+    uint32_t      seg_cnt;
+    uint32_t      used_w;
+    uint32_t      used_h;
+} typedef atlas_page;
+
+static int skyline_fit(const atlas_page * p_page, uint32_t seg_i, uint32_t w, uint32_t h, uint32_t bin, uint32_t * p_y) {
+    const skyline_seg * segs = p_page->segs;
+    if(segs[seg_i].x + w > bin){
+        return 0;
+    }
+
+    /* The segments cover the whole width, the rect can't run past the last one */
+    uint32_t y = 0;
+    for(uint32_t left = w; left > 0; seg_i++){
+        y = segs[seg_i].y > y ? segs[seg_i].y : y;
+        if(y + h > bin){
+            return 0;
+        }
+        left -= left < segs[seg_i].width ? left : segs[seg_i].width;
+    }
+
+    *p_y = y;
+    return 1;
+}
+
+/* Bottom-left: the position with the lowest top edge, the leftmost of those */
+static int skyline_insert(atlas_page * p_page, uint32_t w, uint32_t h, uint32_t bin, uint32_t * p_x, uint32_t * p_y) {
+    skyline_seg * segs = p_page->segs;
+    uint32_t best = UINT32_MAX;
+    uint32_t best_top = UINT32_MAX;
+
+    for(uint32_t i = 0; i < p_page->seg_cnt; i++){
+        uint32_t y;
+        if(skyline_fit(p_page, i, w, h, bin, &y) && y + h < best_top){
+            best = i;
+            best_top = y + h;
+        }
+    }
+    if(best == UINT32_MAX){
+        return 0;
+    }
+
+    const uint32_t x = segs[best].x;
+    memmove(&segs[best + 1], &segs[best], (p_page->seg_cnt - best) * sizeof(skyline_seg));
+    segs[best] = (skyline_seg){ x, best_top, w };
+    p_page->seg_cnt++;
+
+    /* Cut away what the new segment shadows */
+    for(uint32_t i = best + 1; i < p_page->seg_cnt; ){
+        if(segs[i].x >= x + w){
+            break;
+        }
+        const uint32_t shrink = x + w - segs[i].x;
+        if(segs[i].width > shrink){
+            segs[i].x += shrink;
+            segs[i].width -= shrink;
+            break;
+        }
+        memmove(&segs[i], &segs[i + 1], (p_page->seg_cnt - i - 1) * sizeof(skyline_seg));
+        p_page->seg_cnt--;
+    }
+
+    for(uint32_t i = 0; i + 1 < p_page->seg_cnt; ){
+        if(segs[i].y == segs[i + 1].y){
+            segs[i].width += segs[i + 1].width;
+            memmove(&segs[i + 1], &segs[i + 2], (p_page->seg_cnt - i - 2) * sizeof(skyline_seg));
+            p_page->seg_cnt--;
+        }else{
+            i++;
+        }
+    }
+
+    *p_x = x;
+    *p_y = best_top - h;
+    return 1;
+}
+
+static int atlas_group_cmp(const void * a, const void * b) {
+    const ilbm_atlas_group * p_a = (const ilbm_atlas_group *)a;
+    const ilbm_atlas_group * p_b = (const ilbm_atlas_group *)b;
+
+    int cmp = memcmp(p_a->palette, p_b->palette, sizeof(p_a->palette));
+    if(cmp != 0) return cmp;
+    return p_a->trans_clr < p_b->trans_clr ? -1 : p_a->trans_clr > p_b->trans_clr;
+}
+
+static int atlas_sprite_cmp(const void * a, const void * b) {
+    const ilbm_atlas_sprite * p_a = (const ilbm_atlas_sprite *)a;
+    const ilbm_atlas_sprite * p_b = (const ilbm_atlas_sprite *)b;
+
+    if(p_a->group != p_b->group) return p_a->group < p_b->group ? -1 : 1;
+    if(p_a->src.height != p_b->src.height) return p_a->src.height > p_b->src.height ? -1 : 1;
+    if(p_a->src.width != p_b->src.width) return p_a->src.width > p_b->src.width ? -1 : 1;
+    int cmp = strcmp(p_a->path, p_b->path);
+    if(cmp != 0) return cmp;
+    return p_a->cell < p_b->cell ? -1 : p_a->cell > p_b->cell;
+}
+
+/* Groups and sprites are sorted first, the pages come out the same whatever order the
+ * worker threads added the images in */
+static int atlas_sort(ilbm_atlas * p_atlas) {
+    ilbm_atlas_group * sorted = (ilbm_atlas_group *)malloc((p_atlas->group_cnt + 1) * sizeof(ilbm_atlas_group));
+    uint32_t * rank = (uint32_t *)malloc((p_atlas->group_cnt + 1) * sizeof(uint32_t));
+    if(sorted == NULL || rank == NULL){
+        free(sorted);
+        free(rank);
+        return -1;
+    }
+
+    memcpy(sorted, p_atlas->groups, p_atlas->group_cnt * sizeof(ilbm_atlas_group));
+    qsort(sorted, p_atlas->group_cnt, sizeof(ilbm_atlas_group), atlas_group_cmp);
+    for(uint32_t i = 0; i < p_atlas->group_cnt; i++){
+        ilbm_atlas_group * p_found = (ilbm_atlas_group *)bsearch(&p_atlas->groups[i], sorted, p_atlas->group_cnt, sizeof(ilbm_atlas_group), atlas_group_cmp);
+        rank[i] = p_found - sorted;
+    }
+    for(uint32_t i = 0; i < p_atlas->sprite_cnt; i++){
+        p_atlas->sprites[i].group = rank[p_atlas->sprites[i].group];
+    }
+    memcpy(p_atlas->groups, sorted, p_atlas->group_cnt * sizeof(ilbm_atlas_group));
+    qsort(p_atlas->sprites, p_atlas->sprite_cnt, sizeof(ilbm_atlas_sprite), atlas_sprite_cmp);
+
+    free(sorted);
+    free(rank);
+
+    return 0;
+}
+
+static int atlas_write_page(ilbm_atlas * p_atlas, const char * dir, uint32_t group_i, uint32_t page_i, const atlas_page * p_page, ilbm_atlas_sprite * sprites, uint32_t sprite_cnt) {
+    ilbm_atlas_group * p_group = &p_atlas->groups[group_i];
+    const uint32_t width = p_page->used_w;
+    const uint32_t height = p_page->used_h;
+
+    ilbm_image page;
+    memset(&page, 0, sizeof(page));
+    page.format = ILBM_FORMAT_PBM;
+    page.head.width = width;
+    page.head.height = height;
+    page.head.num_planes = 8;
+    page.width = width;
+    page.height = height;
+    page.size = width * height;
+    page.color_count = 256;
+    page.palette = p_group->palette;
+    page.error = ILBM_OK;
+    page.pixels = (uint8_t *)malloc(page.size);
+    if(page.pixels == NULL){
+        return -1;
+    }
+    memset(page.pixels, p_group->trans_clr >= 0 ? p_group->trans_clr : 0, page.size);
+
+    for(uint32_t i = 0; i < sprite_cnt; i++){
+        const ilbm_atlas_sprite * p_sprite = &sprites[i];
+        if(p_sprite->page != page_i){
+            continue;
+        }
+        for(uint32_t y = 0; y < p_sprite->src.height; y++){
+            memcpy(&page.pixels[(p_sprite->y + y) * width + p_sprite->x], &p_sprite->pixels[y * p_sprite->src.width], p_sprite->src.width);
+        }
+    }
+
+    if(p_group->trans_clr >= 0){
+        page.head.mask = 2;
+        page.head.trans_clr = p_group->trans_clr;
+        page.alpha = (uint8_t *)malloc(page.size);
+        if(page.alpha == NULL){
+            free(page.pixels);
+            return -1;
+        }
+        for(uint32_t i = 0; i < page.size; i++){
+            page.alpha[i] = page.pixels[i] == p_group->trans_clr ? 0x00 : 0xff;
+        }
+    }
+
+    char out_path[4096];
+    snprintf(out_path, sizeof(out_path), "%s/atlas_%u_%u.png", dir, group_i, page_i);
+
+    int ret = -1;
+    FILE * file_p = fopen(out_path, "wb");
+    if(file_p != NULL){
+        ret = ilbm_write_png(file_p, &page);
+        if(fclose(file_p) != 0){
+            ret = -1;
+        }
+    }
+
+    free(page.pixels);
+    free(page.alpha);
+
+    return ret;
+}
+
+int ilbm_atlas_write(ilbm_atlas * p_atlas, const char * dir) {
+    const uint32_t size = p_atlas->size;
+    const uint32_t bin = size + ILBM_ATLAS_PADDING;
+
+    pthread_mutex_lock(&p_atlas->lock);
+
+    int page_cnt = atlas_sort(p_atlas);
+
+    atlas_page * pages = NULL;
+    uint32_t page_max = 0;
+
+    for(uint32_t start = 0, end; page_cnt >= 0 && start < p_atlas->sprite_cnt; start = end){
+        const uint32_t group_i = p_atlas->sprites[start].group;
+        for(end = start + 1; end < p_atlas->sprite_cnt && p_atlas->sprites[end].group == group_i; end++);
+
+        uint32_t group_pages = 0;
+        for(uint32_t i = start; i < end && page_cnt >= 0; i++){
+            ilbm_atlas_sprite * p_sprite = &p_atlas->sprites[i];
+            const uint32_t w = p_sprite->src.width + ILBM_ATLAS_PADDING;
+            const uint32_t h = p_sprite->src.height + ILBM_ATLAS_PADDING;
+
+            /* Too big for a page, left out of the manifest */
+            p_sprite->page = UINT32_MAX;
+            if(w > bin || h > bin){
+                continue;
+            }
+
+            for(uint32_t page_i = 0; page_i <= group_pages; page_i++){
+                if(page_i == group_pages){
+                    if(group_pages == page_max){
+                        page_max = page_max ? page_max * 2 : 4;
+                        atlas_page * grown = (atlas_page *)realloc(pages, page_max * sizeof(atlas_page));
+                        if(grown == NULL){
+                            page_cnt = -1;
+                            break;
+                        }
+                        pages = grown;
+                    }
+                    atlas_page * p_page = &pages[group_pages];
+                    p_page->segs = (skyline_seg *)malloc((bin + 1) * sizeof(skyline_seg));
+                    if(p_page->segs == NULL){
+                        page_cnt = -1;
+                        break;
+                    }
+                    p_page->segs[0] = (skyline_seg){ 0, 0, bin };
+                    p_page->seg_cnt = 1;
+                    p_page->used_w = 0;
+                    p_page->used_h = 0;
+                    group_pages++;
+                }
+
+                atlas_page * p_page = &pages[page_i];
+                if(skyline_insert(p_page, w, h, bin, &p_sprite->x, &p_sprite->y)){
+                    p_sprite->page = page_i;
+                    if(p_sprite->x + p_sprite->src.width > p_page->used_w) p_page->used_w = p_sprite->x + p_sprite->src.width;
+                    if(p_sprite->y + p_sprite->src.height > p_page->used_h) p_page->used_h = p_sprite->y + p_sprite->src.height;
+                    break;
+                }
+            }
+        }
+
+        for(uint32_t page_i = 0; page_i < group_pages; page_i++){
+            if(page_cnt >= 0){
+                if(atlas_write_page(p_atlas, dir, group_i, page_i, &pages[page_i], &p_atlas->sprites[start], end - start) != 0){
+                    page_cnt = -1;
+                }else{
+                    page_cnt++;
+                }
+            }
+            free(pages[page_i].segs);
+        }
+    }
+
+    free(pages);
+
+    char out_path[4096];
+    snprintf(out_path, sizeof(out_path), "%s/atlas.csv", dir);
+
+    FILE * file_p = page_cnt >= 0 ? fopen(out_path, "w") : NULL;
+    if(file_p != NULL){
+        fprintf(file_p, "atlas,x,y,width,height,source,src_x,src_y,hot_x,hot_y\n");
+        for(uint32_t i = 0; i < p_atlas->sprite_cnt; i++){
+            const ilbm_atlas_sprite * p_sprite = &p_atlas->sprites[i];
+            if(p_sprite->page == UINT32_MAX){
+                continue;
+            }
+            fprintf(file_p, "atlas_%u_%u.png,%u,%u,%u,%u,\"%s\",%u,%u,", p_sprite->group, p_sprite->page, p_sprite->x, p_sprite->y, p_sprite->src.width, p_sprite->src.height, p_sprite->path, p_sprite->src.x, p_sprite->src.y);
+            if(p_sprite->has_hot){
+                fprintf(file_p, "%d,%d\n", p_sprite->hot_x, p_sprite->hot_y);
+            }else{
+                fprintf(file_p, ",\n");
+            }
+        }
+        if(fclose(file_p) != 0){
+            page_cnt = -1;
+        }
+    }else{
+        page_cnt = -1;
+    }
+
+    pthread_mutex_unlock(&p_atlas->lock);
+
+    return page_cnt;
+}
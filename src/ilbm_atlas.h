@@ -0,0 +1,92 @@
+/* ilbm_atlas.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ILBM_ATLAS_H
+#define ILBM_ATLAS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "libilbm.h"
+
+#define ILBM_ATLAS_SIZE    1024
+#define ILBM_ATLAS_PADDING 1
+
+struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} typedef ilbm_rect;
+
+/* One sprite cut out of a source image, indices with the transparent pixels set to the
+ * transparent color of its group */
+struct {
+    char *    path;
+    uint32_t  cell;
+    ilbm_rect src;
+    uint8_t   has_hot;
+    int32_t   hot_x;
+    int32_t   hot_y;
+    uint32_t  group;
+    uint8_t * pixels;
+    uint32_t  page;
+    uint32_t  x;
+    uint32_t  y;
+} typedef ilbm_atlas_sprite;
+
+/* Sprites sharing a palette and transparent color (-1 for none) go onto the same pages */
+struct {
+    uint8_t  palette[256 * 3];
+    int32_t  trans_clr;
+} typedef ilbm_atlas_group;
+
+/* Collects the sprites of all decoded images, safe to add to from several threads */
+struct {
+    pthread_mutex_t     lock;
+    uint32_t            size;
+    ilbm_atlas_group *  groups;
+    uint32_t            group_cnt;
+    uint32_t            group_max;
+    ilbm_atlas_sprite * sprites;
+    uint32_t            sprite_cnt;
+    uint32_t            sprite_max;
+} typedef ilbm_atlas;
+
+/* Cuts the image into sprite cells along fully transparent rows, then along fully
+ * transparent columns within each band of rows, each cell trimmed to its opaque pixels.
+ * Images without alpha are a single cell. Returns the number of cells, which may be more
+ * than cell_max, only the first cell_max are stored. */
+uint32_t ilbm_slice(ilbm_image * p_img, ilbm_rect * cells, uint32_t cell_max);
+
+void ilbm_atlas_init(ilbm_atlas * p_atlas, uint32_t size);
+
+void ilbm_atlas_release(ilbm_atlas * p_atlas);
+
+/* Slices an indexed image and copies its cells in. Returns the number of sprites added or
+ * -1 if the image can't go into an atlas. */
+int ilbm_atlas_add(ilbm_atlas * p_atlas, ilbm_image * p_img, const char * path);
+
+/* Packs every group onto size x size pages with a skyline bottom-left packer, tallest
+ * sprites first, and writes them as atlas_<group>_<page>.png plus atlas.csv listing
+ * "atlas,x,y,width,height,source,src_x,src_y,hot_x,hot_y" for every sprite. The hotspot
+ * comes from GRAB, relative to the sprite, and is empty without one. Returns the number of
+ * pages written or -1. */
+int ilbm_atlas_write(ilbm_atlas * p_atlas, const char * dir);
+
+#endif
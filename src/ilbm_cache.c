@@ -0,0 +1,383 @@
+/* ilbm_cache.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ilbm_cache.h"
+
+#define CACHE_EXT ".ilbmc"
+
+/* The cycles hold doubles and come first, right after the header */
+#define CACHE_DATA_AT ((sizeof(ilbm_cache_head) + 7) & ~(size_t)7)
+
+struct {
+    char     name[32];
+    time_t   mtime;
+    uint64_t size;
+} typedef cache_file;
+
+static uint32_t cache_tmp_no = 0;
+
+static int cache_path(const ilbm_cache * p_cache, uint64_t key, char * buf, size_t len) {
+    return snprintf(buf, len, "%s/%016llx" CACHE_EXT, p_cache->dir, (unsigned long long)key) < (int)len ? 0 : -1;
+}
+
+static int cache_is_entry(const char * name) {
+    return strlen(name) == 16 + strlen(CACHE_EXT) && strcmp(name + 16, CACHE_EXT) == 0;
+}
+
+/* Adds up the sizes of all entries, and lists them when p_files is given */
+static uint64_t cache_scan(ilbm_cache * p_cache, cache_file ** p_files, uint32_t * p_cnt) {
+    uint64_t     bytes = 0;
+    uint32_t     cnt = 0;
+    uint32_t     max = 0;
+    cache_file * files = NULL;
+
+    DIR * dir_p = opendir(p_cache->dir);
+    if(dir_p == NULL){
+        return 0;
+    }
+
+    struct dirent * ent;
+    while((ent = readdir(dir_p)) != NULL){
+        struct stat st;
+        if(!cache_is_entry(ent->d_name) || fstatat(dirfd(dir_p), ent->d_name, &st, 0) != 0){
+            continue;
+        }
+        bytes += st.st_size;
+
+        if(p_files == NULL){
+            continue;
+        }
+        if(cnt == max){
+            max = max ? max * 2 : 1024;
+            cache_file * grown = (cache_file *)realloc(files, max * sizeof(cache_file));
+            if(grown == NULL){
+                break;
+            }
+            files = grown;
+        }
+        snprintf(files[cnt].name, sizeof(files[cnt].name), "%s", ent->d_name);
+        files[cnt].mtime = st.st_mtime;
+        files[cnt].size = st.st_size;
+        cnt++;
+    }
+    closedir(dir_p);
+
+    if(p_files != NULL){
+        *p_files = files;
+        *p_cnt = cnt;
+    }
+    return bytes;
+}
+
+static int cache_file_cmp(const void * a, const void * b) {
+    const cache_file * p_a = (const cache_file *)a;
+    const cache_file * p_b = (const cache_file *)b;
+
+    if(p_a->mtime != p_b->mtime) return p_a->mtime < p_b->mtime ? -1 : 1;
+    return strcmp(p_a->name, p_b->name);
+}
+
+/* Removes the least recently used entries, a hit renews the mtime of its file. Going down to 3/4
+ * of the limit keeps this rare, it lists the whole directory. Called with the lock held. */
+static void cache_evict(ilbm_cache * p_cache) {
+    cache_file * files = NULL;
+    uint32_t     cnt = 0;
+    uint64_t     bytes = cache_scan(p_cache, &files, &cnt);
+
+    qsort(files, cnt, sizeof(cache_file), cache_file_cmp);
+
+    for(uint32_t i = 0; i < cnt && bytes > p_cache->max_bytes / 4 * 3; i++){
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", p_cache->dir, files[i].name);
+        if(unlink(path) == 0){
+            bytes -= files[i].size;
+            p_cache->stats.evictions++;
+        }
+    }
+    free(files);
+
+    p_cache->stats.bytes = bytes;
+}
+
+int ilbm_cache_open(ilbm_cache * p_cache, const char * dir, uint64_t max_bytes, int store_pixels) {
+    memset(p_cache, 0, sizeof(ilbm_cache));
+
+    mkdir(dir, 0777);
+
+    struct stat st;
+    if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)){
+        return -1;
+    }
+
+    p_cache->dir = strdup(dir);
+    if(p_cache->dir == NULL){
+        return -1;
+    }
+    p_cache->max_bytes = max_bytes;
+    p_cache->store_pixels = store_pixels;
+    pthread_mutex_init(&p_cache->lock, NULL);
+
+    p_cache->stats.bytes = cache_scan(p_cache, NULL, NULL);
+
+    return 0;
+}
+
+void ilbm_cache_close(ilbm_cache * p_cache) {
+    if(p_cache->dir == NULL){
+        return;
+    }
+    free(p_cache->dir);
+    pthread_mutex_destroy(&p_cache->lock);
+    memset(p_cache, 0, sizeof(ilbm_cache));
+}
+
+uint64_t ilbm_cache_key(const uint8_t * data, size_t size, ILBM_FORMAT format) {
+    return ilbm_hash_data((uint64_t)ILBM_CACHE_VERSION << 8 | format, data, size);
+}
+
+static uint32_t cache_head_check(const ilbm_cache_head * h) {
+    ilbm_cache_head copy = *h;
+    copy.check = 0;
+    return (uint32_t)ilbm_hash_data(ILBM_CACHE_MAGIC, (const uint8_t *)&copy, sizeof(copy));
+}
+
+/* Checks a mapped entry against what was asked for and points an image into it */
+static ilbm_cache_view * cache_view(void * map, size_t map_size, uint64_t key, uint64_t data_size) {
+    const ilbm_cache_head * h = (const ilbm_cache_head *)map;
+
+    if(h->magic != ILBM_CACHE_MAGIC || h->version != ILBM_CACHE_VERSION || h->key != key || h->data_size != data_size ||
+       h->check != cache_head_check(h)){
+        return NULL;
+    }
+
+    const uint64_t size = (uint64_t)h->width * h->height;
+    const uint64_t cycle_bytes = (uint64_t)h->cycle_count * sizeof(ilbm_cycle);
+    if(CACHE_DATA_AT + cycle_bytes + h->palette_bytes + h->pixel_bytes + h->alpha_bytes > map_size ||
+       h->palette_bytes < h->color_count * 3 || (h->pixel_bytes != 0 && h->pixel_bytes != size * (h->true_color ? 4 : 1)) ||
+       (h->alpha_bytes != 0 && h->alpha_bytes != size) || h->roles >= (1 << ILBM_ROLE_EOL)){
+        return NULL;
+    }
+
+    ilbm_cache_view * p_view = (ilbm_cache_view *)calloc(1, sizeof(ilbm_cache_view));
+    if(p_view == NULL){
+        return NULL;
+    }
+    p_view->map = map;
+    p_view->map_size = map_size;
+    p_view->has_hash = h->has_hash;
+    p_view->has_pixels = h->has_pixels;
+    p_view->hash = h->hash;
+    memcpy(p_view->form_type, h->form_type, 4);
+
+    ilbm_image * p_img = &p_view->img;
+    p_img->error = (ILBM_ERROR)h->error;
+    p_img->warnings = h->warnings;
+    p_img->format = (ILBM_FORMAT)h->format;
+    p_img->head = h->head;
+    p_img->width = h->width;
+    p_img->height = h->height;
+    p_img->size = size;
+    p_img->true_color = h->true_color;
+    p_img->color_count = h->color_count;
+    p_img->cycle_count = h->cycle_count;
+
+    /* The cycles are the only part past the header that is used as indices */
+    uint8_t * data = (uint8_t *)map + CACHE_DATA_AT;
+    for(uint32_t i = 0; i < h->cycle_count; i++){
+        const ilbm_cycle * p_cycle = &((const ilbm_cycle *)data)[i];
+        if(p_cycle->high <= p_cycle->low || p_cycle->high + 1u > h->color_count){
+            free(p_view);
+            return NULL;
+        }
+    }
+    p_img->cycles = h->cycle_count ? (ilbm_cycle *)data : NULL;
+    data += cycle_bytes;
+    p_img->palette = h->palette_bytes ? data : NULL;
+    data += h->palette_bytes;
+    p_img->pixels = h->pixel_bytes ? data : NULL;
+    data += h->pixel_bytes;
+    p_img->alpha = h->alpha_bytes ? data : NULL;
+
+    ilbm_chunk ** roles[ILBM_ROLE_EOL] = { &p_img->form_chunk, &p_img->bmhd_chunk, &p_img->cmap_chunk, &p_img->body_chunk };
+    for(uint32_t r = 0; r < ILBM_ROLE_EOL; r++){
+        if(h->roles & (1 << r)){
+            memcpy(p_view->chunks[r].name, h->role[r].name, 4);
+            p_view->chunks[r].addr = h->role[r].addr;
+            *roles[r] = &p_view->chunks[r];
+        }
+    }
+    p_view->chunks[ILBM_ROLE_FORM].content = (uint8_t *)p_view->form_type;
+
+    return p_view;
+}
+
+ilbm_cache_view * ilbm_cache_lookup(ilbm_cache * p_cache, uint64_t key, uint64_t data_size, int need_pixels, int * p_found) {
+    ilbm_cache_view * p_view = NULL;
+    int               found = 0;
+
+    char path[4096];
+    const int fd = cache_path(p_cache, key, path, sizeof(path)) == 0 ? open(path, O_RDONLY) : -1;
+
+    struct stat st;
+    if(fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= CACHE_DATA_AT){
+        /* Private and writable, whatever touches the image only changes its own copy */
+        void * map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED){
+            p_view = cache_view(map, st.st_size, key, data_size);
+            found = p_view != NULL;
+            if(p_view != NULL && need_pixels && !p_view->has_pixels && p_view->img.error == ILBM_OK){
+                free(p_view);
+                p_view = NULL;
+            }
+            if(p_view == NULL){
+                munmap(map, st.st_size);
+            }else{
+                futimens(fd, NULL);
+            }
+        }
+    }
+    if(fd >= 0){
+        close(fd);
+    }
+
+    __atomic_fetch_add(p_view != NULL ? &p_cache->stats.hits : &p_cache->stats.misses, 1, __ATOMIC_RELAXED);
+
+    if(p_found != NULL){
+        *p_found = found;
+    }
+    return p_view;
+}
+
+void ilbm_cache_view_free(ilbm_cache_view * p_view) {
+    if(p_view == NULL){
+        return;
+    }
+    munmap(p_view->map, p_view->map_size);
+    free(p_view);
+}
+
+int ilbm_cache_store(ilbm_cache * p_cache, uint64_t key, uint64_t data_size, ilbm_image * p_img, const ilbm_hash * p_hash) {
+    ilbm_cache_head h;
+    memset(&h, 0, sizeof(h));
+
+    h.magic = ILBM_CACHE_MAGIC;
+    h.version = ILBM_CACHE_VERSION;
+    h.key = key;
+    h.data_size = data_size;
+    h.error = p_img->error;
+    h.warnings = p_img->warnings;
+    h.format = p_img->format;
+
+    const ilbm_chunk * roles[ILBM_ROLE_EOL] = { p_img->form_chunk, p_img->bmhd_chunk, p_img->cmap_chunk, p_img->body_chunk };
+    for(uint32_t r = 0; r < ILBM_ROLE_EOL; r++){
+        if(roles[r] != NULL){
+            h.roles |= 1 << r;
+            memcpy(h.role[r].name, roles[r]->name, 4);
+            h.role[r].addr = roles[r]->addr;
+        }
+    }
+    if(p_img->form_chunk != NULL && p_img->form_chunk->content != NULL){
+        memcpy(h.form_type, p_img->form_chunk->content, 4);
+    }
+
+    /* Everything past the header is only known once the header was parsed */
+    if(p_img->bmhd_chunk != NULL){
+        h.head = p_img->head;
+        h.true_color = p_img->true_color;
+        h.width = p_img->width;
+        h.height = p_img->height;
+    }
+    /* Padded to 256 colors, indices past the CMAP read black instead of the next section */
+    if(p_img->palette != NULL){
+        h.color_count = p_img->color_count;
+        h.palette_bytes = (p_img->color_count < 256 ? 256 : p_img->color_count) * 3;
+    }
+    if(p_img->cycles != NULL){
+        h.cycle_count = p_img->cycle_count;
+    }
+    if(p_cache->store_pixels && p_img->pixels != NULL){
+        h.has_pixels = 1;
+        h.pixel_bytes = p_img->size * (p_img->true_color ? 4 : 1);
+        h.alpha_bytes = p_img->alpha != NULL ? p_img->size : 0;
+    }
+    if(p_hash != NULL){
+        h.has_hash = 1;
+        h.hash = *p_hash;
+    }
+    h.check = cache_head_check(&h);
+
+    char path[4096];
+    char tmp_path[4096];
+    if(cache_path(p_cache, key, path, sizeof(path)) != 0){
+        return -1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%016llx.%d.%u.tmp", p_cache->dir, (unsigned long long)key, (int)getpid(),
+             __atomic_fetch_add(&cache_tmp_no, 1, __ATOMIC_RELAXED));
+
+    FILE * file_p = fopen(tmp_path, "wb");
+    if(file_p == NULL){
+        return -1;
+    }
+
+    static const uint8_t zeros[8] = { 0 };
+    int ok = fwrite(&h, sizeof(h), 1, file_p) == 1 && fwrite(zeros, 1, CACHE_DATA_AT - sizeof(h), file_p) == CACHE_DATA_AT - sizeof(h);
+    if(ok && h.cycle_count){
+        ok = fwrite(p_img->cycles, sizeof(ilbm_cycle), h.cycle_count, file_p) == h.cycle_count;
+    }
+    if(ok && h.palette_bytes){
+        ok = fwrite(p_img->palette, 3, h.color_count, file_p) == h.color_count;
+        for(uint32_t i = h.color_count * 3; ok && i < h.palette_bytes; i++){
+            ok = fputc(0, file_p) != EOF;
+        }
+    }
+    if(ok && h.pixel_bytes){
+        ok = fwrite(p_img->pixels, 1, h.pixel_bytes, file_p) == h.pixel_bytes;
+    }
+    if(ok && h.alpha_bytes){
+        ok = fwrite(p_img->alpha, 1, h.alpha_bytes, file_p) == h.alpha_bytes;
+    }
+    const uint64_t bytes = CACHE_DATA_AT + (uint64_t)h.cycle_count * sizeof(ilbm_cycle) + h.palette_bytes + h.pixel_bytes + h.alpha_bytes;
+
+    /* An entry written again replaces the old one, only the difference is added */
+    struct stat old_st;
+    const uint64_t replaced = stat(path, &old_st) == 0 ? (uint64_t)old_st.st_size : 0;
+
+    if(fclose(file_p) != 0 || !ok || rename(tmp_path, path) != 0){
+        unlink(tmp_path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&p_cache->lock);
+    p_cache->stats.stores++;
+    p_cache->stats.bytes = p_cache->stats.bytes + bytes > replaced ? p_cache->stats.bytes + bytes - replaced : 0;
+    if(p_cache->max_bytes != 0 && p_cache->stats.bytes > p_cache->max_bytes){
+        cache_evict(p_cache);
+    }
+    pthread_mutex_unlock(&p_cache->lock);
+
+    return 0;
+}
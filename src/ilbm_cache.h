@@ -0,0 +1,127 @@
+/* ilbm_cache.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ILBM_CACHE_H
+#define ILBM_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "libilbm.h"
+#include "ilbm_hash.h"
+
+#define ILBM_CACHE_MAGIC   0x43424c49
+#define ILBM_CACHE_FORMAT  1
+#define ILBM_CACHE_VERSION ((ILBM_CACHE_FORMAT << 24) | (LIBILBM_VER_MAJ << 16) | (LIBILBM_VER_MIN << 8) | LIBILBM_VER_REV)
+#define ILBM_CACHE_SIZE    256 /* MB, default of --cache-size */
+
+enum {
+    ILBM_ROLE_FORM,
+    ILBM_ROLE_BMHD,
+    ILBM_ROLE_CMAP,
+    ILBM_ROLE_BODY,
+    ILBM_ROLE_EOL
+} typedef ILBM_ROLE;
+
+/* Which chunk the parser took for what, by name and offset, the heuristics included */
+struct {
+    char     name[4];
+    uint32_t addr;
+} typedef ilbm_cache_role;
+
+/* One file per decoded input, named after its key. The header is followed by the cycles, the
+ * palette and, for entries stored with pixels, the pixels and the mask, so a mapped entry is
+ * used in place. Native byte order, entries of another version are never read. check covers the
+ * header with check 0, a damaged entry is a miss. */
+struct {
+    uint32_t        magic;
+    uint32_t        version;
+    uint64_t        key;
+    uint64_t        data_size;
+    int32_t         error;
+    uint32_t        warnings;
+    ilbm_head       head;
+    uint8_t         format;
+    uint8_t         true_color;
+    uint8_t         has_hash;
+    uint8_t         has_pixels;
+    uint32_t        roles;
+    ilbm_cache_role role[ILBM_ROLE_EOL];
+    char            form_type[4];
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        color_count;
+    uint32_t        cycle_count;
+    ilbm_hash       hash;
+    uint32_t        palette_bytes;
+    uint32_t        pixel_bytes;
+    uint32_t        alpha_bytes;
+    uint32_t        check;
+} typedef ilbm_cache_head;
+
+struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    uint64_t bytes;
+} typedef ilbm_cache_stats;
+
+/* A cache directory shared by all threads, and by other processes using the same directory.
+ * Entries are written to a temporary file and renamed, readers never see half of one. Once the
+ * files add up to more than max_bytes the least recently used ones are removed. */
+struct {
+    char *           dir;
+    uint64_t         max_bytes;
+    uint8_t          store_pixels;
+    pthread_mutex_t  lock;
+    ilbm_cache_stats stats;
+} typedef ilbm_cache;
+
+/* A hit: an image whose pixel, palette and cycle pointers go into the mapped entry and whose
+ * chunks only carry the names of their roles. Never passed to ilbm_free(). */
+struct {
+    ilbm_image        img;
+    ilbm_chunk        chunks[ILBM_ROLE_EOL];
+    char              form_type[4];
+    ilbm_hash         hash;
+    uint8_t           has_hash;
+    uint8_t           has_pixels;
+    void *            map;
+    size_t            map_size;
+} typedef ilbm_cache_view;
+
+/* Creates the directory if needed and counts what it holds, max_bytes 0 means no limit */
+int ilbm_cache_open(ilbm_cache * p_cache, const char * dir, uint64_t max_bytes, int store_pixels);
+
+void ilbm_cache_close(ilbm_cache * p_cache);
+
+/* Key of the raw input, the library version and the format it is decoded as */
+uint64_t ilbm_cache_key(const uint8_t * data, size_t size, ILBM_FORMAT format);
+
+/* Returns the entry for key, or NULL (a miss). With need_pixels, entries of decodable images
+ * stored without their pixels are misses too, *p_found (may be NULL) tells those apart. */
+ilbm_cache_view * ilbm_cache_lookup(ilbm_cache * p_cache, uint64_t key, uint64_t data_size, int need_pixels, int * p_found);
+
+void ilbm_cache_view_free(ilbm_cache_view * p_view);
+
+/* p_hash may be NULL. Returns 0 when the entry was written. */
+int ilbm_cache_store(ilbm_cache * p_cache, uint64_t key, uint64_t data_size, ilbm_image * p_img, const ilbm_hash * p_hash);
+
+#endif
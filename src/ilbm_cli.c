@@ -16,25 +16,125 @@
  * <https://www.gnu.org/licenses/>.
  */
 
-#define LIBILBM_VERBOSITY 3
-
 #include "libilbm.h"
-#include "libilbm.c"
+#include "iso9660.h"
+#include "archive.h"
+#include "carve.h"
+#include "ilbm_gif.h"
+#include "ilbm_export.h"
+#include "ilbm_preview.h"
+#include "ilbm_hash.h"
+#include "ilbm_cache.h"
+#include "ilbm_atlas.h"
+#include "ilbm_serve.h"
+#include "prefetch.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <glob.h>
 #include <strings.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+void print_result(const char * path, ilbm_image * p_img);
+
+void print_check(const char * path, ILBM_ERROR error, const ilbm_check * p_check);
+
+int scan_iso(ilbm_ctx * p_ctx, const char * filename, time_t mtime);
+
+int scan_archive(ilbm_ctx * p_ctx, const char * filename, time_t mtime);
+
+int scan_carve(ilbm_ctx * p_ctx, const char * filename, time_t mtime);
+
+void process_file(ilbm_ctx * p_ctx, const char * path);
+
+void process_stream(ilbm_ctx * p_ctx, FILE * file_p, const char * name);
+
+void run_jobs(char ** paths, uint32_t path_cnt, uint32_t threads);
+
+void run_tree(char ** paths, uint32_t path_cnt, uint32_t threads);
+
+char ** read_path_list(FILE * file_p, uint32_t * p_cnt);
+
+void serve_file(ilbm_ctx * p_ctx, FILE * out_p, const char * path);
+
+void serve_data(ilbm_ctx * p_ctx, FILE * out_p, const char * name, const uint8_t * data, size_t size);
+
+int export_gif(FILE * file_p, ilbm_image * p_img);
+
+void handle_image(const char * path, ilbm_image * p_img);
+
+void handle_hashed(const char * path, ilbm_image * p_img, const ilbm_hash * p_hash);
+
+void handle_data(ilbm_ctx * p_ctx, const char * path, const uint8_t * data, size_t size, ILBM_FORMAT format);
+
+int export_path(char * buf, size_t len, const char * path);
+
+int export_up_to_date(const char * path, time_t src_mtime);
+
+int export_img(const char * path, ilbm_image * p_img);
+
+int VERBOSE = 0;
+int LIB_VERBOSITY = 0;
+
+const char * out_dir = NULL;
+ILBM_EXPORT  out_format = ILBM_EXPORT_GIF;
+ILBM_PREVIEW preview_mode = ILBM_PREVIEW_ASCII;
+uint32_t     job_cnt = 0;
+int          hash_mode = 0;
+int          carve_mode = 0;
+int          validate_mode = 0;
+int          recursive = 0;
+const char * atlas_dir = NULL;
+uint32_t     atlas_size = ILBM_ATLAS_SIZE;
+const char * serve_path = NULL;
+const char * client_path = NULL;
+const char * cache_dir = NULL;
+uint64_t     cache_size = ILBM_CACHE_SIZE;
+int          cache_pixels = 0;
 
-void print_img(ilbm_image * p_img, uint32_t col_max, double aspect, uint32_t charset_no);
+ilbm_hash_index hash_index;
+ilbm_atlas      atlas;
+ilbm_cache      cache;
+
+pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Where print_result() writes to, the connection being served on the --serve workers */
+__thread FILE * result_p = NULL;
+
+ILBM_FORMAT format_by_name(const char * path) {
+    const char *ext = strrchr(path, '.');
+
+    if(ext != NULL && strncasecmp(ext + 1, "LBM", 4) == 0){
+        return ILBM_FORMAT_PBM;
+    }
+    return ILBM_FORMAT_AUTO;
+}
+
+int is_iso(const char * path) {
+    const char *ext = strrchr(path, '.');
+
+    return ext != NULL && strncasecmp(ext + 1, "ISO", 4) == 0;
+}
+
+int is_archive(const char * path) {
+    const char *ext = strrchr(path, '.');
+
+    return ext != NULL && (strncasecmp(ext + 1, "GZ", 3) == 0 || strncasecmp(ext + 1, "LHA", 4) == 0 || strncasecmp(ext + 1, "LZH", 4) == 0);
+}
 
 int main(int argc, char **argv){
 
     if(argc < 2){
-        printf("Usage: %s [-vvv] <filename/pattern>\n", argv[0]);
+        printf("Usage: %s [-vvv [--preview ascii|color]] [-r] [-o <outdir> [--format gif|png|ppm|pam]] [--hash] [--carve] [--validate] [--atlas <dir> [--atlas-size <n>]] [--cache <dir> [--cache-size <MB>] [--cache-pixels]] [-j <jobs>] [--serve <socket> | --client <socket>] <filename/pattern/image.iso/archive.gz|lha/- for stdin>\n", argv[0]);
         return 1;
     }
 
-    const int VERBOSE =
+    VERBOSE =
         strncmp(argv[1], "-vvvv", 6) == 0 ? 4 :
         strncmp(argv[1], "-vvv", 5) == 0 ? 3 :
         strncmp(argv[1], "-vv", 4) == 0 ? 2 :
@@ -42,128 +142,1019 @@ int main(int argc, char **argv){
     ;
 
     switch(VERBOSE){
-        default: log_set_verbosity(0); break;
-        case 3: log_set_verbosity(4); break;
-        case 4: log_set_verbosity(4); break;
-    }
-    
-    if(VERBOSE == 0){
-        log_set_verbosity(0);
+        default: LIB_VERBOSITY = 0; break;
+        case 3: LIB_VERBOSITY = 4; break;
+        case 4: LIB_VERBOSITY = 4; break;
     }
 
+    log_set_verbosity(LIB_VERBOSITY);
+
+    glob_t globbuf;    
+    int    glob_flags = 0;
+    int    read_stdin = 0;
+
     for(int arg_i = 1; arg_i < argc; arg_i++){
+        if(strcmp(argv[arg_i], "-o") == 0 && arg_i + 1 < argc){
+            out_dir = argv[++arg_i];
+        }else
+        if(strcmp(argv[arg_i], "--format") == 0 && arg_i + 1 < argc){
+            out_format = ilbm_export_by_name(argv[++arg_i]);
+            if(out_format == ILBM_EXPORT_EOL){
+                printf("Unknown output format \"%s\"\n", argv[arg_i]);
+                return 1;
+            }
+        }else
+        if(strcmp(argv[arg_i], "--preview") == 0 && arg_i + 1 < argc){
+            preview_mode = ilbm_preview_by_name(argv[++arg_i]);
+            if(preview_mode == ILBM_PREVIEW_EOL){
+                printf("Unknown preview \"%s\"\n", argv[arg_i]);
+                return 1;
+            }
+        }else
+        if(strcmp(argv[arg_i], "-r") == 0){
+            recursive = 1;
+        }else
+        if(strcmp(argv[arg_i], "--hash") == 0){
+            hash_mode = 1;
+        }else
+        if(strcmp(argv[arg_i], "--carve") == 0){
+            carve_mode = 1;
+        }else
+        if(strcmp(argv[arg_i], "--validate") == 0){
+            validate_mode = 1;
+        }else
+        if(strcmp(argv[arg_i], "--atlas") == 0 && arg_i + 1 < argc){
+            atlas_dir = argv[++arg_i];
+        }else
+        if(strcmp(argv[arg_i], "--atlas-size") == 0 && arg_i + 1 < argc){
+            atlas_size = atoi(argv[++arg_i]);
+        }else
+        if(strcmp(argv[arg_i], "--cache") == 0 && arg_i + 1 < argc){
+            cache_dir = argv[++arg_i];
+        }else
+        if(strcmp(argv[arg_i], "--cache-size") == 0 && arg_i + 1 < argc){
+            cache_size = strtoull(argv[++arg_i], NULL, 10);
+        }else
+        if(strcmp(argv[arg_i], "--cache-pixels") == 0){
+            cache_pixels = 1;
+        }else
+        if(strcmp(argv[arg_i], "--serve") == 0 && arg_i + 1 < argc){
+            serve_path = argv[++arg_i];
+        }else
+        if(strcmp(argv[arg_i], "--client") == 0 && arg_i + 1 < argc){
+            client_path = argv[++arg_i];
+        }else
+        if(strcmp(argv[arg_i], "-j") == 0 && arg_i + 1 < argc){
+            job_cnt = atoi(argv[++arg_i]);
+        }else
+        if(strcmp(argv[arg_i], "-") == 0){
+            read_stdin = 1;
+        }else
+        if(argv[arg_i][0] != '-'){
+            if(glob(argv[arg_i], glob_flags, NULL, &globbuf) == 0){
+                glob_flags = GLOB_APPEND;
+            }
+        }
+    }
 
-        if(argv[arg_i][0] == '-'){
-            continue;
+    if(glob_flags == 0 && !read_stdin && serve_path == NULL){
+        return 0;
+    }
+
+    if(out_dir != NULL){
+        mkdir(out_dir, 0777);
+    }
+    if(atlas_dir != NULL){
+        mkdir(atlas_dir, 0777);
+    }
+    if(cache_dir != NULL && ilbm_cache_open(&cache, cache_dir, cache_size << 20, cache_pixels) != 0){
+        log_error("%s: failed to open cache\n", cache_dir);
+        cache_dir = NULL;
+    }
+
+    if((out_dir != NULL || hash_mode || validate_mode || atlas_dir != NULL || serve_path != NULL || client_path != NULL) && job_cnt == 0){
+        job_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    ilbm_hash_index_init(&hash_index);
+    ilbm_atlas_init(&atlas, atlas_size);
+
+    if(serve_path != NULL){
+        /* Runs until it's stopped, then writes the hash groups and atlas like a normal run */
+        ilbm_serve_cfg cfg = { job_cnt, LIB_VERBOSITY, atlas_dir != NULL, serve_file, serve_data, format_by_name };
+        log_info("%s: serving on %u workers", serve_path, job_cnt);
+        if(ilbm_serve(serve_path, &cfg) != 0){
+            log_error("%s: failed to listen\n", serve_path);
         }
+        read_stdin = 0;
+    }
 
-        glob_t globbuf;    
-        
-        if(glob(argv[arg_i], 0, NULL, &globbuf) == 0){
-            char ** pathv = globbuf.gl_pathv;
-
-            for(; *pathv; pathv++){
-                FILE * file_p = fopen(*pathv, "rb");
-
-                if(file_p){
-
-                    const char *ext = strrchr(*pathv, '.');
-
-                    int use_lbm = 0;
-                    if(ext != NULL && strncasecmp(ext + 1, "LBM", 4) == 0){
-                        use_lbm = 1;
-                    }
-
-                    ilbm_image * p_img = ilbm_read(file_p, use_lbm ? ILBM_FORMAT_PBM : ILBM_FORMAT_AUTO);
-
-                    fclose(file_p);
-                    
-                    switch(p_img->error){
-                        case ILBM_OK:
-                            printf("\"%-80s\",%4d,%4d,%3d,\"%4.4s\",\"%4.4s\",\"%4.4s\",\"%4.4s\",\"%4.4s\",\n", *pathv, p_img->width, p_img->height, p_img->color_count, p_img->form_chunk->name, p_img->form_chunk->content, p_img->bmhd_chunk->name, p_img->cmap_chunk->name, p_img->body_chunk->name);                    
-                            if(VERBOSE >= 3){
-                                print_img(p_img, 120, 4.0 / 2.0, 0);                    
-                            }
-                            break;
-                        case ILBM_ERROR_BODY_SHORT_LITERAL:
-                        case ILBM_ERROR_BODY_SHORT_REPEAT:
-                            if(VERBOSE >= 1){
-                                printf("\"%-80s\",,,            \"%4.4s\",\"%4.4s\",,,,\"Compression error\"\n", *pathv, p_img->form_chunk->name, p_img->form_chunk->content);                    
-                            }
-                            break;
-                        case ILBM_ERROR_BMHD_MISSING:
-                        case ILBM_ERROR_CMAP_MISSING:
-                        case ILBM_ERROR_BODY_MISSING:
-                            if(VERBOSE >= 1){
-                                printf("\"%-80s\",,,            \"%4.4s\",\"%4.4s\",,,,\"Mandatory chunk missing\"\n", *pathv, p_img->form_chunk->name, p_img->form_chunk->content);                    
-                            }
-                            break;
-                        case ILBM_ERROR_ZERO_SIZE:
-                        case ILBM_ERROR_ILLEGAL_HEIGHT:
-                        case ILBM_ERROR_ILLEGAL_WIDTH:                        
-                            if(VERBOSE >= 1){
-                                printf("\"%-80s\",,,            \"%4.4s\",\"%4.4s\",\"%4.4s\",,,\"Illegal header value(s)\",\"%s\"\n", *pathv, p_img->form_chunk->name, p_img->form_chunk->content, p_img->bmhd_chunk->name, ilbm_error_strs[p_img->error]);                    
-                            }
-                            break;
-                        case ILBM_ERROR_IFF_8SVX:                        
-                        case ILBM_ERROR_IFF_SMUS: 
-                        case ILBM_ERROR_IFF_ANIM: 
-                            if(VERBOSE >= 2){
-                                printf("\"%-80s\",,,            \"%4.4s\",\"%4.4s\",,,,\"Non-image IFF file\"\n", *pathv, p_img->form_chunk->name, p_img->form_chunk->content);                    
-                            }
-                            break;
-                        default:
-                            char err_str[64];
-                            snprintf(err_str, sizeof(err_str), "%s", ilbm_error_strs[p_img->error]);
-                            log_error("%s: parsing failed: %s\n", *pathv, err_str);
-                            break;
-                    }                    
-
-                    ilbm_free(p_img);        
-                }else{
-                    log_error("%s: failed to open file\n", *pathv);
-                }
-            }                         
+    /* The client takes the paths to send from stdin, one per line */
+    if(read_stdin && client_path != NULL){
+        uint32_t path_cnt = 0;
+        char ** paths = read_path_list(stdin, &path_cnt);
+
+        run_jobs(paths, path_cnt, job_cnt);
+
+        for(uint32_t i = 0; i < path_cnt; i++){
+            free(paths[i]);
+        }
+        free(paths);
+        read_stdin = 0;
+    }
+
+    if(read_stdin){
+        ilbm_ctx ctx;
+        ilbm_ctx_init(&ctx);
+        ctx.verbosity = LIB_VERBOSITY;
+        ctx.collect_stats = atlas_dir != NULL;
+
+        process_stream(&ctx, stdin, "stdin");
+
+        ilbm_ctx_release(&ctx);
+    }
+
+    if(glob_flags != 0){
+        if(recursive){
+            run_tree(globbuf.gl_pathv, globbuf.gl_pathc, job_cnt);
+        }else{
+            run_jobs(globbuf.gl_pathv, globbuf.gl_pathc, job_cnt);
         }
 
         globfree(&globbuf);
     }
 
+    if(hash_mode){
+        uint32_t group_cnt = ilbm_hash_index_print(&hash_index, stdout);
+        log_info("%u images, %u duplicate groups", hash_index.entry_cnt, group_cnt);
+    }
+
+    if(atlas_dir != NULL){
+        int page_cnt = ilbm_atlas_write(&atlas, atlas_dir);
+        if(page_cnt < 0){
+            log_error("%s: failed to write atlas\n", atlas_dir);
+        }else{
+            log_info("%u sprites in %u groups on %d pages", atlas.sprite_cnt, atlas.group_cnt, page_cnt);
+        }
+    }
+
+    if(cache_dir != NULL){
+        log_info("%s: %llu hits, %llu misses, %llu stored, %llu evicted, %llu KB", cache_dir, (unsigned long long)cache.stats.hits,
+                 (unsigned long long)cache.stats.misses, (unsigned long long)cache.stats.stores, (unsigned long long)cache.stats.evictions,
+                 (unsigned long long)cache.stats.bytes >> 10);
+        ilbm_cache_close(&cache);
+    }
+
+    ilbm_hash_index_release(&hash_index);
+    ilbm_atlas_release(&atlas);
+
    return 0;
 }
 
-void print_img(ilbm_image * p_img, uint32_t col_max, double aspect, uint32_t charset_no) {
-    double   fac = col_max > p_img->width ? 1.0 : (double)col_max / p_img->width;
-    double   fac_y = fac / aspect;
-    
-    const char * charsets[] = {
-        /* Source: https://paulbourke.net/dataformats/asciiart/ */
-        " .:-=+*#%@",
-        " .\'`^\",:;Il!i><~+_-?][}{1)(|\\/tfjrxnuvczXYUJCLQ0OZmwqpdbkhao*#MW&8%B@$",        
-        " .`:,;\'_^\"></-!~\\=)(|j?}{ ][ti+l7v1%yrfcJ32uIC$zwo96sngaT5qpkYVOL40&mG8*xhedbZUSAQPFDXWK#RNEHBM@"
-    };
-
-    const char * charset = charsets[charset_no % 3];
-    const uint32_t charset_len = strlen(charset);
-
-    printf(".-");
-    for(uint32_t col = 0; col < p_img->width * fac; col++) printf("-");
-    printf("-.\n");
-    for(uint32_t row = 0; row < p_img->height * fac_y; row++){
-        printf(": ");
-        const uint32_t row_i = ((uint32_t)(row / fac_y)) * p_img->width;            
-        for(uint32_t col = 0; col < p_img->width * fac; col++){
-            uint32_t p_i = row_i + (uint32_t)(col / fac);                
-            uint32_t c_i = p_img->pixels[p_i];
-            uint8_t * color = &p_img->palette[c_i * 3];
-            uint32_t intensity = (color[0] + color[1] + color[2]) / 3;
-            if(p_img->alpha != NULL && p_img->alpha[p_i] == 0) intensity = 0;
-            
-            printf("%c", charset[((charset_len - 1) * intensity / 255)]);
-        }
-        printf(" :\n");
-    }
-    printf("`-");
-    for(uint32_t col = 0; col < p_img->width * fac; col++) printf("-");
-    printf("-'\n");
+struct {
+    char **  paths;
+    uint32_t path_cnt;
+    uint32_t next;
+} typedef job_queue;
+
+static void * job_worker(void * arg) {
+    job_queue * p_queue = (job_queue *)arg;
+
+    /* One context per worker, its scratch buffer stays warm across files. */
+    ilbm_ctx ctx;
+    ilbm_ctx_init(&ctx);
+    ctx.verbosity = LIB_VERBOSITY;
+    ctx.collect_stats = atlas_dir != NULL;
+
+    while(1){
+        uint32_t i = __atomic_fetch_add(&p_queue->next, 1, __ATOMIC_RELAXED);
+        if(i >= p_queue->path_cnt){
+            break;
+        }
+        process_file(&ctx, p_queue->paths[i]);
+    }
+
+    ilbm_ctx_release(&ctx);
+
+    return NULL;
+}
+
+/* Hands the paths to a running --serve and prints what comes back, one connection per thread */
+static void * client_worker(void * arg) {
+    job_queue * p_queue = (job_queue *)arg;
+
+    const int fd = ilbm_serve_connect(client_path, 2000);
+    const int send_fd = fd >= 0 ? dup(fd) : -1;
+    FILE * recv_p = fd >= 0 ? fdopen(fd, "rb") : NULL;
+    FILE * send_p = send_fd >= 0 ? fdopen(send_fd, "wb") : NULL;
+    if(recv_p == NULL || send_p == NULL){
+        log_error("%s: no server to connect to\n", client_path);
+        if(recv_p != NULL) fclose(recv_p); else if(fd >= 0) close(fd);
+        if(send_p != NULL) fclose(send_p); else if(send_fd >= 0) close(send_fd);
+        return NULL;
+    }
+
+    char cwd[4096];
+    if(getcwd(cwd, sizeof(cwd)) == NULL){
+        cwd[0] = '\0';
+    }
+
+    while(1){
+        uint32_t i = __atomic_fetch_add(&p_queue->next, 1, __ATOMIC_RELAXED);
+        if(i >= p_queue->path_cnt){
+            break;
+        }
+
+        /* The server has its own working directory */
+        const char * path = p_queue->paths[i];
+        char full_path[8192];
+        snprintf(full_path, sizeof(full_path), "%s%s%s", path[0] != '/' ? cwd : "", path[0] != '/' ? "/" : "", path);
+        if(strchr(full_path, '\n') != NULL){
+            continue;
+        }
+
+        char * answer = NULL;
+        size_t answer_size = 0;
+        FILE * mem_p = open_memstream(&answer, &answer_size);
+        if(mem_p == NULL){
+            break;
+        }
+        const int ret = ilbm_serve_request(send_p, recv_p, full_path, mem_p);
+        fclose(mem_p);
+
+        pthread_mutex_lock(&print_lock);
+        fwrite(answer, 1, answer_size, stdout);
+        pthread_mutex_unlock(&print_lock);
+        free(answer);
+
+        if(ret != 0){
+            log_error("%s: connection lost\n", client_path);
+            break;
+        }
+    }
+
+    fclose(send_p);
+    fclose(recv_p);
+
+    return NULL;
+}
+
+void run_jobs(char ** paths, uint32_t path_cnt, uint32_t threads) {
+    job_queue queue = { paths, path_cnt, 0 };
+    void * (*worker)(void *) = client_path != NULL ? client_worker : job_worker;
+
+    if(threads <= 1 || path_cnt <= 1){
+        worker(&queue);
+        return;
+    }
+    if(threads > path_cnt){
+        threads = path_cnt;
+    }
+
+    pthread_t * p_threads = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    uint32_t started = 0;
+    for(; p_threads != NULL && started < threads; started++){
+        if(pthread_create(&p_threads[started], NULL, worker, &queue) != 0){
+            break;
+        }
+    }
+
+    /* Whatever could not be handed to a thread is worked off here. */
+    worker(&queue);
+
+    for(uint32_t i = 0; i < started; i++){
+        pthread_join(p_threads[i], NULL);
+    }
+    free(p_threads);
+}
+
+/* Disc images, archives and --carve map the file themselves, outputs that are up to date are
+ * passed on unread */
+static int tree_want(void * user, const char * path, const struct stat * p_st) {
+    (void)user;
+    return !carve_mode && !is_iso(path) && !is_archive(path) && (validate_mode || !export_up_to_date(path, p_st->st_mtime));
+}
+
+static void tree_found(void * user, const char * path) {
+    prefetch_add((prefetch *)user, path);
+}
+
+struct {
+    char **  paths;
+    uint32_t path_cnt;
+    uint32_t path_max;
+} typedef path_list;
+
+static void tree_collect(void * user, const char * path) {
+    path_list * p_list = (path_list *)user;
+
+    if(p_list->path_cnt == p_list->path_max){
+        const uint32_t path_max = p_list->path_max ? p_list->path_max * 2 : 256;
+        char ** grown = (char **)realloc(p_list->paths, path_max * sizeof(char *));
+        if(grown == NULL){
+            return;
+        }
+        p_list->paths = grown;
+        p_list->path_max = path_max;
+    }
+    if((p_list->paths[p_list->path_cnt] = strdup(path)) != NULL){
+        p_list->path_cnt++;
+    }
+}
+
+static void * tree_worker(void * arg) {
+    prefetch * p_prefetch = (prefetch *)arg;
+
+    ilbm_ctx ctx;
+    ilbm_ctx_init(&ctx);
+    ctx.verbosity = LIB_VERBOSITY;
+    ctx.collect_stats = atlas_dir != NULL;
+
+    prefetch_item * p_item;
+    while((p_item = prefetch_next(p_prefetch)) != NULL){
+        if(p_item->data != NULL){
+            handle_data(&ctx, p_item->path, p_item->data, p_item->size, format_by_name(p_item->path));
+        }else{
+            process_file(&ctx, p_item->path);
+        }
+        prefetch_release(p_prefetch, p_item);
+    }
+
+    ilbm_ctx_release(&ctx);
+
+    return NULL;
+}
+
+/* -r: directories are walked on this thread while the files found are read ahead, a bounded
+ * number and amount at a time, and decoded by the workers as their reads complete */
+void run_tree(char ** paths, uint32_t path_cnt, uint32_t threads) {
+    /* The server reads the files itself */
+    if(client_path != NULL){
+        path_list list = { NULL, 0, 0 };
+        for(uint32_t i = 0; i < path_cnt; i++){
+            prefetch_walk(paths[i], tree_collect, &list);
+        }
+        run_jobs(list.paths, list.path_cnt, threads);
+        for(uint32_t i = 0; i < list.path_cnt; i++){
+            free(list.paths[i]);
+        }
+        free(list.paths);
+        return;
+    }
+
+    prefetch * p_prefetch = prefetch_new(PREFETCH_DEPTH, PREFETCH_BYTES, tree_want, NULL);
+    if(p_prefetch == NULL){
+        log_error("failed to start reading\n");
+        return;
+    }
+
+    if(threads == 0){
+        threads = 1;
+    }
+    pthread_t * p_threads = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    uint32_t started = 0;
+    for(; p_threads != NULL && started < threads; started++){
+        if(pthread_create(&p_threads[started], NULL, tree_worker, p_prefetch) != 0){
+            break;
+        }
+    }
+
+    uint32_t file_cnt = 0;
+    for(uint32_t i = 0; i < path_cnt; i++){
+        file_cnt += prefetch_walk(paths[i], tree_found, p_prefetch);
+    }
+    prefetch_end(p_prefetch);
+
+    /* Whatever is left once the walk is done is worked off here too. */
+    tree_worker(p_prefetch);
+
+    for(uint32_t i = 0; i < started; i++){
+        pthread_join(p_threads[i], NULL);
+    }
+    free(p_threads);
+
+    log_info("%u files, %s read-ahead", file_cnt, prefetch_backend(p_prefetch));
+
+    prefetch_free(p_prefetch);
+}
+
+/* --validate only reads the control bytes of the BODY and a --cache hit only the bytes for its
+ * key, mapping the file leaves the rest of the pages alone */
+static int map_file(ilbm_ctx * p_ctx, const char * path, off_t size) {
+    const int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return -1;
+    }
+
+    const uint8_t * data = size > 0 ? (const uint8_t *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if(data == MAP_FAILED){
+        return -1;
+    }
+
+    handle_data(p_ctx, path, data, size, format_by_name(path));
+
+    if(data != NULL){
+        munmap((void *)data, size);
+    }
+
+    return 0;
+}
+
+void process_file(ilbm_ctx * p_ctx, const char * path) {
+    struct stat st;
+    if(stat(path, &st) != 0){
+        log_error("%s: failed to open file\n", path);
+        return;
+    }
+
+    /* Disc images and archives are carved as they are, not walked */
+    if(carve_mode){
+        if(scan_carve(p_ctx, path, st.st_mtime) != 0){
+            log_error("%s: failed to open file\n", path);
+        }
+        return;
+    }
+
+    if(is_iso(path)){
+        if(scan_iso(p_ctx, path, st.st_mtime) != 0){
+            log_error("%s: failed to read ISO9660 image\n", path);
+        }
+        return;
+    }
+
+    if(is_archive(path)){
+        if(scan_archive(p_ctx, path, st.st_mtime) != 0){
+            log_error("%s: failed to read archive\n", path);
+        }
+        return;
+    }
+
+    if(!validate_mode && export_up_to_date(path, st.st_mtime)){
+        log_info("%s: up to date", path);
+        return;
+    }
+
+    if(validate_mode || cache_dir != NULL){
+        if(map_file(p_ctx, path, st.st_size) != 0){
+            log_error("%s: failed to open file\n", path);
+        }
+        return;
+    }
+
+    FILE * file_p = fopen(path, "rb");
+
+    if(file_p){
+        ilbm_image * p_img = ilbm_read_ctx(p_ctx, file_p, format_by_name(path));
+
+        fclose(file_p);
+        
+        handle_image(path, p_img);
+
+        ilbm_free(p_img);        
+    }else{
+        log_error("%s: failed to open file\n", path);
+    }
+}
+
+/* Pipes can't be seeked, the push parser decodes the rows while the data comes in. */
+void process_stream(ilbm_ctx * p_ctx, FILE * file_p, const char * name) {
+    if(validate_mode || cache_dir != NULL){
+        uint8_t * data = NULL;
+        size_t    size = 0;
+        FILE *    mem_p = open_memstream((char **)&data, &size);
+        if(mem_p == NULL){
+            return;
+        }
+
+        uint8_t buf[65536];
+        size_t  n;
+        while((n = fread(buf, 1, sizeof(buf), file_p)) > 0){
+            fwrite(buf, 1, n, mem_p);
+        }
+        fclose(mem_p);
+
+        handle_data(p_ctx, name, data, size, ILBM_FORMAT_AUTO);
+
+        free(data);
+        return;
+    }
+
+    ilbm_push * p_push = ilbm_push_new(p_ctx, ILBM_FORMAT_AUTO, NULL, NULL);
+    if(p_push == NULL){
+        return;
+    }
+
+    uint8_t buf[65536];
+    size_t  n;
+    while((n = fread(buf, 1, sizeof(buf), file_p)) > 0){
+        if(ilbm_feed(p_push, buf, n) != 0){
+            break;
+        }
+    }
+
+    ilbm_image * p_img = ilbm_push_finish(p_push);
+
+    handle_image(name, p_img);
+
+    ilbm_free(p_img);
+}
+
+/* The --serve workers answer with what a normal run prints for the same input */
+void serve_file(ilbm_ctx * p_ctx, FILE * out_p, const char * path) {
+    result_p = out_p;
+    process_file(p_ctx, path);
+    result_p = NULL;
+}
+
+void serve_data(ilbm_ctx * p_ctx, FILE * out_p, const char * name, const uint8_t * data, size_t size) {
+    result_p = out_p;
+    handle_data(p_ctx, name, data, size, format_by_name(name));
+    result_p = NULL;
+}
+
+char ** read_path_list(FILE * file_p, uint32_t * p_cnt) {
+    char *   line = NULL;
+    size_t   line_max = 0;
+    ssize_t  len;
+    uint32_t cnt = 0;
+    uint32_t max = 0;
+    char **  paths = NULL;
+
+    while((len = getline(&line, &line_max, file_p)) > 0){
+        if(line[len - 1] == '\n'){
+            line[--len] = '\0';
+        }
+        if(len == 0){
+            continue;
+        }
+        if(cnt == max){
+            max = max ? max * 2 : 256;
+            char ** grown = (char **)realloc(paths, max * sizeof(char *));
+            if(grown == NULL){
+                break;
+            }
+            paths = grown;
+        }
+        if((paths[cnt] = strdup(line)) == NULL){
+            break;
+        }
+        cnt++;
+    }
+    free(line);
+
+    *p_cnt = cnt;
+    return paths;
+}
+
+void handle_image(const char * path, ilbm_image * p_img) {
+    ilbm_hash hash;
+    handle_hashed(path, p_img, hash_mode && ilbm_hash_image(p_img, &hash) == 0 ? &hash : NULL);
+}
+
+/* p_hash is NULL when --hash is off or the image has no pixels to hash */
+void handle_hashed(const char * path, ilbm_image * p_img, const ilbm_hash * p_hash) {
+    if(p_img == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&print_lock);
+    print_result(path, p_img);
+    pthread_mutex_unlock(&print_lock);
+
+    /* Exact copies are only exported once, whichever is decoded first */
+    if(hash_mode && p_hash != NULL){
+        const char * first = ilbm_hash_index_add(&hash_index, p_hash, path);
+        if(first != NULL){
+            log_info("%s: same as %s", path, first);
+            return;
+        }
+    }
+
+    if(p_img->error == ILBM_OK && out_dir != NULL && export_img(path, p_img) != 0){
+        log_error("%s: export failed\n", path);
+    }
+
+    if(p_img->error == ILBM_OK && atlas_dir != NULL && ilbm_atlas_add(&atlas, p_img, path) < 0){
+        log_info("%s: not added to the atlas", path);
+    }
+}
+
+/* A --cache hit is used unless pixels are wanted and the entry has none. The atlas also needs the
+ * decode statistics, which aren't cached, but its decodes are still stored. */
+static void handle_cached(ilbm_ctx * p_ctx, const char * path, const uint8_t * data, size_t size, ILBM_FORMAT format) {
+    const uint64_t key = ilbm_cache_key(data, size, format);
+
+    int found = 0;
+    ilbm_cache_view * p_view = atlas_dir == NULL ? ilbm_cache_lookup(&cache, key, size, out_dir != NULL || VERBOSE >= 3, &found) : NULL;
+    if(p_view != NULL){
+        handle_hashed(path, &p_view->img, p_view->has_hash ? &p_view->hash : NULL);
+        ilbm_cache_view_free(p_view);
+        return;
+    }
+
+    ilbm_image * p_img = ilbm_read_mem_ctx(p_ctx, data, size, format);
+    if(p_img == NULL){
+        return;
+    }
+
+    /* Hashed even without --hash, so the entry serves later --hash runs too */
+    ilbm_hash hash;
+    const int hashed = ilbm_hash_image(p_img, &hash) == 0;
+    /* An entry that only lacks the pixels would be written again just the same */
+    if((!found || cache.store_pixels) && ilbm_cache_store(&cache, key, size, p_img, hashed ? &hash : NULL) != 0){
+        log_info("%s: not cached", path);
+    }
+
+    handle_hashed(path, p_img, hashed ? &hash : NULL);
+
+    ilbm_free(p_img);
+}
+
+/* Images in memory are decoded, or only checked with --validate */
+void handle_data(ilbm_ctx * p_ctx, const char * path, const uint8_t * data, size_t size, ILBM_FORMAT format) {
+    if(validate_mode){
+        ilbm_check check;
+        ILBM_ERROR error = ilbm_validate(p_ctx, data, size, format, &check);
+
+        pthread_mutex_lock(&print_lock);
+        print_check(path, error, &check);
+        pthread_mutex_unlock(&print_lock);
+        return;
+    }
+
+    if(cache_dir != NULL){
+        handle_cached(p_ctx, path, data, size, format);
+        return;
+    }
+
+    ilbm_image * p_img = ilbm_read_mem_ctx(p_ctx, data, size, format);
+
+    handle_image(path, p_img);
+
+    ilbm_free(p_img);
+}
+
+/* Files that aren't images at all are only listed with -v */
+void print_check(const char * path, ILBM_ERROR error, const ilbm_check * p_check) {
+    if(VERBOSE < 1 && (error == ILBM_ERROR_FORM_MISSING || error == ILBM_ERROR_NO_CHUNKS || error == ILBM_ERROR_IFF_8SVX ||
+                       error == ILBM_ERROR_IFF_SMUS || error == ILBM_ERROR_IFF_ANIM)){
+        return;
+    }
+
+    FILE * out_p = result_p != NULL ? result_p : stdout;
+
+    fprintf(out_p, "\"%-80s\",%4u,%4u,\"%s\"", path, p_check->width, p_check->height, ilbm_error_strs[error]);
+    for(uint32_t i = 0; i < ILBM_ISSUE_EOL; i++){
+        if(!(p_check->issues & (1 << i))){
+            continue;
+        }
+        fprintf(out_p, ",\"%s at 0x%08x, row %u", ilbm_issue_strs[i], p_check->issue_addr[i], p_check->issue_row[i]);
+        if(i == ILBM_ISSUE_CROSSED_ROW){
+            fprintf(out_p, ", %u runs", p_check->crossed_cnt);
+        }
+        fprintf(out_p, "\"");
+    }
+    fprintf(out_p, "\n");
+}
+
+void print_result(const char * path, ilbm_image * p_img) {
+    if(p_img == NULL){
+        return;
+    }
+
+    FILE * out_p = result_p != NULL ? result_p : stdout;
+
+    switch(p_img->error){
+        case ILBM_OK:
+            fprintf(out_p, "\"%-80s\",%4d,%4d,%3d,\"%4.4s\",\"%4.4s\",\"%4.4s\",\"%4.4s\",\"%4.4s\",\n", path, p_img->width, p_img->height, p_img->color_count, p_img->form_chunk->name, p_img->form_chunk->content, p_img->bmhd_chunk->name, p_img->cmap_chunk != NULL ? p_img->cmap_chunk->name : "", p_img->body_chunk->name);                    
+            if(VERBOSE >= 3){
+                ilbm_preview_print(out_p, p_img, 120, preview_mode);                    
+            }
+            break;
+        case ILBM_ERROR_BODY_SHORT_LITERAL:
+        case ILBM_ERROR_BODY_SHORT_REPEAT:
+            if(VERBOSE >= 1){
+                fprintf(out_p, "\"%-80s\",,,            \"%4.4s\",\"%4.4s\",,,,\"Compression error\"\n", path, p_img->form_chunk->name, p_img->form_chunk->content);                    
+            }
+            break;
+        case ILBM_ERROR_BMHD_MISSING:
+        case ILBM_ERROR_CMAP_MISSING:
+        case ILBM_ERROR_BODY_MISSING:
+            if(VERBOSE >= 1){
+                fprintf(out_p, "\"%-80s\",,,            \"%4.4s\",\"%4.4s\",,,,\"Mandatory chunk missing\"\n", path, p_img->form_chunk->name, p_img->form_chunk->content);                    
+            }
+            break;
+        case ILBM_ERROR_ZERO_SIZE:
+        case ILBM_ERROR_ILLEGAL_HEIGHT:
+        case ILBM_ERROR_ILLEGAL_WIDTH:                        
+            if(VERBOSE >= 1){
+                fprintf(out_p, "\"%-80s\",,,            \"%4.4s\",\"%4.4s\",\"%4.4s\",,,\"Illegal header value(s)\",\"%s\"\n", path, p_img->form_chunk->name, p_img->form_chunk->content, p_img->bmhd_chunk->name, ilbm_error_strs[p_img->error]);                    
+            }
+            break;
+        case ILBM_ERROR_IFF_8SVX:                        
+        case ILBM_ERROR_IFF_SMUS: 
+        case ILBM_ERROR_IFF_ANIM: 
+            if(VERBOSE >= 2){
+                fprintf(out_p, "\"%-80s\",,,            \"%4.4s\",\"%4.4s\",,,,\"Non-image IFF file\"\n", path, p_img->form_chunk->name, p_img->form_chunk->content);                    
+            }
+            break;
+        default:
+            char err_str[64];
+            snprintf(err_str, sizeof(err_str), "%s", ilbm_error_strs[p_img->error]);
+            log_error("%s: parsing failed: %s\n", path, err_str);
+            break;
+    }                    
+}
+
+/* The source path is mirrored below out_dir, so sources of the same name in other directories
+ * or containers get outputs of their own. Leading slashes and "." are dropped, ".." becomes "__"
+ * so no source path can write outside out_dir. Returns -1 if it doesn't fit. */
+int export_path(char * buf, size_t len, const char * path) {
+    int pos = snprintf(buf, len, "%s", out_dir);
+
+    for(const char * p = path; pos >= 0 && (size_t)pos < len && *p != 0;){
+        const int n = strcspn(p, "/");
+        if(n == 2 && p[0] == '.' && p[1] == '.'){
+            pos += snprintf(buf + pos, len - pos, "/__");
+        }else
+        if(n > 0 && !(n == 1 && p[0] == '.')){
+            pos += snprintf(buf + pos, len - pos, "/%.*s", n, p);
+        }
+        p += n;
+        p += *p == '/';
+    }
+    if(pos >= 0 && (size_t)pos < len){
+        pos += snprintf(buf + pos, len - pos, ".%s", ilbm_export_strs[out_format]);
+    }
+
+    return pos >= 0 && (size_t)pos < len ? pos : -1;
+}
+
+/* Directories of an output path below out_dir, workers creating the same one at once is fine */
+static void export_make_dirs(char * out_path) {
+    for(char * p = strchr(out_path + strlen(out_dir) + 1, '/'); p != NULL; p = strchr(p + 1, '/')){
+        *p = 0;
+        mkdir(out_path, 0777);
+        *p = '/';
+    }
+}
+
+int export_up_to_date(const char * path, time_t src_mtime) {
+    /* The atlas is rebuilt from scratch and the duplicate groups span the whole run, both need
+     * every image decoded */
+    if(out_dir == NULL || atlas_dir != NULL || hash_mode){
+        return 0;
+    }
+
+    char out_path[4096];
+    if(export_path(out_path, sizeof(out_path), path) < 0){
+        return 0;
+    }
+
+    struct stat st;
+    return stat(out_path, &st) == 0 && st.st_mtime >= src_mtime;
+}
+
+int export_img(const char * path, ilbm_image * p_img) {
+    if(out_format == ILBM_EXPORT_GIF && p_img->true_color){
+        /* no palette to build the color table from, use png */
+        return -1;
+    }
+
+    char out_path[4096];
+    if(export_path(out_path, sizeof(out_path), path) < 0){
+        return -1;
+    }
+    export_make_dirs(out_path);
+
+    /* Written aside and renamed when complete, so an interrupted run or two workers on the same
+     * output never leave a partial file that export_up_to_date() would take as done */
+    static uint32_t part_seq;
+    char part_path[4096 + 32];
+    snprintf(part_path, sizeof(part_path), "%s.%d.%u.part", out_path, (int)getpid(), __atomic_fetch_add(&part_seq, 1, __ATOMIC_RELAXED));
+
+    FILE * file_p = fopen(part_path, "wb");
+    if(file_p == NULL){
+        return -1;
+    }
+
+    int ret = -1;
+    switch(out_format){
+        case ILBM_EXPORT_PNG: ret = ilbm_write_png(file_p, p_img); break;
+        case ILBM_EXPORT_PPM: ret = ilbm_write_ppm(file_p, p_img); break;
+        case ILBM_EXPORT_PAM: ret = ilbm_write_pam(file_p, p_img); break;
+        case ILBM_EXPORT_GIF: ret = export_gif(file_p, p_img); break;
+        default: break;
+    }
+
+    if(fclose(file_p) != 0){
+        ret = -1;
+    }
+    if(ret != 0 || rename(part_path, out_path) != 0){
+        unlink(part_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int export_gif(FILE * file_p, ilbm_image * p_img) {
+    /* Step at the pace of the fastest range, GIF viewers clamp delays below 2cs. */
+    double rate_max = 0.0;
+    for(uint32_t i = 0; i < p_img->cycle_count; i++){
+        if(p_img->cycles[i].rate > rate_max) rate_max = p_img->cycles[i].rate;
+    }
+    uint32_t delay_cs = rate_max > 0.0 ? (uint32_t)(100.0 / rate_max) : 0;
+    if(delay_cs < 2) delay_cs = 2;
+    if(delay_cs > 100) delay_cs = 100;
+
+    uint32_t frames = ilbm_cycle_frames(p_img, delay_cs / 100.0, ILBM_GIF_MAX_FRAMES);
+
+    return ilbm_write_gif(file_p, p_img, frames, delay_cs);
+}
+
+struct {
+    ilbm_ctx *   ctx;
+    const char * iso_name;
+    time_t       mtime;
+} typedef iso_scan;
+
+static int scan_iso_filter(const uint8_t * data, size_t size) {
+    return ilbm_sniff(data, size);
+}
+
+static int scan_iso_file(void * user, const char * path, const uint8_t * data, uint32_t size) {
+    iso_scan * p_scan = (iso_scan *)user;
+
+    char full_path[ISO9660_MAX_PATH + 256];
+    snprintf(full_path, sizeof(full_path), "%s:%s", p_scan->iso_name, path);
+
+    if(export_up_to_date(full_path, p_scan->mtime)){
+        return 0;
+    }
+
+    handle_data(p_scan->ctx, full_path, data, size, format_by_name(path));
+
+    return 0;
+}
+
+int scan_iso(ilbm_ctx * p_ctx, const char * filename, time_t mtime) {
+    iso9660 * p_iso = iso9660_open(filename);
+    if(p_iso == NULL){
+        return -1;
+    }
+
+    log_info("%s: %s, %s names", filename, p_iso->joliet ? "Joliet" : "ISO9660", p_iso->rock_ridge ? "Rock Ridge" : p_iso->joliet ? "UCS-2" : "8.3");
+
+    iso_scan scan = { p_ctx, filename, mtime };
+    int ret = iso9660_walk(p_iso, scan_iso_filter, scan_iso_file, &scan);
+
+    log_info("%s: %d files, %d candidates", filename, p_iso->file_cnt, p_iso->candidate_cnt);
+
+    iso9660_close(p_iso);
+
+    return ret < 0 ? -1 : 0;
+}
+
+struct {
+    ilbm_ctx *   ctx;
+    const char * file_name;
+    time_t       mtime;
+} typedef carve_scan_job;
+
+/* Images are decoded in place, straight out of the mapping */
+static int scan_carve_found(void * user, uint64_t offset, const uint8_t * data, size_t size) {
+    carve_scan_job * p_scan = (carve_scan_job *)user;
+
+    char full_path[4096];
+    snprintf(full_path, sizeof(full_path), "%s@0x%08llx", p_scan->file_name, (unsigned long long)offset);
+
+    if(export_up_to_date(full_path, p_scan->mtime)){
+        return 0;
+    }
+
+    handle_data(p_scan->ctx, full_path, data, size, ILBM_FORMAT_AUTO);
+
+    return 0;
+}
+
+int scan_carve(ilbm_ctx * p_ctx, const char * filename, time_t mtime) {
+    carve * p_carve = carve_open(filename);
+    if(p_carve == NULL){
+        return -1;
+    }
+
+    carve_scan_job scan = { p_ctx, filename, mtime };
+    int ret = carve_walk(p_carve, p_ctx, scan_carve_found, &scan);
+
+    log_info("%s: %llu bytes carved (%s), %llu magics, %u images", filename, (unsigned long long)p_carve->map_size, carve_simd_name(), (unsigned long long)p_carve->hit_cnt, p_carve->found_cnt);
+
+    carve_close(p_carve);
+
+    return ret < 0 ? -1 : 0;
+}
+
+struct {
+    ilbm_ctx *   ctx;
+    const char * arc_name;
+    time_t       mtime;
+    char         path[ARCHIVE_MAX_PATH * 2 + 256];
+    ilbm_push *  push;
+    int          sniffed;
+    FILE *       member_p;
+    uint8_t *    member;
+    size_t       member_size;
+} typedef arc_scan;
+
+static int scan_archive_begin(void * user, const char * path, uint32_t size) {
+    arc_scan * p_scan = (arc_scan *)user;
+
+    snprintf(p_scan->path, sizeof(p_scan->path), "%s:%s", p_scan->arc_name, path);
+    p_scan->push = NULL;
+    p_scan->sniffed = 0;
+
+    /* LHA tells the size up front, gzip members are sniffed on their first piece */
+    return (size != 0 && size < 20) || export_up_to_date(p_scan->path, p_scan->mtime);
+}
+
+/* Members are decoded while they are unpacked, nothing but the current piece is held */
+static int scan_archive_data(void * user, const uint8_t * data, size_t size) {
+    arc_scan * p_scan = (arc_scan *)user;
+
+    if(!p_scan->sniffed){
+        p_scan->sniffed = 1;
+        if(!ilbm_sniff(data, size)){
+            return 1;
+        }
+        /* --validate and --cache need the member in one piece */
+        if(validate_mode || cache_dir != NULL){
+            p_scan->member_p = open_memstream((char **)&p_scan->member, &p_scan->member_size);
+        }else{
+            p_scan->push = ilbm_push_new(p_scan->ctx, format_by_name(p_scan->path), NULL, NULL);
+        }
+    }
+
+    if(p_scan->member_p != NULL){
+        return fwrite(data, 1, size, p_scan->member_p) != size;
+    }
+
+    return p_scan->push == NULL || ilbm_feed(p_scan->push, data, size) != 0;
+}
+
+static void scan_archive_end(void * user, int status) {
+    arc_scan * p_scan = (arc_scan *)user;
+
+    if(p_scan->member_p != NULL){
+        fclose(p_scan->member_p);
+        p_scan->member_p = NULL;
+        if(status != 0){
+            log_error("%s: damaged archive member\n", p_scan->path);
+        }else{
+            handle_data(p_scan->ctx, p_scan->path, p_scan->member, p_scan->member_size, format_by_name(p_scan->path));
+        }
+        free(p_scan->member);
+        p_scan->member = NULL;
+        return;
+    }
+
+    if(p_scan->push == NULL){
+        return;
+    }
+
+    ilbm_image * p_img = ilbm_push_finish(p_scan->push);
+    p_scan->push = NULL;
+
+    if(status != 0){
+        log_error("%s: damaged archive member\n", p_scan->path);
+    }else{
+        handle_image(p_scan->path, p_img);
+    }
+
+    ilbm_free(p_img);
+}
+
+int scan_archive(ilbm_ctx * p_ctx, const char * filename, time_t mtime) {
+    archive * p_arc = archive_open(filename);
+    if(p_arc == NULL){
+        return -1;
+    }
+
+    arc_scan * p_scan = (arc_scan *)calloc(1, sizeof(arc_scan));
+    if(p_scan == NULL){
+        archive_close(p_arc);
+        return -1;
+    }
+    p_scan->ctx = p_ctx;
+    p_scan->arc_name = filename;
+    p_scan->mtime = mtime;
+
+    int ret = archive_walk(p_arc, scan_archive_begin, scan_archive_data, scan_archive_end, p_scan);
+
+    log_info("%s: %s, %d members, %d unsupported", filename, archive_type_strs[p_arc->type], p_arc->member_cnt, p_arc->unsupported_cnt);
+
+    free(p_scan);
+    archive_close(p_arc);
+
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,221 @@
+/* ilbm_export.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "ilbm_export.h"
+
+#define PNG_IDAT_SIZE 65536
+
+const char * ilbm_export_strs[] = { "gif", "png", "ppm", "pam" };
+
+ILBM_EXPORT ilbm_export_by_name(const char * name) {
+    for(int i = 0; i < ILBM_EXPORT_EOL; i++){
+        if(strcmp(name, ilbm_export_strs[i]) == 0){
+            return i;
+        }
+    }
+    return ILBM_EXPORT_EOL;
+}
+
+static uint32_t export_table_bits(ilbm_image * p_img) {
+    uint32_t table_bits = p_img->format == ILBM_FORMAT_PBM ? 8 : p_img->head.num_planes;
+    if(table_bits < 1) table_bits = 1;
+    if(table_bits > 8) table_bits = 8;
+    return table_bits;
+}
+
+static void png_put_u32(uint8_t * p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void png_put_chunk(FILE * file_p, const char * type, const uint8_t * data, uint32_t len) {
+    uint8_t head[8];
+    png_put_u32(head, len);
+    memcpy(head + 4, type, 4);
+    fwrite(head, 8, 1, file_p);
+    if(len > 0){
+        fwrite(data, len, 1, file_p);
+    }
+
+    uint32_t crc = crc32(0, (const Bytef *)type, 4);
+    if(len > 0){
+        crc = crc32(crc, data, len);
+    }
+    uint8_t tail[4];
+    png_put_u32(tail, crc);
+    fwrite(tail, 4, 1, file_p);
+}
+
+int ilbm_write_png(FILE * file_p, ilbm_image * p_img) {
+    if(p_img == NULL || p_img->error != ILBM_OK || p_img->pixels == NULL){
+        return -1;
+    }
+
+    const uint32_t table_bits = export_table_bits(p_img);
+    const uint32_t table_size = 1 << table_bits;
+    const uint32_t depth = p_img->true_color || table_bits > 4 ? 8 : table_bits <= 1 ? 1 : table_bits <= 2 ? 2 : 4;
+    const uint32_t row_bytes = p_img->true_color ? p_img->width * 4 : (p_img->width * depth + 7) / 8;
+
+    uint8_t * row = (uint8_t *)malloc(1 + row_bytes);
+    uint8_t * idat = (uint8_t *)malloc(PNG_IDAT_SIZE);
+    if(row == NULL || idat == NULL){
+        free(row);
+        free(idat);
+        return -1;
+    }
+
+    fwrite("\x89PNG\r\n\x1a\n", 8, 1, file_p);
+
+    uint8_t ihdr[13];
+    png_put_u32(ihdr + 0, p_img->width);
+    png_put_u32(ihdr + 4, p_img->height);
+    ihdr[8] = depth;
+    ihdr[9] = p_img->true_color ? 6 : 3;
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+    png_put_chunk(file_p, "IHDR", ihdr, sizeof(ihdr));
+
+    if(!p_img->true_color){
+        uint8_t plte[256 * 3];
+        memset(plte, 0, sizeof(plte));
+        memcpy(plte, p_img->palette, (p_img->color_count < table_size ? p_img->color_count : table_size) * 3);
+        png_put_chunk(file_p, "PLTE", plte, table_size * 3);
+    }
+
+    if(!p_img->true_color && p_img->alpha != NULL && p_img->head.mask == 2 && p_img->head.trans_clr < table_size){
+        uint8_t trns[256];
+        memset(trns, 0xff, sizeof(trns));
+        trns[p_img->head.trans_clr] = 0x00;
+        png_put_chunk(file_p, "tRNS", trns, p_img->head.trans_clr + 1);
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK){
+        free(row);
+        free(idat);
+        return -1;
+    }
+    zs.next_out = idat;
+    zs.avail_out = PNG_IDAT_SIZE;
+
+    int ret = 0;
+    for(uint32_t row_no = 0; row_no <= p_img->height && ret == 0; row_no++){
+        const int flush = row_no == p_img->height ? Z_FINISH : Z_NO_FLUSH;
+
+        if(flush == Z_NO_FLUSH){
+            row[0] = 0;
+            if(p_img->true_color){
+                memcpy(row + 1, &p_img->pixels[row_no * row_bytes], row_bytes);
+            }else if(depth == 8){
+                memcpy(row + 1, &p_img->pixels[row_no * p_img->width], p_img->width);
+            }else{
+                memset(row + 1, 0, row_bytes);
+                const uint8_t * src = &p_img->pixels[row_no * p_img->width];
+                const uint32_t per_byte = 8 / depth;
+                for(uint32_t col = 0; col < p_img->width; col++){
+                    row[1 + col / per_byte] |= (src[col] & (table_size - 1)) << ((per_byte - 1 - col % per_byte) * depth);
+                }
+            }
+            zs.next_in = row;
+            zs.avail_in = 1 + row_bytes;
+        }
+
+        while(1){
+            int z = deflate(&zs, flush);
+            if(z == Z_STREAM_ERROR){
+                ret = -1;
+                break;
+            }
+            if(zs.avail_out == 0 || (z == Z_STREAM_END && zs.avail_out < PNG_IDAT_SIZE)){
+                png_put_chunk(file_p, "IDAT", idat, PNG_IDAT_SIZE - zs.avail_out);
+                zs.next_out = idat;
+                zs.avail_out = PNG_IDAT_SIZE;
+            }
+            if(flush == Z_FINISH ? z == Z_STREAM_END : zs.avail_in == 0){
+                break;
+            }
+        }
+    }
+    deflateEnd(&zs);
+
+    png_put_chunk(file_p, "IEND", NULL, 0);
+
+    free(row);
+    free(idat);
+
+    return ret != 0 || ferror(file_p) ? -1 : 0;
+}
+
+static int export_rgb(FILE * file_p, ilbm_image * p_img, uint32_t channels) {
+    if(p_img == NULL || p_img->error != ILBM_OK || p_img->pixels == NULL){
+        return -1;
+    }
+
+    uint8_t lut[256 * 3];
+    memset(lut, 0, sizeof(lut));
+    if(p_img->palette != NULL){
+        memcpy(lut, p_img->palette, (p_img->color_count < 256 ? p_img->color_count : 256) * 3);
+    }
+
+    uint8_t * row = (uint8_t *)malloc(p_img->width * channels);
+    if(row == NULL){
+        return -1;
+    }
+
+    for(uint32_t row_no = 0; row_no < p_img->height; row_no++){
+        const uint32_t row_i = row_no * p_img->width;
+        uint8_t * p_out = row;
+        for(uint32_t col = 0; col < p_img->width; col++){
+            const uint8_t * color = p_img->true_color ? &p_img->pixels[(row_i + col) * 4] : &lut[p_img->pixels[row_i + col] * 3];
+            p_out[0] = color[0];
+            p_out[1] = color[1];
+            p_out[2] = color[2];
+            if(channels == 4){
+                p_out[3] = p_img->alpha[row_i + col];
+            }
+            p_out += channels;
+        }
+        fwrite(row, channels, p_img->width, file_p);
+    }
+
+    free(row);
+
+    return ferror(file_p) ? -1 : 0;
+}
+
+int ilbm_write_ppm(FILE * file_p, ilbm_image * p_img) {
+    fprintf(file_p, "P6\n%d %d\n255\n", p_img->width, p_img->height);
+
+    return export_rgb(file_p, p_img, 3);
+}
+
+int ilbm_write_pam(FILE * file_p, ilbm_image * p_img) {
+    const uint32_t channels = p_img->alpha != NULL ? 4 : 3;
+
+    fprintf(file_p, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", p_img->width, p_img->height, channels, channels == 4 ? "RGB_ALPHA" : "RGB");
+
+    return export_rgb(file_p, p_img, channels);
+}
@@ -0,0 +1,50 @@
+/* ilbm_export.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ILBM_EXPORT_H
+#define ILBM_EXPORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "libilbm.h"
+
+enum {
+    ILBM_EXPORT_GIF,
+    ILBM_EXPORT_PNG,
+    ILBM_EXPORT_PPM,
+    ILBM_EXPORT_PAM,
+    ILBM_EXPORT_EOL
+} typedef ILBM_EXPORT;
+
+extern const char * ilbm_export_strs[];
+
+ILBM_EXPORT ilbm_export_by_name(const char * name);
+
+/* Indexed PNG with PLTE from the CMAP and a tRNS entry for the transparent color.
+ * Rows are packed to the smallest bit depth holding all planes and deflated one by one.
+ * 24 plane images are written as 8 bit RGBA. */
+int ilbm_write_png(FILE * file_p, ilbm_image * p_img);
+
+/* Binary PPM (P6), RGB expanded one row at a time. */
+int ilbm_write_ppm(FILE * file_p, ilbm_image * p_img);
+
+/* PAM (P7), RGB_ALPHA when the image has an alpha channel. */
+int ilbm_write_pam(FILE * file_p, ilbm_image * p_img);
+
+#endif
@@ -0,0 +1,206 @@
+/* ilbm_gif.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ilbm_gif.h"
+
+#define GIF_LZW_HASH_SIZE 8192
+
+struct {
+    uint8_t * buf;
+    size_t    len;
+    size_t    cap;
+    uint32_t  acc;
+    uint32_t  acc_bits;
+} typedef gif_bits;
+
+static int gif_bits_put(gif_bits * p_bits, uint32_t code, uint32_t code_size) {
+    p_bits->acc |= code << p_bits->acc_bits;
+    p_bits->acc_bits += code_size;
+
+    while(p_bits->acc_bits >= 8){
+        if(p_bits->len == p_bits->cap){
+            size_t cap = p_bits->cap ? p_bits->cap * 2 : 4096;
+            uint8_t * p_new = (uint8_t *)realloc(p_bits->buf, cap);
+            if(p_new == NULL){
+                return -1;
+            }
+            p_bits->buf = p_new;
+            p_bits->cap = cap;
+        }
+        p_bits->buf[p_bits->len++] = p_bits->acc & 0xff;
+        p_bits->acc >>= 8;
+        p_bits->acc_bits -= 8;
+    }
+
+    return 0;
+}
+
+static int gif_lzw(gif_bits * p_bits, const uint8_t * pixels, uint32_t size, uint32_t min_code_size) {
+    const uint32_t clear = 1 << min_code_size;
+    const uint32_t eoi = clear + 1;
+
+    uint32_t * keys = (uint32_t *)calloc(GIF_LZW_HASH_SIZE, sizeof(uint32_t));
+    uint16_t * codes = (uint16_t *)malloc(GIF_LZW_HASH_SIZE * sizeof(uint16_t));
+    if(keys == NULL || codes == NULL){
+        free(keys);
+        free(codes);
+        return -1;
+    }
+
+    uint32_t code_size = min_code_size + 1;
+    uint32_t next = eoi + 1;
+    int ret = gif_bits_put(p_bits, clear, code_size);
+
+    uint32_t prefix = pixels[0];
+    for(uint32_t i = 1; i < size && ret == 0; i++){
+        const uint32_t c = pixels[i];
+        const uint32_t key = ((prefix << 8) | c) + 1;
+
+        uint32_t h = (key * 2654435761u) >> 19;
+        while(keys[h] != 0 && keys[h] != key){
+            h = (h + 1) & (GIF_LZW_HASH_SIZE - 1);
+        }
+        if(keys[h] == key){
+            prefix = codes[h];
+            continue;
+        }
+
+        ret = gif_bits_put(p_bits, prefix, code_size);
+
+        if(next < 4096){
+            if(next == (1u << code_size)){
+                code_size++;
+            }
+            keys[h] = key;
+            codes[h] = next++;
+        }else{
+            ret |= gif_bits_put(p_bits, clear, code_size);
+            memset(keys, 0, GIF_LZW_HASH_SIZE * sizeof(uint32_t));
+            code_size = min_code_size + 1;
+            next = eoi + 1;
+        }
+        prefix = c;
+    }
+
+    ret |= gif_bits_put(p_bits, prefix, code_size);
+    ret |= gif_bits_put(p_bits, eoi, code_size);
+    if(p_bits->acc_bits > 0){
+        ret |= gif_bits_put(p_bits, 0, 8 - p_bits->acc_bits);
+    }
+
+    free(keys);
+    free(codes);
+
+    return ret;
+}
+
+static void gif_put_u16(FILE * file_p, uint32_t v) {
+    fputc(v & 0xff, file_p);
+    fputc((v >> 8) & 0xff, file_p);
+}
+
+static void gif_put_table(FILE * file_p, const uint8_t * palette, uint32_t color_count, uint32_t table_size) {
+    fwrite(palette, 3, color_count < table_size ? color_count : table_size, file_p);
+    for(uint32_t i = color_count; i < table_size; i++){
+        fputc(0, file_p);
+        fputc(0, file_p);
+        fputc(0, file_p);
+    }
+}
+
+int ilbm_write_gif(FILE * file_p, ilbm_image * p_img, uint32_t frame_count, uint32_t delay_cs) {
+    if(p_img == NULL || p_img->error != ILBM_OK || p_img->pixels == NULL || p_img->true_color){
+        return -1;
+    }
+
+    uint32_t table_bits = p_img->format == ILBM_FORMAT_PBM ? 8 : p_img->head.num_planes;
+    if(table_bits < 1) table_bits = 1;
+    if(table_bits > 8) table_bits = 8;
+    const uint32_t table_size = 1 << table_bits;
+    const int transparent = p_img->alpha != NULL && p_img->head.mask == 2 && p_img->head.trans_clr < table_size;
+
+    gif_bits bits = { 0 };
+    const uint32_t min_code_size = table_bits < 2 ? 2 : table_bits;
+    if(gif_lzw(&bits, p_img->pixels, p_img->size, min_code_size) != 0){
+        free(bits.buf);
+        return -1;
+    }
+
+    uint8_t * palette = (uint8_t *)malloc(p_img->color_count * 3 + 1);
+    if(palette == NULL){
+        free(bits.buf);
+        return -1;
+    }
+
+    if(frame_count == 0 || p_img->cycle_count == 0){
+        frame_count = 1;
+    }
+
+    fwrite(frame_count > 1 || transparent ? "GIF89a" : "GIF87a", 6, 1, file_p);
+    gif_put_u16(file_p, p_img->width);
+    gif_put_u16(file_p, p_img->height);
+    fputc(0x80 | ((table_bits - 1) << 4) | (table_bits - 1), file_p);
+    fputc(0, file_p);
+    fputc(0, file_p);
+    gif_put_table(file_p, p_img->palette, p_img->color_count, table_size);
+
+    if(frame_count > 1){
+        fwrite("\x21\xff\x0bNETSCAPE2.0\x03\x01\x00\x00\x00", 19, 1, file_p);
+    }
+
+    for(uint32_t frame = 0; frame < frame_count; frame++){
+        if(frame_count > 1 || transparent){
+            fwrite("\x21\xf9\x04", 3, 1, file_p);
+            fputc((frame_count > 1 ? 1 << 2 : 0) | (transparent ? 1 : 0), file_p);
+            gif_put_u16(file_p, delay_cs);
+            fputc(transparent ? p_img->head.trans_clr : 0, file_p);
+            fputc(0, file_p);
+        }
+
+        fputc(0x2c, file_p);
+        gif_put_u16(file_p, 0);
+        gif_put_u16(file_p, 0);
+        gif_put_u16(file_p, p_img->width);
+        gif_put_u16(file_p, p_img->height);
+        if(frame_count > 1){
+            ilbm_cycle_palette(p_img, frame * delay_cs / 100.0, palette);
+            fputc(0x80 | (table_bits - 1), file_p);
+            gif_put_table(file_p, palette, p_img->color_count, table_size);
+        }else{
+            fputc(0, file_p);
+        }
+
+        fputc(min_code_size, file_p);
+        for(size_t pos = 0; pos < bits.len; pos += 255){
+            const size_t block = bits.len - pos < 255 ? bits.len - pos : 255;
+            fputc(block, file_p);
+            fwrite(bits.buf + pos, block, 1, file_p);
+        }
+        fputc(0, file_p);
+    }
+
+    fputc(0x3b, file_p);
+
+    free(palette);
+    free(bits.buf);
+
+    return ferror(file_p) ? -1 : 0;
+}
@@ -0,0 +1,34 @@
+/* ilbm_gif.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ILBM_GIF_H
+#define ILBM_GIF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "libilbm.h"
+
+#define ILBM_GIF_MAX_FRAMES 600
+
+/* Writes the image as GIF. With active CRNG/CCRT ranges every frame is the same
+ * LZW stream, compressed once, and only differs by its local color table.
+ * 24 plane images have no palette and are refused. */
+int ilbm_write_gif(FILE * file_p, ilbm_image * p_img, uint32_t frame_count, uint32_t delay_cs);
+
+#endif
@@ -0,0 +1,278 @@
+/* ilbm_hash.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ilbm_hash.h"
+
+#define HASH_GRID_W 9
+#define HASH_GRID_H 8
+
+const char * ilbm_hash_level_strs[] = { "exact", "palette", "similar" };
+
+/* Not meant to withstand crafted collisions, only to tell pictures apart quickly */
+static inline uint64_t hash_mix(uint64_t h, uint64_t v) {
+    h ^= v * 0x9e3779b97f4a7c15ull;
+    h = (h << 31) | (h >> 33);
+    return h * 0xbf58476d1ce4e5b9ull;
+}
+
+static inline uint64_t hash_final(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hash_bytes(uint64_t h, const uint8_t * data, size_t len) {
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8){
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        h = hash_mix(h, v);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, len - i);
+    return hash_mix(h, tail ^ (uint64_t)len << 56);
+}
+
+uint64_t ilbm_hash_data(uint64_t seed, const uint8_t * data, size_t len) {
+    return hash_final(hash_bytes(hash_mix(0, seed), data, len));
+}
+
+/* One pass over the pixels: the raw bytes for EXACT, resolved colors for PALETTE and the
+ * luminance sums of the 9x8 grid cells for SIMILAR. */
+int ilbm_hash_image(ilbm_image * p_img, ilbm_hash * p_hash) {
+    if(p_img == NULL || p_img->error != ILBM_OK || p_img->pixels == NULL){
+        return -1;
+    }
+
+    const uint32_t width = p_img->width;
+    const uint32_t height = p_img->height;
+    const uint64_t dims = (uint64_t)width << 32 | height;
+
+    uint8_t * cell_x = (uint8_t *)malloc(width);
+    if(cell_x == NULL){
+        return -1;
+    }
+    for(uint32_t x = 0; x < width; x++){
+        cell_x[x] = (uint64_t)x * HASH_GRID_W / width;
+    }
+
+    uint32_t rgb_lut[256];
+    uint32_t luma_lut[256];
+    memset(rgb_lut, 0, sizeof(rgb_lut));
+    memset(luma_lut, 0, sizeof(luma_lut));
+    if(!p_img->true_color && p_img->palette != NULL){
+        for(uint32_t i = 0; i < p_img->color_count && i < 256; i++){
+            const uint8_t * c = &p_img->palette[i * 3];
+            rgb_lut[i] = c[0] | c[1] << 8 | c[2] << 16;
+            luma_lut[i] = c[0] * 77 + c[1] * 150 + c[2] * 29;
+        }
+    }
+
+    const size_t bytes = (size_t)p_img->size * (p_img->true_color ? 4 : 1);
+    uint64_t exact = hash_bytes(hash_mix(0, dims), p_img->pixels, bytes);
+    if(!p_img->true_color && p_img->palette != NULL){
+        exact = hash_bytes(exact, p_img->palette, p_img->color_count * 3);
+    }
+
+    uint64_t cell_sum[HASH_GRID_H][HASH_GRID_W];
+    uint32_t cell_cnt[HASH_GRID_H][HASH_GRID_W];
+    memset(cell_sum, 0, sizeof(cell_sum));
+    memset(cell_cnt, 0, sizeof(cell_cnt));
+
+    uint64_t rgb = hash_mix(1, dims);
+    for(uint32_t y = 0; y < height; y++){
+        const uint32_t cy = (uint64_t)y * HASH_GRID_H / height;
+        uint64_t * sum = cell_sum[cy];
+        uint32_t * cnt = cell_cnt[cy];
+
+        if(p_img->true_color){
+            const uint8_t * src = &p_img->pixels[(size_t)y * width * 4];
+            for(uint32_t x = 0; x < width; x++, src += 4){
+                rgb = hash_mix(rgb, src[0] | src[1] << 8 | src[2] << 16);
+                sum[cell_x[x]] += src[0] * 77 + src[1] * 150 + src[2] * 29;
+                cnt[cell_x[x]]++;
+            }
+        }else{
+            /* One resolved color per pixel like above, so an indexed image and its true color
+             * conversion share the key */
+            const uint8_t * src = &p_img->pixels[(size_t)y * width];
+            for(uint32_t x = 0; x < width; x++){
+                rgb = hash_mix(rgb, rgb_lut[src[x]]);
+                sum[cell_x[x]] += luma_lut[src[x]];
+                cnt[cell_x[x]]++;
+            }
+        }
+    }
+
+    free(cell_x);
+
+    /* Each bit tells whether a cell is darker than its right neighbour */
+    uint64_t diff = 0;
+    for(uint32_t cy = 0; cy < HASH_GRID_H; cy++){
+        for(uint32_t cx = 0; cx + 1 < HASH_GRID_W; cx++){
+            const uint64_t left = cell_cnt[cy][cx] ? cell_sum[cy][cx] / cell_cnt[cy][cx] : 0;
+            const uint64_t right = cell_cnt[cy][cx + 1] ? cell_sum[cy][cx + 1] / cell_cnt[cy][cx + 1] : 0;
+            diff = diff << 1 | (left < right);
+        }
+    }
+
+    p_hash->key[ILBM_HASH_EXACT] = hash_final(exact);
+    p_hash->key[ILBM_HASH_PALETTE] = hash_final(rgb);
+    p_hash->key[ILBM_HASH_SIMILAR] = hash_final(hash_mix(dims, diff));
+
+    return 0;
+}
+
+void ilbm_hash_index_init(ilbm_hash_index * p_index) {
+    memset(p_index, 0, sizeof(ilbm_hash_index));
+    pthread_mutex_init(&p_index->lock, NULL);
+}
+
+void ilbm_hash_index_release(ilbm_hash_index * p_index) {
+    for(uint32_t i = 0; i < p_index->entry_cnt; i++){
+        free(p_index->entries[i].path);
+    }
+    free(p_index->entries);
+    free(p_index->slots);
+    pthread_mutex_destroy(&p_index->lock);
+    memset(p_index, 0, sizeof(ilbm_hash_index));
+}
+
+/* Open addressing on the EXACT hash, slots hold entry index + 1 and are kept at most half full */
+static uint32_t * hash_index_slot(ilbm_hash_index * p_index, uint64_t key) {
+    const uint32_t mask = p_index->slot_cnt - 1;
+    uint32_t i = key & mask;
+    while(p_index->slots[i] != 0 && p_index->entries[p_index->slots[i] - 1].hash.key[ILBM_HASH_EXACT] != key){
+        i = (i + 1) & mask;
+    }
+    return &p_index->slots[i];
+}
+
+static int hash_index_grow(ilbm_hash_index * p_index) {
+    if(p_index->entry_cnt == p_index->entry_max){
+        const uint32_t entry_max = p_index->entry_max ? p_index->entry_max * 2 : 1024;
+        ilbm_hash_entry * entries = (ilbm_hash_entry *)realloc(p_index->entries, entry_max * sizeof(ilbm_hash_entry));
+        if(entries == NULL){
+            return -1;
+        }
+        p_index->entries = entries;
+        p_index->entry_max = entry_max;
+    }
+
+    if(p_index->entry_cnt * 2 >= p_index->slot_cnt){
+        const uint32_t slot_cnt = p_index->slot_cnt ? p_index->slot_cnt * 2 : 2048;
+        uint32_t * slots = (uint32_t *)calloc(slot_cnt, sizeof(uint32_t));
+        if(slots == NULL){
+            return -1;
+        }
+        free(p_index->slots);
+        p_index->slots = slots;
+        p_index->slot_cnt = slot_cnt;
+        for(uint32_t i = 0; i < p_index->entry_cnt; i++){
+            uint32_t * p_slot = hash_index_slot(p_index, p_index->entries[i].hash.key[ILBM_HASH_EXACT]);
+            if(*p_slot == 0){
+                *p_slot = i + 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+const char * ilbm_hash_index_add(ilbm_hash_index * p_index, const ilbm_hash * p_hash, const char * path) {
+    const char * first = NULL;
+
+    pthread_mutex_lock(&p_index->lock);
+
+    char * copy = strdup(path);
+    if(copy != NULL && hash_index_grow(p_index) == 0){
+        uint32_t * p_slot = hash_index_slot(p_index, p_hash->key[ILBM_HASH_EXACT]);
+        if(*p_slot != 0){
+            first = p_index->entries[*p_slot - 1].path;
+        }else{
+            *p_slot = p_index->entry_cnt + 1;
+        }
+        p_index->entries[p_index->entry_cnt].hash = *p_hash;
+        p_index->entries[p_index->entry_cnt].path = copy;
+        p_index->entry_cnt++;
+    }else{
+        free(copy);
+    }
+
+    pthread_mutex_unlock(&p_index->lock);
+
+    return first;
+}
+
+struct {
+    uint64_t key;
+    uint64_t sub;
+    uint32_t entry;
+} typedef hash_sort_item;
+
+static int hash_sort_cmp(const void * a, const void * b) {
+    const hash_sort_item * p_a = (const hash_sort_item *)a;
+    const hash_sort_item * p_b = (const hash_sort_item *)b;
+
+    if(p_a->key != p_b->key) return p_a->key < p_b->key ? -1 : 1;
+    if(p_a->sub != p_b->sub) return p_a->sub < p_b->sub ? -1 : 1;
+    return p_a->entry < p_b->entry ? -1 : p_a->entry > p_b->entry;
+}
+
+uint32_t ilbm_hash_index_print(ilbm_hash_index * p_index, FILE * file_p) {
+    pthread_mutex_lock(&p_index->lock);
+
+    uint32_t group_cnt = 0;
+    hash_sort_item * items = (hash_sort_item *)malloc((p_index->entry_cnt + 1) * sizeof(hash_sort_item));
+
+    for(uint32_t level = 0; items != NULL && level < ILBM_HASH_EOL; level++){
+        for(uint32_t i = 0; i < p_index->entry_cnt; i++){
+            items[i].key = p_index->entries[i].hash.key[level];
+            items[i].sub = level > 0 ? p_index->entries[i].hash.key[level - 1] : 0;
+            items[i].entry = i;
+        }
+        qsort(items, p_index->entry_cnt, sizeof(hash_sort_item), hash_sort_cmp);
+
+        for(uint32_t start = 0, end; start < p_index->entry_cnt; start = end){
+            uint32_t distinct = 1;
+            for(end = start + 1; end < p_index->entry_cnt && items[end].key == items[start].key; end++){
+                distinct += items[end].sub != items[end - 1].sub;
+            }
+            if(end - start < 2 || (level > 0 && distinct < 2)){
+                continue;
+            }
+
+            group_cnt++;
+            for(uint32_t i = start; i < end; i++){
+                fprintf(file_p, "%s,%u,\"%s\"\n", ilbm_hash_level_strs[level], group_cnt, p_index->entries[items[i].entry].path);
+            }
+        }
+    }
+
+    free(items);
+
+    pthread_mutex_unlock(&p_index->lock);
+
+    return group_cnt;
+}
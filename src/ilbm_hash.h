@@ -0,0 +1,78 @@
+/* ilbm_hash.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ILBM_HASH_H
+#define ILBM_HASH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "libilbm.h"
+
+enum {
+    ILBM_HASH_EXACT,
+    ILBM_HASH_PALETTE,
+    ILBM_HASH_SIMILAR,
+    ILBM_HASH_EOL
+} typedef ILBM_HASH_LEVEL;
+
+extern const char * ilbm_hash_level_strs[];
+
+/* EXACT: size, indices and palette. PALETTE: size and the RGB of every pixel, the same for
+ * any order of the palette and for a true color conversion. SIMILAR: size and a 64 bit
+ * difference hash of the luminance scaled down to 9x8, survives small retouches and palette
+ * tweaks. Chunk names and the container don't go into any of them. */
+struct {
+    uint64_t key[ILBM_HASH_EOL];
+} typedef ilbm_hash;
+
+struct {
+    ilbm_hash hash;
+    char *    path;
+} typedef ilbm_hash_entry;
+
+/* Collects the hashes of all decoded images, safe to add to from several threads */
+struct {
+    pthread_mutex_t   lock;
+    ilbm_hash_entry * entries;
+    uint32_t          entry_cnt;
+    uint32_t          entry_max;
+    uint32_t *        slots;
+    uint32_t          slot_cnt;
+} typedef ilbm_hash_index;
+
+int ilbm_hash_image(ilbm_image * p_img, ilbm_hash * p_hash);
+
+/* The same mixing over raw bytes, for keys of file contents */
+uint64_t ilbm_hash_data(uint64_t seed, const uint8_t * data, size_t len);
+
+void ilbm_hash_index_init(ilbm_hash_index * p_index);
+
+void ilbm_hash_index_release(ilbm_hash_index * p_index);
+
+/* Returns the path of an earlier image with the same EXACT hash, or NULL for a new one.
+ * The returned path stays valid until the index is released. */
+const char * ilbm_hash_index_add(ilbm_hash_index * p_index, const ilbm_hash * p_hash, const char * path);
+
+/* Prints every group of two or more images sharing a hash as "level,group,path" lines,
+ * PALETTE and SIMILAR groups only when they hold more than one image of the stricter level.
+ * Returns the number of groups. */
+uint32_t ilbm_hash_index_print(ilbm_hash_index * p_index, FILE * file_p);
+
+#endif
@@ -0,0 +1,373 @@
+/* ilbm_preview.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ilbm_preview.h"
+
+/* Colors of averaged cells, bit 24 set where most pixels are opaque */
+#define PREVIEW_OPAQUE 0x1000000u
+
+/* Pixels are summed as R, G and B in 21 bit fields of one word per cell, this many at most
+ * before the fields are carried out */
+#define PREVIEW_SPAN   8192
+#define PREVIEW_WIDE(r, g, b) ((uint64_t)(r) | (uint64_t)(g) << 21 | (uint64_t)(b) << 42)
+
+/* Source: https://paulbourke.net/dataformats/asciiart/ */
+static const char preview_ramp[] = " .:-=+*#%@";
+
+const char * ilbm_preview_strs[] = { "ascii", "color" };
+
+ILBM_PREVIEW ilbm_preview_by_name(const char * name) {
+    for(int i = 0; i < ILBM_PREVIEW_EOL; i++){
+        if(strcmp(name, ilbm_preview_strs[i]) == 0){
+            return i;
+        }
+    }
+    return ILBM_PREVIEW_EOL;
+}
+
+struct {
+    const ilbm_image * p_img;
+    uint64_t           lut[256];
+    uint32_t           cols;
+    uint32_t *         col_x0;
+    uint64_t *         wide;
+    uint64_t *         sums;
+    uint32_t *         opaque;
+    uint32_t           carry_rows;
+    uint32_t           rows;
+    double             band;
+} typedef preview_grid;
+
+static void preview_grid_release(preview_grid * p_grid) {
+    free(p_grid->col_x0);
+    free(p_grid->wide);
+    free(p_grid->sums);
+    free(p_grid->opaque);
+}
+
+/* Columns split the width evenly, bands of rows are band pixels high, fractions included, so
+ * the aspect holds for any size. Bands are at least a row, narrow images are not widened. */
+static int preview_grid_init(preview_grid * p_grid, const ilbm_image * p_img, uint32_t cols, double cell_aspect) {
+    memset(p_grid, 0, sizeof(preview_grid));
+    p_grid->p_img = p_img;
+
+    /* Indices past the palette are black, the palette is resolved once per image */
+    if(!p_img->true_color && p_img->palette != NULL){
+        for(uint32_t i = 0; i < p_img->color_count && i < 256; i++){
+            const uint8_t * c = &p_img->palette[i * 3];
+            p_grid->lut[i] = PREVIEW_WIDE(c[0], c[1], c[2]);
+        }
+    }
+
+    /* At least one column, narrow enough that a row of one fits a word */
+    if(cols == 0){
+        cols = 1;
+    }
+    if(cols < p_img->width / (PREVIEW_SPAN / 2)){
+        cols = p_img->width / (PREVIEW_SPAN / 2);
+    }
+    const double step = p_img->width > cols ? (double)p_img->width / cols : 1.0;
+    const double x_aspect = p_img->head.x_aspect ? p_img->head.x_aspect : 1;
+    const double y_aspect = p_img->head.y_aspect ? p_img->head.y_aspect : 1;
+
+    p_grid->cols = p_img->width > cols ? cols : p_img->width;
+    p_grid->band = step * cell_aspect * x_aspect / y_aspect;
+    p_grid->rows = (uint32_t)(p_img->height / p_grid->band + 0.5);
+    if(p_grid->rows == 0){
+        p_grid->rows = 1;
+    }
+
+    p_grid->col_x0 = (uint32_t *)malloc((p_grid->cols + 1) * sizeof(uint32_t));
+    p_grid->wide = (uint64_t *)malloc(p_grid->cols * sizeof(uint64_t));
+    p_grid->sums = (uint64_t *)malloc(p_grid->cols * 3 * sizeof(uint64_t));
+    p_grid->opaque = (uint32_t *)malloc(p_grid->cols * sizeof(uint32_t));
+    if(p_grid->col_x0 == NULL || p_grid->wide == NULL || p_grid->sums == NULL || p_grid->opaque == NULL){
+        preview_grid_release(p_grid);
+        return -1;
+    }
+    for(uint32_t c = 0; c <= p_grid->cols; c++){
+        p_grid->col_x0[c] = (uint32_t)(c * step);
+    }
+    p_grid->col_x0[p_grid->cols] = p_img->width;
+    p_grid->carry_rows = PREVIEW_SPAN / ((uint32_t)step + 1);
+
+    return 0;
+}
+
+/* Averages one band of rows into a color per column, over the opaque pixels only */
+static void preview_band(preview_grid * p_grid, uint32_t row, uint32_t * cells) {
+    const ilbm_image * p_img = p_grid->p_img;
+
+    uint32_t y0 = (uint32_t)(row * p_grid->band);
+    uint32_t y1 = (uint32_t)((row + 1) * p_grid->band);
+    if(y0 >= p_img->height){
+        y0 = p_img->height - 1;
+    }
+    if(y1 > p_img->height || row == p_grid->rows - 1){
+        y1 = p_img->height;
+    }
+    if(y1 <= y0){
+        y1 = y0 + 1;
+    }
+
+    const uint32_t   cols = p_grid->cols;
+    const uint32_t * col_x0 = p_grid->col_x0;
+    const uint64_t * lut = p_grid->lut;
+    const uint8_t *  alpha = p_img->alpha;
+    uint64_t *       wide = p_grid->wide;
+    uint32_t *       opaque = p_grid->opaque;
+
+    memset(wide, 0, cols * sizeof(uint64_t));
+    memset(p_grid->sums, 0, cols * 3 * sizeof(uint64_t));
+    memset(opaque, 0, cols * sizeof(uint32_t));
+
+    /* The mask and true color are decided per row, the loop over a cell is only a lookup and an add */
+    for(uint32_t y = y0; y < y1; y++){
+        const size_t row_i = (size_t)y * p_img->width;
+
+        if(p_img->true_color){
+            for(uint32_t c = 0; c < cols; c++){
+                uint64_t acc = wide[c];
+                for(uint32_t x = col_x0[c]; x < col_x0[c + 1]; x++){
+                    const uint8_t * src = &p_img->pixels[(row_i + x) * 4];
+                    if(alpha == NULL || alpha[row_i + x]){
+                        acc += PREVIEW_WIDE(src[0], src[1], src[2]);
+                        opaque[c]++;
+                    }
+                }
+                wide[c] = acc;
+            }
+        }else
+        if(alpha == NULL){
+            const uint8_t * src = &p_img->pixels[row_i];
+            for(uint32_t c = 0; c < cols; c++){
+                uint64_t acc = wide[c];
+                for(uint32_t x = col_x0[c]; x < col_x0[c + 1]; x++){
+                    acc += lut[src[x]];
+                }
+                wide[c] = acc;
+                opaque[c] += col_x0[c + 1] - col_x0[c];
+            }
+        }else{
+            const uint8_t * src = &p_img->pixels[row_i];
+            for(uint32_t c = 0; c < cols; c++){
+                uint64_t acc = wide[c];
+                for(uint32_t x = col_x0[c]; x < col_x0[c + 1]; x++){
+                    if(alpha[row_i + x]){
+                        acc += lut[src[x]];
+                        opaque[c]++;
+                    }
+                }
+                wide[c] = acc;
+            }
+        }
+
+        if((y - y0 + 1) % p_grid->carry_rows == 0 || y + 1 == y1){
+            for(uint32_t c = 0; c < cols; c++){
+                p_grid->sums[c * 3 + 0] += wide[c] & 0x1fffff;
+                p_grid->sums[c * 3 + 1] += wide[c] >> 21 & 0x1fffff;
+                p_grid->sums[c * 3 + 2] += wide[c] >> 42;
+                wide[c] = 0;
+            }
+        }
+    }
+
+    for(uint32_t c = 0; c < cols; c++){
+        const uint64_t * sum = &p_grid->sums[c * 3];
+        const uint64_t n = opaque[c];
+        const uint64_t area = (uint64_t)(y1 - y0) * (col_x0[c + 1] - col_x0[c]);
+        cells[c] = n == 0 || n * 2 < area ? 0 : PREVIEW_OPAQUE | (uint32_t)(sum[0] / n) << 16 | (uint32_t)(sum[1] / n) << 8 | (uint32_t)(sum[2] / n);
+    }
+}
+
+static char * preview_ascii(preview_grid * p_grid, uint32_t * cells, size_t * p_len) {
+    const uint32_t cols = p_grid->cols;
+    const uint32_t ramp_max = sizeof(preview_ramp) - 2;
+
+    char * buf = (char *)malloc((size_t)(cols + 5) * (p_grid->rows + 2));
+    if(buf == NULL){
+        return NULL;
+    }
+    char * p = buf;
+
+    *p++ = '.';
+    memset(p, '-', cols + 2);
+    p += cols + 2;
+    *p++ = '.';
+    *p++ = '\n';
+
+    for(uint32_t row = 0; row < p_grid->rows; row++){
+        preview_band(p_grid, row, cells);
+        *p++ = ':';
+        *p++ = ' ';
+        for(uint32_t c = 0; c < cols; c++){
+            const uint32_t rgb = cells[c];
+            const uint32_t intensity = ((rgb >> 16 & 0xff) + (rgb >> 8 & 0xff) + (rgb & 0xff)) / 3;
+            *p++ = preview_ramp[ramp_max * intensity / 255];
+        }
+        *p++ = ' ';
+        *p++ = ':';
+        *p++ = '\n';
+    }
+
+    *p++ = '`';
+    memset(p, '-', cols + 2);
+    p += cols + 2;
+    *p++ = '\'';
+    *p++ = '\n';
+
+    *p_len = p - buf;
+    return buf;
+}
+
+/* A channel and its separator, copied 4 bytes at a time and advanced by its length */
+static char * preview_channel(char * p, uint32_t v, char sep) {
+    char digits[4];
+    uint32_t len;
+    if(v >= 100){
+        digits[0] = '0' + v / 100;
+        digits[1] = '0' + v / 10 % 10;
+        digits[2] = '0' + v % 10;
+        len = 3;
+    }else
+    if(v >= 10){
+        digits[0] = '0' + v / 10;
+        digits[1] = '0' + v % 10;
+        len = 2;
+    }else{
+        digits[0] = '0' + v;
+        len = 1;
+    }
+    digits[len] = sep;
+    memcpy(p, digits, 4);
+    return p + len + 1;
+}
+
+static char * preview_sgr(char * p, uint32_t ground, uint32_t rgb) {
+    memcpy(p, ground == 38 ? "\x1b[38;2;" : "\x1b[48;2;", 7);
+    p = preview_channel(p + 7, rgb >> 16 & 0xff, ';');
+    p = preview_channel(p, rgb >> 8 & 0xff, ';');
+    return preview_channel(p, rgb & 0xff, 'm');
+}
+
+/* The upper half block takes the upper cell as foreground and the lower one as background. A
+ * masked upper cell flips to the lower half block, escapes are only written where colors change. */
+static char * preview_color(preview_grid * p_grid, uint32_t * cells, size_t * p_len) {
+    const uint32_t cols = p_grid->cols;
+    const uint32_t lines = (p_grid->rows + 1) / 2;
+    uint32_t *     lower = cells + cols;
+
+    /* Worst case per cell: both colors, "\x1b[38;2;255;255;255m" twice, and the block */
+    char * buf = (char *)malloc((size_t)lines * (cols * 43 + 8) + 1);
+    if(buf == NULL){
+        return NULL;
+    }
+    char * p = buf;
+
+    for(uint32_t line = 0; line < lines; line++){
+        preview_band(p_grid, line * 2, cells);
+        if(line * 2 + 1 < p_grid->rows){
+            preview_band(p_grid, line * 2 + 1, lower);
+        }else{
+            memset(lower, 0, cols * sizeof(uint32_t));
+        }
+
+        uint32_t fg = 0;
+        uint32_t bg = 0;
+        for(uint32_t c = 0; c < cols; c++){
+            uint32_t top = cells[c];
+            uint32_t bottom = lower[c];
+            const char * block = "\xe2\x96\x80";
+
+            if(!(top & PREVIEW_OPAQUE)){
+                if(!(bottom & PREVIEW_OPAQUE)){
+                    if(bg != 0){
+                        memcpy(p, "\x1b[49m", 5);
+                        p += 5;
+                        bg = 0;
+                    }
+                    *p++ = ' ';
+                    continue;
+                }
+                block = "\xe2\x96\x84";
+                top = bottom;
+                bottom = 0;
+            }
+
+            if(top != fg){
+                p = preview_sgr(p, 38, top);
+                fg = top;
+            }
+            if(bottom != bg){
+                if(bottom & PREVIEW_OPAQUE){
+                    p = preview_sgr(p, 48, bottom);
+                }else{
+                    memcpy(p, "\x1b[49m", 5);
+                    p += 5;
+                }
+                bg = bottom;
+            }
+            memcpy(p, block, 3);
+            p += 3;
+        }
+        memcpy(p, "\x1b[0m\n", 5);
+        p += 5;
+    }
+
+    *p_len = p - buf;
+    return buf;
+}
+
+char * ilbm_preview_render(const ilbm_image * p_img, uint32_t cols, ILBM_PREVIEW mode, size_t * p_len) {
+    if(p_img == NULL || p_img->error != ILBM_OK || p_img->pixels == NULL || p_img->width == 0 || p_img->height == 0 || cols == 0){
+        return NULL;
+    }
+
+    /* A character cell is twice as high as wide, a half block is square */
+    preview_grid grid;
+    if(preview_grid_init(&grid, p_img, cols, mode == ILBM_PREVIEW_COLOR ? 1.0 : 2.0) != 0){
+        return NULL;
+    }
+
+    char *     buf = NULL;
+    uint32_t * cells = (uint32_t *)malloc(grid.cols * 2 * sizeof(uint32_t));
+    if(cells != NULL){
+        buf = mode == ILBM_PREVIEW_COLOR ? preview_color(&grid, cells, p_len) : preview_ascii(&grid, cells, p_len);
+    }
+
+    free(cells);
+    preview_grid_release(&grid);
+
+    return buf;
+}
+
+int ilbm_preview_print(FILE * file_p, const ilbm_image * p_img, uint32_t cols, ILBM_PREVIEW mode) {
+    size_t len;
+    char * buf = ilbm_preview_render(p_img, cols, mode, &len);
+    if(buf == NULL){
+        return -1;
+    }
+
+    const int ret = fwrite(buf, 1, len, file_p) == len ? 0 : -1;
+    free(buf);
+
+    return ret;
+}
@@ -0,0 +1,48 @@
+/* ilbm_preview.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ILBM_PREVIEW_H
+#define ILBM_PREVIEW_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "libilbm.h"
+
+enum {
+    ILBM_PREVIEW_ASCII,
+    ILBM_PREVIEW_COLOR,
+    ILBM_PREVIEW_EOL
+} typedef ILBM_PREVIEW;
+
+extern const char * ilbm_preview_strs[];
+
+ILBM_PREVIEW ilbm_preview_by_name(const char * name);
+
+/* Renders the image at most cols characters wide into one malloc()ed buffer, *p_len bytes long.
+ * Every character averages the area of the pixels it covers, sized by the BMHD x_aspect and
+ * y_aspect for a terminal cell twice as high as wide. ASCII is a framed luminance ramp, COLOR
+ * 24 bit ANSI escapes with a half block per two rows of cells, the terminal background where
+ * most of a cell is masked out. Returns NULL without pixels. */
+char * ilbm_preview_render(const ilbm_image * p_img, uint32_t cols, ILBM_PREVIEW mode, size_t * p_len);
+
+/* Renders and writes the preview with a single call */
+int ilbm_preview_print(FILE * file_p, const ilbm_image * p_img, uint32_t cols, ILBM_PREVIEW mode);
+
+#endif
@@ -0,0 +1,337 @@
+/* ilbm_serve.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ilbm_serve.h"
+
+#define SERVE_QUEUE    64
+#define SERVE_MAX_DATA (256u << 20)
+
+/* Accepted connections wait here for a free worker */
+struct {
+    const ilbm_serve_cfg * cfg;
+    pthread_mutex_t        lock;
+    pthread_cond_t         not_empty;
+    pthread_cond_t         not_full;
+    int                    fds[SERVE_QUEUE];
+    uint32_t               head;
+    uint32_t               cnt;
+} typedef serve_pool;
+
+static volatile sig_atomic_t serve_stop = 0;
+
+static void serve_signal(int sig) {
+    (void)sig;
+    serve_stop = 1;
+}
+
+static int serve_addr(struct sockaddr_un * p_addr, const char * socket_path) {
+    memset(p_addr, 0, sizeof(struct sockaddr_un));
+    p_addr->sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(p_addr->sun_path)){
+        return -1;
+    }
+    strcpy(p_addr->sun_path, socket_path);
+    return 0;
+}
+
+/* Palette images are resolved through their palette, alpha is 0xff without a mask */
+static void serve_write_rgba(FILE * out_p, ilbm_image * p_img, const char * name) {
+    if(p_img == NULL || p_img->error != ILBM_OK || p_img->pixels == NULL){
+        fprintf(out_p, "error %s: %s\n", name, p_img != NULL ? ilbm_error_strs[p_img->error] : "failed to read");
+        return;
+    }
+
+    uint8_t lut[256 * 3];
+    memset(lut, 0, sizeof(lut));
+    if(p_img->palette != NULL){
+        memcpy(lut, p_img->palette, (p_img->color_count < 256 ? p_img->color_count : 256) * 3);
+    }
+
+    uint8_t * row = (uint8_t *)malloc(p_img->width * 4);
+    if(row == NULL){
+        fprintf(out_p, "error %s: out of memory\n", name);
+        return;
+    }
+
+    fprintf(out_p, "rgba %u %u %s\n", p_img->width, p_img->height, name);
+    for(uint32_t row_no = 0; row_no < p_img->height; row_no++){
+        const uint32_t row_i = row_no * p_img->width;
+        uint8_t * p_out = row;
+        for(uint32_t col = 0; col < p_img->width; col++){
+            const uint8_t * color = p_img->true_color ? &p_img->pixels[(row_i + col) * 4] : &lut[p_img->pixels[row_i + col] * 3];
+            p_out[0] = color[0];
+            p_out[1] = color[1];
+            p_out[2] = color[2];
+            p_out[3] = p_img->alpha != NULL ? p_img->alpha[row_i + col] : 0xff;
+            p_out += 4;
+        }
+        fwrite(row, 4, p_img->width, out_p);
+    }
+
+    free(row);
+}
+
+/* "<size> <name>" and the size bytes behind the request line */
+static uint8_t * serve_read_data(FILE * in_p, char * args, size_t * p_size, const char ** p_name) {
+    char * end;
+    const unsigned long long size = strtoull(args, &end, 10);
+    if(end == args || *end != ' ' || size > SERVE_MAX_DATA){
+        return NULL;
+    }
+
+    uint8_t * data = (uint8_t *)malloc(size + 1);
+    if(data == NULL || fread(data, 1, size, in_p) != size){
+        free(data);
+        return NULL;
+    }
+
+    *p_size = size;
+    *p_name = end + 1;
+    return data;
+}
+
+static void serve_connection(serve_pool * p_pool, ilbm_ctx * p_ctx, int fd) {
+    const ilbm_serve_cfg * p_cfg = p_pool->cfg;
+
+    const int out_fd = dup(fd);
+    FILE * in_p = fdopen(fd, "rb");
+    FILE * out_p = out_fd >= 0 ? fdopen(out_fd, "wb") : NULL;
+    if(in_p == NULL || out_p == NULL){
+        if(in_p != NULL) fclose(in_p); else close(fd);
+        if(out_p != NULL) fclose(out_p); else if(out_fd >= 0) close(out_fd);
+        return;
+    }
+
+    char *  line = NULL;
+    size_t  line_max = 0;
+    ssize_t len;
+    while((len = getline(&line, &line_max, in_p)) > 0){
+        if(line[len - 1] == '\n'){
+            line[--len] = '\0';
+        }
+
+        if(strncmp(line, "file ", 5) == 0){
+            p_cfg->file(p_ctx, out_p, line + 5);
+        }else
+        if(strncmp(line, "rgba ", 5) == 0){
+            FILE * file_p = fopen(line + 5, "rb");
+            ilbm_image * p_img = file_p != NULL ? ilbm_read_ctx(p_ctx, file_p, p_cfg->format(line + 5)) : NULL;
+            if(file_p != NULL){
+                fclose(file_p);
+            }
+            serve_write_rgba(out_p, p_img, line + 5);
+            ilbm_free(p_img);
+        }else
+        if(strncmp(line, "data ", 5) == 0 || strncmp(line, "rgba-data ", 10) == 0){
+            const int rgba = line[0] == 'r';
+            size_t size;
+            const char * name;
+            uint8_t * data = serve_read_data(in_p, line + (rgba ? 10 : 5), &size, &name);
+            if(data == NULL){
+                /* The stream can't be followed any further */
+                fprintf(out_p, "error bad data request\n.\n");
+                break;
+            }
+            if(rgba){
+                ilbm_image * p_img = ilbm_read_mem_ctx(p_ctx, data, size, p_cfg->format(name));
+                serve_write_rgba(out_p, p_img, name);
+                ilbm_free(p_img);
+            }else{
+                p_cfg->data(p_ctx, out_p, name, data, size);
+            }
+            free(data);
+        }else{
+            fprintf(out_p, "error unknown request\n");
+        }
+
+        fprintf(out_p, ".\n");
+        if(fflush(out_p) != 0){
+            break;
+        }
+    }
+
+    free(line);
+    fclose(in_p);
+    fclose(out_p);
+}
+
+static void * serve_worker(void * arg) {
+    serve_pool * p_pool = (serve_pool *)arg;
+
+    /* Lives as long as the server, its scratch buffer stays warm across all requests */
+    ilbm_ctx ctx;
+    ilbm_ctx_init(&ctx);
+    ctx.verbosity = p_pool->cfg->verbosity;
+    ctx.collect_stats = p_pool->cfg->collect_stats;
+
+    while(1){
+        pthread_mutex_lock(&p_pool->lock);
+        while(p_pool->cnt == 0){
+            pthread_cond_wait(&p_pool->not_empty, &p_pool->lock);
+        }
+        const int fd = p_pool->fds[p_pool->head];
+        p_pool->head = (p_pool->head + 1) % SERVE_QUEUE;
+        p_pool->cnt--;
+        pthread_cond_signal(&p_pool->not_full);
+        pthread_mutex_unlock(&p_pool->lock);
+
+        serve_connection(p_pool, &ctx, fd);
+    }
+
+    return NULL;
+}
+
+int ilbm_serve(const char * socket_path, const ilbm_serve_cfg * p_cfg) {
+    struct sockaddr_un addr;
+    if(serve_addr(&addr, socket_path) != 0){
+        return -1;
+    }
+
+    /* A socket left behind by a server that was killed */
+    struct stat st;
+    if(stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)){
+        unlink(socket_path);
+    }
+
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0){
+        return -1;
+    }
+    /* Clients have the server read any path it can, so only the owner may connect. The umask
+     * covers the socket from its creation on, no workers run yet to be affected by it. */
+    const mode_t old_mask = umask(0177);
+    const int bound = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if(bound != 0 || listen(listen_fd, SOMAXCONN) != 0){
+        close(listen_fd);
+        return -1;
+    }
+
+    /* The workers aren't joined, the pool has to outlive the call */
+    static serve_pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.cfg = p_cfg;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.not_empty, NULL);
+    pthread_cond_init(&pool.not_full, NULL);
+
+    /* The workers block SIGINT and SIGTERM, so they interrupt accept() below */
+    sigset_t stop_set;
+    sigemptyset(&stop_set);
+    sigaddset(&stop_set, SIGINT);
+    sigaddset(&stop_set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_set, NULL);
+
+    uint32_t started = 0;
+    for(uint32_t i = 0; i < (p_cfg->threads ? p_cfg->threads : 1); i++){
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, serve_worker, &pool) == 0){
+            pthread_detach(thread);
+            started++;
+        }
+    }
+
+    pthread_sigmask(SIG_UNBLOCK, &stop_set, NULL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while(started > 0 && !serve_stop){
+        const int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            break;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        while(pool.cnt == SERVE_QUEUE){
+            pthread_cond_wait(&pool.not_full, &pool.lock);
+        }
+        pool.fds[(pool.head + pool.cnt) % SERVE_QUEUE] = fd;
+        pool.cnt++;
+        pthread_cond_signal(&pool.not_empty);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    return started > 0 ? 0 : -1;
+}
+
+int ilbm_serve_connect(const char * socket_path, uint32_t wait_ms) {
+    struct sockaddr_un addr;
+    if(serve_addr(&addr, socket_path) != 0){
+        return -1;
+    }
+
+    for(uint32_t waited = 0; ; waited += 50){
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0){
+            return -1;
+        }
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0){
+            return fd;
+        }
+        const int err = errno;
+        close(fd);
+        if((err != ENOENT && err != ECONNREFUSED) || waited >= wait_ms){
+            return -1;
+        }
+        const struct timespec pause = { 0, 50 * 1000000 };
+        nanosleep(&pause, NULL);
+    }
+}
+
+int ilbm_serve_request(FILE * send_p, FILE * recv_p, const char * path, FILE * out_p) {
+    if(fprintf(send_p, "file %s\n", path) < 0 || fflush(send_p) != 0){
+        return -1;
+    }
+
+    int     ret = -1;
+    char *  line = NULL;
+    size_t  line_max = 0;
+    ssize_t len;
+    while((len = getline(&line, &line_max, recv_p)) > 0){
+        if(strcmp(line, ".\n") == 0){
+            ret = 0;
+            break;
+        }
+        fwrite(line, 1, len, out_p);
+    }
+    free(line);
+
+    return ret;
+}
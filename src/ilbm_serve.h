@@ -0,0 +1,68 @@
+/* ilbm_serve.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ILBM_SERVE_H
+#define ILBM_SERVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "libilbm.h"
+
+/* Requests are single lines, each answer ends with a line holding a single ".":
+ *
+ *   file <path>                 the lines the command line tool prints for the file
+ *   data <size> <name>          followed by size bytes of the file, answered like file
+ *   rgba <path>                 "rgba <width> <height> <name>" and width * height * 4 bytes
+ *                               of RGBA, or "error <name>: <message>"
+ *   rgba-data <size> <name>     followed by size bytes, answered like rgba
+ *
+ * Requests on one connection are answered in order, so clients can send a whole batch
+ * before they read. Connections are spread over the workers. */
+
+/* Decodes a file for the file request and writes what it found to out_p */
+typedef void (*ilbm_serve_file_fn)(ilbm_ctx * p_ctx, FILE * out_p, const char * path);
+
+/* Same for a buffer sent with the data request */
+typedef void (*ilbm_serve_data_fn)(ilbm_ctx * p_ctx, FILE * out_p, const char * name, const uint8_t * data, size_t size);
+
+typedef ILBM_FORMAT (*ilbm_serve_format_fn)(const char * path);
+
+struct {
+    uint32_t             threads;
+    int                  verbosity;
+    uint8_t              collect_stats;
+    ilbm_serve_file_fn   file;
+    ilbm_serve_data_fn   data;
+    ilbm_serve_format_fn format;
+} typedef ilbm_serve_cfg;
+
+/* Listens on socket_path until SIGINT or SIGTERM, every worker keeps its own context and
+ * scratch buffer for as long as the server runs. The socket is created with mode 0600: a
+ * client can have any file the server's user may read decoded, so only that user connects. */
+int ilbm_serve(const char * socket_path, const ilbm_serve_cfg * p_cfg);
+
+/* Connects to a server, retrying for up to wait_ms while it is still starting up. Returns
+ * the socket or -1. */
+int ilbm_serve_connect(const char * socket_path, uint32_t wait_ms);
+
+/* Sends "file <path>" on send_p and copies the answer from recv_p to out_p, without the
+ * closing ".". Returns -1 if the connection broke. */
+int ilbm_serve_request(FILE * send_p, FILE * recv_p, const char * path, FILE * out_p);
+
+#endif
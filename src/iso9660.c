@@ -0,0 +1,323 @@
+/* iso9660.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "iso9660.h"
+
+#define ISO9660_SNIFF_SIZE 64
+
+static uint32_t iso9660_le32(const uint8_t * p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const uint8_t * iso9660_extent(iso9660 * p_iso, uint32_t lba, uint32_t size) {
+    uint64_t start = (uint64_t)lba * ISO9660_SECTOR_SIZE;
+    if(start + size > p_iso->map_size){
+        return NULL;
+    }
+    return p_iso->map + start;
+}
+
+iso9660 * iso9660_open(const char * filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < 17 * ISO9660_SECTOR_SIZE){
+        close(fd);
+        return NULL;
+    }
+
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED){
+        close(fd);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_RANDOM);
+
+    iso9660 * p_iso = (iso9660 *)calloc(1, sizeof(iso9660));
+    if(p_iso == NULL){
+        munmap(map, st.st_size);
+        close(fd);
+        return NULL;
+    }
+    p_iso->fd = fd;
+    p_iso->map = (const uint8_t *)map;
+    p_iso->map_size = st.st_size;
+
+    uint32_t pvd_lba = 0, pvd_size = 0;
+    uint32_t svd_lba = 0, svd_size = 0;
+    for(uint32_t sector = 16; sector < 64; sector++){
+        const uint8_t * vd = iso9660_extent(p_iso, sector, ISO9660_SECTOR_SIZE);
+        if(vd == NULL || memcmp(vd + 1, "CD001", 5) != 0 || vd[0] == 255){
+            break;
+        }
+        if(vd[0] == 1 && pvd_lba == 0){
+            pvd_lba = iso9660_le32(vd + 156 + 2);
+            pvd_size = iso9660_le32(vd + 156 + 10);
+        }
+        if(vd[0] == 2 && vd[88] == 0x25 && vd[89] == 0x2f && (vd[90] == 0x40 || vd[90] == 0x43 || vd[90] == 0x45)){
+            svd_lba = iso9660_le32(vd + 156 + 2);
+            svd_size = iso9660_le32(vd + 156 + 10);
+        }
+    }
+
+    if(pvd_lba == 0 && svd_lba == 0){
+        iso9660_close(p_iso);
+        return NULL;
+    }
+
+    /* Rock Ridge announces itself with a SUSP "SP" entry in the root's "." record. */
+    const uint8_t * root = pvd_lba != 0 ? iso9660_extent(p_iso, pvd_lba, ISO9660_SECTOR_SIZE) : NULL;
+    if(root != NULL && root[0] >= 34 + 7){
+        const uint8_t * su = root + 34;
+        if(su[0] == 'S' && su[1] == 'P' && su[4] == 0xbe && su[5] == 0xef){
+            p_iso->rock_ridge = 1;
+            p_iso->susp_skip = su[6];
+        }
+    }
+
+    if(p_iso->rock_ridge || svd_lba == 0){
+        p_iso->root_lba = pvd_lba;
+        p_iso->root_size = pvd_size;
+    }else{
+        p_iso->joliet = 1;
+        p_iso->root_lba = svd_lba;
+        p_iso->root_size = svd_size;
+    }
+
+    return p_iso;
+}
+
+void iso9660_close(iso9660 * p_iso) {
+    if(p_iso == NULL){
+        return;
+    }
+    munmap((void *)p_iso->map, p_iso->map_size);
+    close(p_iso->fd);
+    free(p_iso);
+}
+
+static uint32_t iso9660_rr_name(iso9660 * p_iso, const uint8_t * su, uint32_t su_len, char * out, uint32_t out_len) {
+    uint32_t name_len = 0;
+    uint32_t hops = 0;
+
+    su += p_iso->susp_skip < su_len ? p_iso->susp_skip : su_len;
+    su_len -= p_iso->susp_skip < su_len ? p_iso->susp_skip : su_len;
+
+    while(su_len >= 4){
+        uint32_t entry_len = su[2];
+        if(entry_len < 4 || entry_len > su_len){
+            break;
+        }
+
+        if(su[0] == 'N' && su[1] == 'M' && entry_len >= 5){
+            if(su[4] & 0x06){
+                return 0;
+            }
+            for(uint32_t i = 5; i < entry_len && name_len + 1 < out_len; i++){
+                out[name_len++] = su[i];
+            }
+        }else
+        if(su[0] == 'C' && su[1] == 'E' && entry_len >= 28 && hops < 8){
+            const uint8_t * ce = iso9660_extent(p_iso, iso9660_le32(su + 4), iso9660_le32(su + 12) + iso9660_le32(su + 20));
+            if(ce != NULL){
+                su_len = iso9660_le32(su + 20);
+                su = ce + iso9660_le32(su + 12);
+                hops++;
+                continue;
+            }
+        }else
+        if(su[0] == 'S' && su[1] == 'T'){
+            break;
+        }
+
+        su += entry_len;
+        su_len -= entry_len;
+    }
+
+    out[name_len] = '\0';
+    return name_len;
+}
+
+static uint32_t iso9660_joliet_name(const uint8_t * name, uint32_t len, char * out, uint32_t out_len) {
+    uint32_t o = 0;
+
+    for(uint32_t i = 0; i + 1 < len; i += 2){
+        uint32_t c = (name[i] << 8) | name[i + 1];
+        if(c == ';'){
+            break;
+        }
+        if(c < 0x80){
+            if(o + 2 > out_len) break;
+            out[o++] = c;
+        }else
+        if(c < 0x800){
+            if(o + 3 > out_len) break;
+            out[o++] = 0xc0 | (c >> 6);
+            out[o++] = 0x80 | (c & 0x3f);
+        }else{
+            if(o + 4 > out_len) break;
+            out[o++] = 0xe0 | (c >> 12);
+            out[o++] = 0x80 | ((c >> 6) & 0x3f);
+            out[o++] = 0x80 | (c & 0x3f);
+        }
+    }
+
+    out[o] = '\0';
+    return o;
+}
+
+static uint32_t iso9660_plain_name(const uint8_t * name, uint32_t len, char * out, uint32_t out_len) {
+    uint32_t o = 0;
+
+    for(uint32_t i = 0; i < len && o + 1 < out_len; i++){
+        if(name[i] == ';'){
+            break;
+        }
+        out[o++] = name[i];
+    }
+    if(o > 0 && out[o - 1] == '.'){
+        o--;
+    }
+
+    out[o] = '\0';
+    return o;
+}
+
+static int iso9660_walk_dir(iso9660 * p_iso, uint32_t lba, uint32_t size, char * path, uint32_t path_len, uint32_t depth, iso9660_filter_cb filter, iso9660_file_cb cb, void * user) {
+    if(depth > ISO9660_MAX_DEPTH){
+        return 0;
+    }
+
+    /* Every directory is entered once per walk, crafted images with directories pointing at
+     * each other would otherwise be walked exponentially often */
+    if(lba >= p_iso->map_size / ISO9660_SECTOR_SIZE || (p_iso->dir_seen[lba >> 3] & (1 << (lba & 7)))){
+        return 0;
+    }
+    p_iso->dir_seen[lba >> 3] |= 1 << (lba & 7);
+
+    const uint8_t * dir = iso9660_extent(p_iso, lba, size);
+    if(dir == NULL){
+        return 0;
+    }
+
+    uint32_t pos = 0;
+    while(pos < size){
+        const uint8_t * rec = dir + pos;
+        uint32_t rec_len = rec[0];
+
+        if(rec_len == 0){
+            /* Records never straddle sectors, the rest of this one is padding. */
+            pos = (pos / ISO9660_SECTOR_SIZE + 1) * ISO9660_SECTOR_SIZE;
+            continue;
+        }
+        if(rec_len < 34 || pos + rec_len > size){
+            break;
+        }
+        pos += rec_len;
+
+        uint32_t name_len = rec[32];
+        if(33 + name_len > rec_len){
+            continue;
+        }
+        if(name_len == 1 && (rec[33] == 0 || rec[33] == 1)){
+            continue;
+        }
+
+        uint8_t  flags = rec[25];
+        uint32_t e_lba = iso9660_le32(rec + 2);
+        uint32_t e_size = iso9660_le32(rec + 10);
+
+        if(flags & 0x04){
+            continue;
+        }
+
+        char name[256];
+        uint32_t len = 0;
+        if(p_iso->rock_ridge){
+            uint32_t su_off = 33 + name_len + ((name_len & 1) ? 0 : 1);
+            if(su_off < rec_len){
+                len = iso9660_rr_name(p_iso, rec + su_off, rec_len - su_off, name, sizeof(name));
+            }
+        }
+        if(len == 0){
+            len = p_iso->joliet ? iso9660_joliet_name(rec + 33, name_len, name, sizeof(name)) : iso9660_plain_name(rec + 33, name_len, name, sizeof(name));
+        }
+        if(len == 0 || path_len + 1 + len >= ISO9660_MAX_PATH){
+            continue;
+        }
+
+        path[path_len] = '/';
+        memcpy(path + path_len + 1, name, len + 1);
+
+        int ret = 0;
+        if(flags & 0x02){
+            ret = iso9660_walk_dir(p_iso, e_lba, e_size, path, path_len + 1 + len, depth + 1, filter, cb, user);
+        }else{
+            const uint8_t * data = iso9660_extent(p_iso, e_lba, e_size);
+            if(data != NULL && e_size > 0){
+                p_iso->file_cnt++;
+                if(filter == NULL || filter(data, e_size < ISO9660_SNIFF_SIZE ? e_size : ISO9660_SNIFF_SIZE)){
+                    p_iso->candidate_cnt++;
+
+                    uintptr_t page = (uintptr_t)data & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+                    madvise((void *)page, e_size + ((uintptr_t)data - page), MADV_WILLNEED);
+
+                    ret = cb(user, path, data, e_size);
+                }
+            }
+        }
+
+        path[path_len] = '\0';
+        if(ret != 0){
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int iso9660_walk(iso9660 * p_iso, iso9660_filter_cb filter, iso9660_file_cb cb, void * user) {
+    if(p_iso == NULL || cb == NULL){
+        return -1;
+    }
+
+    p_iso->dir_seen = (uint8_t *)calloc(p_iso->map_size / ISO9660_SECTOR_SIZE / 8 + 1, 1);
+    if(p_iso->dir_seen == NULL){
+        return -1;
+    }
+
+    char path[ISO9660_MAX_PATH];
+    path[0] = '\0';
+
+    const int ret = iso9660_walk_dir(p_iso, p_iso->root_lba, p_iso->root_size, path, 0, 0, filter, cb, user);
+
+    free(p_iso->dir_seen);
+    p_iso->dir_seen = NULL;
+
+    return ret;
+}
@@ -0,0 +1,57 @@
+/* iso9660.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ISO9660_H
+#define ISO9660_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ISO9660_SECTOR_SIZE 2048
+#define ISO9660_MAX_DEPTH   32
+#define ISO9660_MAX_PATH    1024
+
+/* Called for every regular file whose first bytes pass the filter. `data` points
+ * straight into the mapped image and stays valid until iso9660_close(). A non-zero
+ * return value stops the walk. */
+typedef int (*iso9660_file_cb)(void * user, const char * path, const uint8_t * data, uint32_t size);
+
+/* Cheap look at the start of a file extent, decides whether the extent gets paged in. */
+typedef int (*iso9660_filter_cb)(const uint8_t * data, size_t size);
+
+struct {
+    int             fd;
+    const uint8_t * map;
+    size_t          map_size;
+    uint32_t        root_lba;
+    uint32_t        root_size;
+    uint8_t         joliet;
+    uint8_t         rock_ridge;
+    uint32_t        susp_skip;
+    uint32_t        file_cnt;
+    uint32_t        candidate_cnt;
+    uint8_t *       dir_seen;
+} typedef iso9660;
+
+iso9660 * iso9660_open(const char * filename);
+
+int iso9660_walk(iso9660 * p_iso, iso9660_filter_cb filter, iso9660_file_cb cb, void * user);
+
+void iso9660_close(iso9660 * p_iso);
+
+#endif
@@ -21,16 +21,113 @@
 
 #include "libilbm.h"
 
-int log_verbosity = LIBILBM_VERBOSITY;
+const char * ilbm_format_strs[] = { "ILBM", "PBM" };
+
+const char * ilbm_error_strs[] = { "OK", "Zero size", "Illegal width", "Illegal height", "No chunks found", "Magic missing", "Header missing", "Body missing", "Colormap missing", "Short repeat in body", "Short literal in body", "Unsupported 8SVX sound format", "Unsupported SMUS music format", "Unsupported ANIM animation format", "Unsupported bitmap layout", "Resource limit exceeded" };
+
+const char * ilbm_issue_strs[] = { "Run crosses row", "Overrun", "Underrun", "Trailing bytes" };
+
+static int log_verbosity = LIBILBM_VERBOSITY;
+
+static void * ilbm_default_alloc(void * user, size_t size) {
+    (void)user;
+    return malloc(size);
+}
+
+static void ilbm_default_release(void * user, void * ptr) {
+    (void)user;
+    free(ptr);
+}
+
+static void ilbm_default_log(void * user, ILBM_LOG_LEVEL level, const char * msg) {
+    static const char * level_strs[] = { "", "ERROR  ", "WARNING", "INFO   ", "DEV    " };
+
+    (void)user;
+    printf("* libilbm [%s] %s\n", level_strs[level], msg);
+}
+
+void ilbm_ctx_init(ilbm_ctx * p_ctx) {
+    memset(p_ctx, 0, sizeof(ilbm_ctx));
+
+    p_ctx->alloc = ilbm_default_alloc;
+    p_ctx->release = ilbm_default_release;
+    p_ctx->log = ilbm_default_log;
+    p_ctx->verbosity = LIBILBM_VERBOSITY;
+    p_ctx->limits.max_width = 9999;
+    p_ctx->limits.max_height = 9999;
+}
+
+void ilbm_ctx_release(ilbm_ctx * p_ctx) {
+    if(p_ctx->scratch != NULL){
+        p_ctx->release(p_ctx->user, p_ctx->scratch);
+    }
+    p_ctx->scratch = NULL;
+    p_ctx->scratch_size = 0;
+}
+
+/* Every allocation of a decode counts against limits.max_alloc, a refused one marks the decode
+ * so it ends with ILBM_ERROR_LIMIT instead of the error of whatever step ran out. */
+static void * ilbm_alloc(ilbm_ctx * p_ctx, size_t size) {
+    if(p_ctx->limits.max_alloc != 0 && p_ctx->alloc_bytes + size > p_ctx->limits.max_alloc){
+        p_ctx->over_limit = 1;
+        return NULL;
+    }
+    p_ctx->alloc_bytes += size;
+    p_ctx->stats.allocs++;
+    return p_ctx->alloc(p_ctx->user, size);
+}
+
+static void ilbm_release(ilbm_ctx * p_ctx, void * ptr) {
+    if(ptr != NULL){
+        p_ctx->release(p_ctx->user, ptr);
+    }
+}
+
+static uint8_t * ilbm_scratch(ilbm_ctx * p_ctx, size_t size) {
+    if(p_ctx->scratch_size < size){
+        ilbm_release(p_ctx, p_ctx->scratch);
+        p_ctx->scratch = (uint8_t *)ilbm_alloc(p_ctx, size);
+        p_ctx->scratch_size = p_ctx->scratch != NULL ? size : 0;
+        p_ctx->stats.scratch_grows++;
+    }
+    return p_ctx->scratch;
+}
+
+__attribute__((format(printf, 3, 4)))
+static void ilbm_log(ilbm_ctx * p_ctx, ILBM_LOG_LEVEL level, const char * format, ...) {
+    if(p_ctx->verbosity < (int)level) return;
+
+    char msg[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(msg, sizeof(msg), format, args);
+    va_end(args);
+
+    p_ctx->log(p_ctx->user, level, msg);
+}
+
+static int ilbm_chunk_over_limit(ilbm_ctx * p_ctx, uint32_t size) {
+    if(p_ctx->limits.max_chunk_bytes != 0 && size > p_ctx->limits.max_chunk_bytes){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "chunk of %u bytes over the limit", size);
+        p_ctx->over_limit = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static void ilbm_begin(ilbm_ctx * p_ctx) {
+    p_ctx->alloc_bytes = 0;
+    p_ctx->over_limit = 0;
+}
 
 #define UINT32_BE(v) ( (((v >> 24) & 0xff) << 0) | (((v >> 16) & 0xff) << 8) | (((v >> 8) & 0xff) << 16) | (((v >> 0) & 0xff) << 24) )
 #define UINT16_BE(v) ( (((v >> 8) & 0xff) << 0) | (((v >> 0) & 0xff) << 8) )
 #define INT16_BE(v)  ( (((v >> 8) & 0xff) << 0) | (((v >> 0) & 0xff) << 8) )
 
-ilbm_chunk * ilbm_read_chunk(FILE * file_p) {
+static ilbm_chunk * ilbm_read_chunk(ilbm_ctx * p_ctx, FILE * file_p) {
     fpos_t pos;
     if(fgetpos(file_p, &pos) != 0){
-        log_error("chunk pos failed");
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "chunk pos failed");
         return NULL;
     }   
 
@@ -39,9 +136,9 @@ ilbm_chunk * ilbm_read_chunk(FILE * file_p) {
         return NULL;
     }
 
-    ilbm_chunk * p_chunk = (ilbm_chunk *)malloc(sizeof(ilbm_chunk));  
+    ilbm_chunk * p_chunk = (ilbm_chunk *)ilbm_alloc(p_ctx, sizeof(ilbm_chunk));  
     if(p_chunk == NULL){
-        log_error("chunk malloc failed");
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "chunk malloc failed");
         return NULL;
     }
     
@@ -49,12 +146,13 @@ ilbm_chunk * ilbm_read_chunk(FILE * file_p) {
     p_chunk->addr = pos.__pos;
 
     if(fread((void *)&p_chunk->size, 4, 1, file_p) != 1){
-        log_error("size read failed");
-        free(p_chunk);
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "size read failed");
+        ilbm_release(p_ctx, p_chunk);
         return NULL;
     }
 
     p_chunk->size = UINT32_BE(p_chunk->size);
+    p_chunk->borrowed = 0;
     p_chunk->next_chunk = NULL;
 
     uint32_t c_size = p_chunk->size;
@@ -62,25 +160,29 @@ ilbm_chunk * ilbm_read_chunk(FILE * file_p) {
     if(pos.__pos == 0){
         c_size = 4;
     }
-    p_chunk->content = (uint8_t *)malloc(c_size); 
+    if(ilbm_chunk_over_limit(p_ctx, c_size)){
+        ilbm_release(p_ctx, p_chunk);
+        return NULL;
+    }
+    p_chunk->content = (uint8_t *)ilbm_alloc(p_ctx, c_size); 
     if(p_chunk->content == NULL){
-        log_error("content malloc failed");
-        free(p_chunk);
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "content malloc failed");
+        ilbm_release(p_ctx, p_chunk);
         return NULL;
     }
 
     if(fread(p_chunk->content, c_size, 1, file_p) != 1){
-        log_error("content read failed");
-        free(p_chunk->content);
-        free(p_chunk);
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "content read failed");
+        ilbm_release(p_ctx, p_chunk->content);
+        ilbm_release(p_ctx, p_chunk);
         return NULL;
     }
 
     if((c_size & 1) && !feof(file_p)){        
         if(fseek(file_p, 1, SEEK_CUR) != 0){
-            log_error("pad seek failed");
-            free(p_chunk->content);
-            free(p_chunk);
+            ilbm_log(p_ctx, ILBM_LOG_ERROR, "pad seek failed");
+            ilbm_release(p_ctx, p_chunk->content);
+            ilbm_release(p_ctx, p_chunk);
             return NULL;
         } 
     }
@@ -88,17 +190,51 @@ ilbm_chunk * ilbm_read_chunk(FILE * file_p) {
     return p_chunk;
 }
 
-ilbm_image * ilbm_read(FILE *file_p, ILBM_FORMAT format) {
+static ilbm_chunk * ilbm_read_chunk_mem(ilbm_ctx * p_ctx, const uint8_t * buf, size_t len, size_t * p_pos) {
+    size_t pos = *p_pos;
 
-    log_info("libilbm %s", LIBILBM_VERSION);
+    if(pos + 8 > len){
+        return NULL;
+    }
 
-    if(file_p == NULL){        
+    ilbm_chunk * p_chunk = (ilbm_chunk *)ilbm_alloc(p_ctx, sizeof(ilbm_chunk));  
+    if(p_chunk == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "chunk malloc failed");
         return NULL;
     }
-    
-    ilbm_image * p_img   = (ilbm_image *)malloc(sizeof(ilbm_image));  
+
+    memcpy(p_chunk->name, buf + pos, 4);
+    p_chunk->addr = pos;
+
+    memcpy(&p_chunk->size, buf + pos + 4, 4);
+    p_chunk->size = UINT32_BE(p_chunk->size);
+    p_chunk->borrowed = 1;
+    p_chunk->next_chunk = NULL;
+
+    uint32_t c_size = p_chunk->size;
+
+    if(pos == 0){
+        c_size = 4;
+    }
+    if(c_size > len - pos - 8 || ilbm_chunk_over_limit(p_ctx, c_size)){
+        ilbm_release(p_ctx, p_chunk);
+        return NULL;
+    }
+    p_chunk->content = (uint8_t *)(buf + pos + 8);
+
+    pos += 8 + c_size;
+    if((c_size & 1) && pos < len){
+        pos++;
+    }
+    *p_pos = pos;
+
+    return p_chunk;
+}
+
+static ilbm_image * ilbm_image_new(ilbm_ctx * p_ctx) {
+    ilbm_image * p_img   = (ilbm_image *)ilbm_alloc(p_ctx, sizeof(ilbm_image));  
     if(p_img == NULL){
-        log_error("malloc failed");
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "malloc failed");
         return NULL;
     }
 
@@ -107,409 +243,1919 @@ ilbm_image * ilbm_read(FILE *file_p, ILBM_FORMAT format) {
     p_img->warnings = 0;
     p_img->next_image = NULL;
     p_img->pixels = NULL;
+    p_img->planes = NULL;
+    p_img->plane_count = 0;
+    p_img->row_bytes = 0;
     p_img->palette = NULL;
     p_img->alpha = NULL;
+    p_img->true_color = 0;
+    p_img->color_count = 0;
+    p_img->cycle_count = 0;
+    p_img->cycles = NULL;
+    p_img->has_grab = 0;
+    p_img->grab_x = 0;
+    p_img->grab_y = 0;
+    p_img->has_dest = 0;
+    memset(&p_img->dest, 0, sizeof(ilbm_dest));
+    p_img->is_sprite = 0;
+    p_img->sprite_precedence = 0;
+    p_img->max_index = 0;
+    p_img->histogram = NULL;
+    p_img->used_colors = 0;
+    p_img->opaque_x0 = 0;
+    p_img->opaque_y0 = 0;
+    p_img->opaque_x1 = 0;
+    p_img->opaque_y1 = 0;
 
     p_img->first_chunk = NULL;
-    p_img->form_chunk = ilbm_read_chunk(file_p);
+    p_img->form_chunk = NULL;
     p_img->bmhd_chunk = NULL;
     p_img->body_chunk = NULL;
     p_img->cmap_chunk = NULL;
 
-    if(p_img->form_chunk == NULL){
-        p_img->error = ILBM_ERROR_FORM_MISSING;
-        return p_img;
-    }
+    p_img->release = p_ctx->release;
+    p_img->release_user = p_ctx->user;
 
-    if(*(uint32_t *)(p_img->form_chunk->name) != *(uint32_t *)"FORM"){
-        p_img->warnings |= (1 << ILBM_WARN_FORM_BY_POSITION);        
-    }
+    return p_img;
+}
 
-    if(format == ILBM_FORMAT_PBM || memcmp(p_img->form_chunk->content, "PBM ", 4) == 0){
-        p_img->format = ILBM_FORMAT_PBM;
+static uint32_t ilbm_append_chunk(ilbm_ctx * p_ctx, ilbm_image * p_img, ilbm_chunk * p_last, ilbm_chunk * c, uint32_t chunk_cnt) {
+    if(p_img->first_chunk == NULL){
+        p_img->first_chunk = c;                
+    }else{
+        p_last->next_chunk = c;
     }
 
-    uint32_t chunk_cnt = 0;    
-    ilbm_chunk * chunk = NULL;
-    while (1) {
-        ilbm_chunk * c = ilbm_read_chunk(file_p);        
-        if(c != NULL){
-            if(p_img->first_chunk == NULL){
-                p_img->first_chunk = c;                
-            }else{
-                chunk->next_chunk = c;
-            }
-            chunk = c;            
-        
-            log_info("chunk %2d: \"%4.4s\" addr: %d size: %d", chunk_cnt, chunk->name, chunk->addr, chunk->size);            
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "chunk %2d: \"%4.4s\" addr: %d size: %d", chunk_cnt, c->name, c->addr, c->size);            
 
-            chunk_cnt++;
-        }else{
-            break;
-        }
-        chunk = c;
-    }    
+    return chunk_cnt + 1;
+}
 
-    if(chunk_cnt < 3){        
-        p_img->error = ILBM_ERROR_NO_CHUNKS;
-        return p_img;
-    }
+static ilbm_image * ilbm_parse(ilbm_ctx * p_ctx, ilbm_image * p_img, ILBM_FORMAT format, uint32_t chunk_cnt);
 
-    if(memcmp(p_img->form_chunk->content, "8SVX", 4) == 0){
-        p_img->error = ILBM_ERROR_IFF_8SVX;
-        return p_img;
+static ilbm_image * ilbm_account(ilbm_ctx * p_ctx, ilbm_image * p_img) {
+    if(p_ctx->over_limit){
+        p_img->error = ILBM_ERROR_LIMIT;
     }
-    if(memcmp(p_img->form_chunk->content, "SMUS", 4) == 0){
-        p_img->error = ILBM_ERROR_IFF_SMUS;
-        return p_img;
+    p_ctx->stats.images++;
+    if(p_img->error != ILBM_OK){
+        p_ctx->stats.failed++;
     }
-    if(memcmp(p_img->form_chunk->content, "ANIM", 4) == 0){
-        p_img->error = ILBM_ERROR_IFF_ANIM;
-        return p_img;
+    return p_img;
+}
+
+ilbm_image * ilbm_read_ctx(ilbm_ctx * p_ctx, FILE * file_p, ILBM_FORMAT format) {
+
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "libilbm %s (%s)", LIBILBM_VERSION, ilbm_simd_name());
+
+    if(file_p == NULL){        
+        return NULL;
     }
 
-    ilbm_chunk * bmhd_chunk = p_img->first_chunk;
-    while(bmhd_chunk != NULL){
-        if(*(uint32_t *)(bmhd_chunk->name) == *(uint32_t *)"BMHD"){        
-            break;
-        }
-        bmhd_chunk = bmhd_chunk->next_chunk;
+    ilbm_begin(p_ctx);
+    
+    ilbm_image * p_img = ilbm_image_new(p_ctx);
+    if(p_img == NULL){
+        return NULL;
     }
-    if(bmhd_chunk == NULL){
-        bmhd_chunk = p_img->first_chunk;
-        while(bmhd_chunk != NULL){
-            if(bmhd_chunk->size == sizeof(ilbm_head)) { 
-                p_img->warnings |= (1 << ILBM_WARN_BHMD_BY_POSITION);                
-                break;
-            }
-            bmhd_chunk = bmhd_chunk->next_chunk;
-        }
+
+    p_img->form_chunk = ilbm_read_chunk(p_ctx, file_p);
+
+    uint32_t chunk_cnt = 0;    
+    if(p_img->form_chunk != NULL){
+        p_ctx->stats.bytes += 8 + 4;
+        ilbm_chunk * chunk = NULL;
+        ilbm_chunk * c;
+        while((c = ilbm_read_chunk(p_ctx, file_p)) != NULL) {
+            chunk_cnt = ilbm_append_chunk(p_ctx, p_img, chunk, c, chunk_cnt);
+            chunk = c;
+            p_ctx->stats.bytes += 8 + c->size;
+        }    
     }
-    if(bmhd_chunk == NULL){
-        bmhd_chunk = p_img->first_chunk;
-        p_img->warnings |= (1 << ILBM_WARN_BHMD_BY_POSITION) | (1 << ILBM_WARN_BHMD_SIZE_MISMATCH);        
+
+    if(p_ctx->over_limit){
+        return ilbm_account(p_ctx, p_img);
     }
-    p_img->bmhd_chunk = bmhd_chunk;
-    
-    ilbm_head bmhd;
-    memcpy(&bmhd,  p_img->first_chunk->content, sizeof(bmhd));
 
-    bmhd.width = UINT16_BE(bmhd.width);
-    bmhd.height = UINT16_BE(bmhd.height);
-    bmhd.trans_clr = UINT16_BE(bmhd.trans_clr);
-    bmhd.page_width = INT16_BE(bmhd.page_width);
-    bmhd.page_height = INT16_BE(bmhd.page_height);
-    
-    log_info("format      : %s", ilbm_format_strs[p_img->format]);
+    return ilbm_account(p_ctx, ilbm_parse(p_ctx, p_img, format, chunk_cnt));
+}
 
-    log_info("width       : %i", bmhd.width);
-    log_info("height      : %i", bmhd.height);
-    log_info("x_origin    : %i", bmhd.x_origin);
-    log_info("y_origin    : %i", bmhd.y_origin);
+/* Builds the chunk list of an image in memory, the contents are borrowed from buf */
+static uint32_t ilbm_collect_mem(ilbm_ctx * p_ctx, ilbm_image * p_img, const uint8_t * buf, size_t len) {
+    size_t pos = 0;
+    p_img->form_chunk = ilbm_read_chunk_mem(p_ctx, buf, len, &pos);
 
-    log_info("num_planes  : %i", bmhd.num_planes);
-    log_info("mask        : %i", bmhd.mask);
-    log_info("compression : %i", bmhd.compression);
-    log_info("pad1        : %i", bmhd.pad1);
+    uint32_t chunk_cnt = 0;    
+    if(p_img->form_chunk != NULL){
+        ilbm_chunk * chunk = NULL;
+        ilbm_chunk * c;
+        while((c = ilbm_read_chunk_mem(p_ctx, buf, len, &pos)) != NULL) {
+            chunk_cnt = ilbm_append_chunk(p_ctx, p_img, chunk, c, chunk_cnt);
+            chunk = c;
+        }    
+    }
 
-    log_info("trans_clr   : %i", bmhd.trans_clr);
-    log_info("x_aspect    : %i", bmhd.x_aspect);
-    log_info("y_aspect    : %i", bmhd.y_aspect);
-    log_info("page_width  : %i", bmhd.page_width);
-    log_info("page_height : %i", bmhd.page_height);
+    return chunk_cnt;
+}
 
-    p_img->width = bmhd.width;
-    p_img->height = bmhd.height;
-    p_img->size = p_img->width * p_img->height; 
+ilbm_image * ilbm_read_mem_ctx(ilbm_ctx * p_ctx, const uint8_t * buf, size_t len, ILBM_FORMAT format) {
 
-    if(p_img->size == 0){
-        p_img->error = ILBM_ERROR_ZERO_SIZE;
-        return p_img;
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "libilbm %s (%s)", LIBILBM_VERSION, ilbm_simd_name());
+
+    if(buf == NULL){        
+        return NULL;
     }
-    
-    if(p_img->width > 9999){
-        p_img->error = ILBM_ERROR_ILLEGAL_WIDTH;
-        return p_img;
+
+    ilbm_begin(p_ctx);
+
+    ilbm_image * p_img = ilbm_image_new(p_ctx);
+    if(p_img == NULL){
+        return NULL;
     }
 
-    if(p_img->height > 9999){
-        p_img->error = ILBM_ERROR_ILLEGAL_WIDTH;
-        return p_img;
+    p_ctx->stats.bytes += len;
+
+    uint32_t chunk_cnt = ilbm_collect_mem(p_ctx, p_img, buf, len);
+
+    if(p_ctx->over_limit){
+        return ilbm_account(p_ctx, p_img);
     }
 
-    if(bmhd.mask != 0){
-        p_img->alpha = (uint8_t *)malloc(p_img->size);
-        if(p_img->alpha == NULL){
-            log_error("alpha malloc failed");        
-            return p_img;
-        }        
-        memset(p_img->alpha, 0xff, p_img->size);
+    return ilbm_account(p_ctx, ilbm_parse(p_ctx, p_img, format, chunk_cnt));
+}
+
+/* The context free entry points decode with a throw-away context on the stack, so
+ * they stay thread safe; only the verbosity comes from log_set_verbosity(). */
+ilbm_image * ilbm_read(FILE *file_p, ILBM_FORMAT format) {
+    ilbm_ctx ctx;
+    ilbm_ctx_init(&ctx);
+    ctx.verbosity = log_verbosity;
+
+    ilbm_image * p_img = ilbm_read_ctx(&ctx, file_p, format);
+
+    ilbm_ctx_release(&ctx);
+
+    return p_img;
+}
+
+ilbm_image * ilbm_read_mem(const uint8_t * buf, size_t len, ILBM_FORMAT format) {
+    ilbm_ctx ctx;
+    ilbm_ctx_init(&ctx);
+    ctx.verbosity = log_verbosity;
+
+    ilbm_image * p_img = ilbm_read_mem_ctx(&ctx, buf, len, format);
+
+    ilbm_ctx_release(&ctx);
+
+    return p_img;
+}
+
+static int ilbm_is_id_char(uint8_t c) {
+    return c >= 0x20 && c <= 0x7e;
+}
+
+int ilbm_sniff(const uint8_t * buf, size_t len) {
+    if(buf == NULL || len < 20){
+        return 0;
     }
 
-    ilbm_chunk * body_chunk = p_img->first_chunk;
-    while(body_chunk != NULL){
-        if(*(uint32_t *)(body_chunk->name) == *(uint32_t *)"BODY"){        
-            break;    
+    for(uint32_t i = 0; i < 4; i++){
+        if(!ilbm_is_id_char(buf[i]) || !ilbm_is_id_char(buf[8 + i]) || !ilbm_is_id_char(buf[12 + i])){
+            return 0;
         }
-        body_chunk = body_chunk->next_chunk;        
     }
-    if(body_chunk == 0){        
-        ilbm_chunk * chunk = p_img->first_chunk;                
-        uint32_t size_max = 0;
-        while(chunk != NULL){
-            if(chunk->size >= size_max){
-                size_max = chunk->size;
-                body_chunk = chunk;
+
+    uint32_t size;
+    memcpy(&size, buf + 16, 4);
+    size = UINT32_BE(size);
+
+    return size <= len - 20;
+}
+
+/* Planar to chunky through a table that spreads the 8 bits of a plane byte over
+ * the 8 bytes of a uint64_t, so 8 pixels are assembled with one lookup per plane. */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define ILBM_SPREAD(x) ( ((uint64_t)((x) >> 7 & 1) << 56) | ((uint64_t)((x) >> 6 & 1) << 48) | ((uint64_t)((x) >> 5 & 1) << 40) | ((uint64_t)((x) >> 4 & 1) << 32) | \
+                             ((uint64_t)((x) >> 3 & 1) << 24) | ((uint64_t)((x) >> 2 & 1) << 16) | ((uint64_t)((x) >> 1 & 1) <<  8) | ((uint64_t)((x) >> 0 & 1) <<  0) )
+#else
+    #define ILBM_SPREAD(x) ( ((uint64_t)((x) >> 7 & 1) <<  0) | ((uint64_t)((x) >> 6 & 1) <<  8) | ((uint64_t)((x) >> 5 & 1) << 16) | ((uint64_t)((x) >> 4 & 1) << 24) | \
+                             ((uint64_t)((x) >> 3 & 1) << 32) | ((uint64_t)((x) >> 2 & 1) << 40) | ((uint64_t)((x) >> 1 & 1) << 48) | ((uint64_t)((x) >> 0 & 1) << 56) )
+#endif
+#define ILBM_SPREAD4(x)  ILBM_SPREAD(x), ILBM_SPREAD(x + 1), ILBM_SPREAD(x + 2), ILBM_SPREAD(x + 3)
+#define ILBM_SPREAD16(x) ILBM_SPREAD4(x), ILBM_SPREAD4(x + 4), ILBM_SPREAD4(x + 8), ILBM_SPREAD4(x + 12)
+#define ILBM_SPREAD64(x) ILBM_SPREAD16(x), ILBM_SPREAD16(x + 16), ILBM_SPREAD16(x + 32), ILBM_SPREAD16(x + 48)
+
+static const uint64_t ilbm_spread_lut[256] = { ILBM_SPREAD64(0), ILBM_SPREAD64(64), ILBM_SPREAD64(128), ILBM_SPREAD64(192) };
+
+struct {
+    const uint8_t * src;
+    uint32_t        size;
+    uint32_t        pos;
+    uint32_t        run;
+    uint8_t         run_byte;
+    uint8_t         literal;
+    ILBM_ERROR      error;
+    uint8_t         pending;
+} typedef ilbm_unpacker;
+
+/* Fills up to len bytes, returns how many were available. Runs may cross plane and row boundaries. */
+static inline __attribute__((always_inline)) uint32_t ilbm_unpack(ilbm_unpacker * u, uint8_t * dst, uint32_t len, const int compressed) {
+    if(!compressed){
+        uint32_t n = u->size - u->pos < len ? u->size - u->pos : len;
+        memcpy(dst, u->src + u->pos, n);
+        u->pos += n;
+        return n;
+    }
+
+    uint32_t done = 0;
+    while(done < len){
+        if(u->run > 0){
+            uint32_t n = u->run < len - done ? u->run : len - done;
+            if(u->literal){
+                memcpy(dst + done, u->src + u->pos, n);
+                u->pos += n;
+            }else{
+                memset(dst + done, u->run_byte, n);
             }
-            chunk = chunk->next_chunk;        
+            u->run -= n;
+            done += n;
+            continue;
         }
-        if(body_chunk != bmhd_chunk){
-            p_img->warnings |= (1 << ILBM_WARN_BODY_BY_SIZE);            
-        }else{            
-            p_img->error = ILBM_ERROR_BODY_MISSING;
-            return p_img;
-        }
-    }
-    p_img->body_chunk = body_chunk;
 
-    p_img->pixels = (uint8_t *)malloc(p_img->size * sizeof(uint32_t));
-    if(p_img->pixels == NULL){
-        log_error("pixels malloc failed");        
-        return p_img;
-    }
-    memset(p_img->pixels, 0, p_img->size * sizeof(uint32_t));
+        if(u->pos >= u->size || u->error != ILBM_OK){
+            break;
+        }
 
-    uint8_t * pixels = p_img->pixels;
-    uint32_t plane_no = 0;
-    uint32_t row_no = 0;
-    uint32_t col_no = 0;
-    uint32_t byte_i = 0;
-    if(bmhd.compression == 0){
-        
-        while(1){
-            if(byte_i >= body_chunk->size){                
+        uint8_t byte = u->src[u->pos++];
+        if(byte > 128){
+            if(u->pos >= u->size){
+                u->error = ILBM_ERROR_BODY_SHORT_REPEAT;
                 break;
             }
-
-            uint8_t byte = body_chunk->content[byte_i];                        
-            byte_i++;            
-
-            if(col_no >= p_img->width){
-                col_no = 0;
-                plane_no++;
-                if(plane_no == bmhd.num_planes){
-                    plane_no = 0;
-                    row_no++;
-                    if(row_no == bmhd.height){
-                        break;
-                    }
-                }
+            u->run = 257 - byte;
+            u->run_byte = u->src[u->pos++];
+            u->literal = 0;
+        }else
+        if(byte < 128){
+            u->run = byte + 1;
+            u->literal = 1;
+            if(u->run > u->size - u->pos){
+                u->run = u->size - u->pos;
+                u->error = ILBM_ERROR_BODY_SHORT_LITERAL;
             }
+        }
+    }
 
-            for(uint32_t ii = 0; ii < 8; ii++){                        
-                if(col_no >= p_img->width) break;
+    return done;
+}
 
-                if(byte & (0x80 >> ii)){
-                    p_img->pixels[row_no * p_img->width + col_no] |= (1 << plane_no);
-                }
-                col_no++;
-            }       
-        }
+/* ilbm_unpack for a body that arrives in pieces: src and size describe the current piece and
+ * the run state carries over to the next one. A repeat whose byte is still missing waits as
+ * pending, a literal longer than the piece continues in the next one. */
+static uint32_t ilbm_unpack_piece(ilbm_unpacker * u, uint8_t * dst, uint32_t len, int compressed) {
+    if(!compressed){
+        return ilbm_unpack(u, dst, len, 0);
+    }
 
-    }else{
-        while(1){
-            if(byte_i >= body_chunk->size){                
+    uint32_t done = 0;
+    while(done < len){
+        if(u->pending){
+            if(u->pos >= u->size){
                 break;
             }
+            u->run_byte = u->src[u->pos++];
+            u->pending = 0;
+        }
 
-            uint8_t byte = body_chunk->content[byte_i];                        
-            byte_i++;
-            
-            log_dev("act: %c len: %3d next: %3d| r: %3d c: %3d p: %d", byte > 128 ? 'r' : byte < 128 ? 'l' : 'e', byte > 128 ? 257 - byte : byte + 1, body_chunk->content[byte_i], row_no, col_no, plane_no);
-
-            if(byte > 128){
-                if(byte_i >= body_chunk->size){
-                    p_img->error = ILBM_ERROR_BODY_SHORT_REPEAT;                    
+        if(u->run > 0){
+            uint32_t n = u->run < len - done ? u->run : len - done;
+            if(u->literal){
+                n = n < u->size - u->pos ? n : u->size - u->pos;
+                if(n == 0){
                     break;
                 }
-
-                uint8_t repeat = body_chunk->content[byte_i];
-                byte_i++;
-                
-                switch(p_img->format){
-                    case ILBM_FORMAT_ILBM:
-                        for(uint32_t i = 0; i < 257 - byte; i++){                    
-                            for(uint32_t ii = 0; ii < 8; ii++){                        
-                                if(col_no >= p_img->width){
-                                    col_no = 0;
-                                    plane_no++;
-                                    if(plane_no == bmhd.num_planes){
-                                        plane_no = 0;
-                                        row_no++;
-                                    }
-                                }
-                                
-                                if(repeat & (0x80 >> ii)){
-                                    p_img->pixels[row_no * p_img->width + col_no] |= (1 << plane_no);                            
-                                }                        
-                                col_no++;                      
-                            }
-                        }                        
-                        break;
-                    case ILBM_FORMAT_PBM:
-                        for(uint32_t i = 0; i < 257 - byte; i++){                                                
-                            if(col_no >= p_img->width){
-                                col_no = 0;
-                                row_no++;
-                            }
-                                
-                            p_img->pixels[row_no * p_img->width + col_no] = repeat;                                                        
-                            col_no++;                      
-                        }                        
-                        break;
-                }
-            }else
-            if(byte < 128){
-                for(uint32_t i = 0; i < (byte + 1); i++){
-                    if(byte_i > body_chunk->size){                        
-                        p_img->error = ILBM_ERROR_BODY_SHORT_LITERAL;
-                        break;
-                    }
-
-                    uint8_t literal = body_chunk->content[byte_i];
-                    byte_i++;
-
-                    switch(p_img->format){
-                        case ILBM_FORMAT_ILBM:
-                            for(uint32_t ii = 0; ii < 8; ii++){                        
-                                if(col_no >= p_img->width){
-                                    col_no = 0;
-                                    plane_no++;
-                                    if(plane_no == bmhd.num_planes){
-                                        plane_no = 0;
-                                        row_no++;
-                                    }
-                                }
-
-                                if(literal & (0x80 >> ii)){
-                                    p_img->pixels[row_no * p_img->width + col_no] |= (1 << plane_no);
-                                }
-                                col_no++;
-                            }                    
-                            break;
-                        case ILBM_FORMAT_PBM:
-                            if(col_no >= p_img->width){
-                                col_no = 0;
-                                row_no++;
-                            }
-
-                            p_img->pixels[row_no * p_img->width + col_no] = literal;
-                            
-                            col_no++;                    
-                            break;
-                    }
-                }
+                memcpy(dst + done, u->src + u->pos, n);
+                u->pos += n;
             }else{
-                break;
-            }            
+                memset(dst + done, u->run_byte, n);
+            }
+            u->run -= n;
+            done += n;
+            continue;
+        }
+
+        if(u->pos >= u->size){
+            break;
         }
 
+        uint8_t byte = u->src[u->pos++];
+        if(byte > 128){
+            u->run = 257 - byte;
+            u->literal = 0;
+            u->pending = 1;
+        }else
+        if(byte < 128){
+            u->run = byte + 1;
+            u->literal = 1;
+        }
     }
 
-    uint32_t color_max = 0;
-    for(uint32_t i = 0; i < p_img->size; i++){
-        if(p_img->pixels[i] > color_max) color_max = p_img->pixels[i];
+    return done;
+}
+
+static inline __attribute__((always_inline)) void ilbm_p2c(const uint8_t * planes, uint32_t row_bytes, uint8_t * dst, uint32_t width, const uint32_t num_planes) {
+    for(uint32_t x = 0, col = 0; col < width; x++, col += 8){
+        uint64_t px = 0;
+        for(uint32_t p = 0; p < num_planes; p++){
+            px |= ilbm_spread_lut[planes[p * row_bytes + x]] << p;
+        }
+        memcpy(dst + col, &px, width - col < 8 ? width - col : 8);
     }
+}
 
-    if(bmhd.mask == 2){
-        for(uint32_t i = 0; i < p_img->size; i++){
-            if(p_img->pixels[i] == bmhd.trans_clr){
-                p_img->alpha[i] = 0x00;
-            }
+/* The way back: bit p of 8 pixels is gathered into one plane byte by a single multiplication.
+ * Every bit of the product lands on a position of its own, so nothing carries into the top byte. */
+static inline __attribute__((always_inline)) void ilbm_c2p(const uint8_t * chunky, uint32_t width, uint8_t * planes, size_t plane_stride, const uint32_t num_planes) {
+    for(uint32_t x = 0, col = 0; col < width; x++, col += 8){
+        uint64_t px = 0;
+        memcpy(&px, chunky + col, width - col < 8 ? width - col : 8);
+        for(uint32_t p = 0; p < num_planes; p++){
+            planes[p * plane_stride + x] = (((px >> p) & 0x0101010101010101ull) * 0x8040201008040201ull) >> 56;
         }
     }
+}
 
-    ilbm_chunk * cmap_chunk = p_img->first_chunk;
-    while(cmap_chunk != NULL){
-        if(*(uint32_t *)(cmap_chunk->name) == *(uint32_t *)"CMAP"){                
-            break;    
+/* The row kernels below do the same as ilbm_p2c for 16 or 32 pixels at a time: every plane
+ * byte is broadcast over 8 lanes, tested against one bit per lane and ORed into the result.
+ * The kernel is picked once, when the library is loaded, by ilbm_simd_init(). */
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__ELF__)
+#define ILBM_SIMD_DISPATCH
+
+#include <immintrin.h>
+
+typedef void (*ilbm_p2c_fn)(const uint8_t * planes, uint32_t row_bytes, uint8_t * dst, uint32_t width, uint32_t num_planes);
+
+__attribute__((target("sse2")))
+static void ilbm_p2c_sse2(const uint8_t * planes, uint32_t row_bytes, uint8_t * dst, uint32_t width, uint32_t num_planes) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+
+    uint32_t col = 0;
+    for(; col + 16 <= width; col += 16){
+        const uint8_t * src = planes + (col >> 3);
+        __m128i px = _mm_setzero_si128();
+        for(uint32_t p = 0; p < num_planes; p++){
+            __m128i v = _mm_cvtsi32_si128(src[p * row_bytes] | (src[p * row_bytes + 1] << 8));
+            v = _mm_unpacklo_epi8(v, v);
+            v = _mm_unpacklo_epi16(v, v);
+            v = _mm_unpacklo_epi32(v, v);
+            v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+            px = _mm_or_si128(px, _mm_and_si128(v, _mm_set1_epi8(1 << p)));
         }
-        cmap_chunk = cmap_chunk->next_chunk;        
+        _mm_storeu_si128((__m128i *)(dst + col), px);
     }
-    if(cmap_chunk == NULL){
-        cmap_chunk = p_img->first_chunk;
-        while(cmap_chunk != NULL){                
-            if((cmap_chunk != bmhd_chunk) && (cmap_chunk->size == (1 << bmhd.num_planes) * 3)){
-                p_img->warnings |= (1 << ILBM_WARN_CMAP_BY_EXACT_SIZE);                
-                break;    
-            }
-            cmap_chunk = cmap_chunk->next_chunk;        
+    ilbm_p2c(planes + (col >> 3), row_bytes, dst + col, width - col, num_planes);
+}
+
+__attribute__((target("ssse3")))
+static void ilbm_p2c_ssse3(const uint8_t * planes, uint32_t row_bytes, uint8_t * dst, uint32_t width, uint32_t num_planes) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i spread = _mm_set_epi8(1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    uint32_t col = 0;
+    for(; col + 16 <= width; col += 16){
+        const uint8_t * src = planes + (col >> 3);
+        __m128i px = _mm_setzero_si128();
+        for(uint32_t p = 0; p < num_planes; p++){
+            __m128i v = _mm_shuffle_epi8(_mm_cvtsi32_si128(src[p * row_bytes] | (src[p * row_bytes + 1] << 8)), spread);
+            v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+            px = _mm_or_si128(px, _mm_and_si128(v, _mm_set1_epi8(1 << p)));
         }
+        _mm_storeu_si128((__m128i *)(dst + col), px);
     }
-    if(cmap_chunk == NULL){
-        cmap_chunk = p_img->first_chunk;
-        while(cmap_chunk != NULL){            
-            if((cmap_chunk != bmhd_chunk) && (cmap_chunk->size >= color_max * 3)){
-                p_img->warnings |= (1 << ILBM_WARN_CMAP_BY_MIN_SIZE);                
-                break;    
-            }
-            cmap_chunk = cmap_chunk->next_chunk;        
+    ilbm_p2c(planes + (col >> 3), row_bytes, dst + col, width - col, num_planes);
+}
+
+__attribute__((target("avx2")))
+static void ilbm_p2c_avx2(const uint8_t * planes, uint32_t row_bytes, uint8_t * dst, uint32_t width, uint32_t num_planes) {
+    const __m256i bits = _mm256_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                         1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i spread = _mm256_set_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+                                           1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    uint32_t col = 0;
+    for(; col + 32 <= width; col += 32){
+        const uint8_t * src = planes + (col >> 3);
+        __m256i px = _mm256_setzero_si256();
+        for(uint32_t p = 0; p < num_planes; p++){
+            uint32_t word;
+            memcpy(&word, src + p * row_bytes, 4);
+            __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+            v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+            px = _mm256_or_si256(px, _mm256_and_si256(v, _mm256_set1_epi8(1 << p)));
         }
+        _mm256_storeu_si256((__m256i *)(dst + col), px);
     }
+    ilbm_p2c(planes + (col >> 3), row_bytes, dst + col, width - col, num_planes);
+}
 
-    if(cmap_chunk == NULL){        
-        p_img->error = ILBM_ERROR_CMAP_MISSING;
-        return p_img;
+/* Upgraded by ilbm_simd_init() */
+static ilbm_p2c_fn  ilbm_p2c_row = ilbm_p2c_sse2;
+static const char * ilbm_simd = "sse2";
+
+/* Chunky to planar kernels: the pixels of each 8 are put in reverse order, then one shift moves
+ * bit p of every byte to its top bit and pmovmskb collects them, 16 or 32 plane bits at once. */
+typedef void (*ilbm_c2p_fn)(const uint8_t * chunky, uint32_t width, uint8_t * planes, size_t plane_stride, uint32_t num_planes);
+
+__attribute__((target("sse2")))
+static void ilbm_c2p_sse2(const uint8_t * chunky, uint32_t width, uint8_t * planes, size_t plane_stride, uint32_t num_planes) {
+    uint32_t col = 0;
+    for(; col + 16 <= width; col += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(chunky + col));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1b), 0x1b);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        for(uint32_t p = 0; p < num_planes; p++){
+            const uint16_t bits = _mm_movemask_epi8(_mm_slli_epi64(v, 7 - p));
+            memcpy(planes + p * plane_stride + (col >> 3), &bits, 2);
+        }
     }
-    p_img->cmap_chunk = cmap_chunk;
+    ilbm_c2p(chunky + col, width - col, planes + (col >> 3), plane_stride, num_planes);
+}
 
-    p_img->color_count = cmap_chunk->size / 3;
-    p_img->palette = (uint8_t *)malloc(cmap_chunk->size);
+__attribute__((target("avx2")))
+static void ilbm_c2p_avx2(const uint8_t * chunky, uint32_t width, uint8_t * planes, size_t plane_stride, uint32_t num_planes) {
+    const __m256i reverse = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+                                            8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+
+    uint32_t col = 0;
+    for(; col + 32 <= width; col += 32){
+        const __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(chunky + col)), reverse);
+        for(uint32_t p = 0; p < num_planes; p++){
+            const uint32_t bits = _mm256_movemask_epi8(_mm256_slli_epi64(v, 7 - p));
+            memcpy(planes + p * plane_stride + (col >> 3), &bits, 4);
+        }
+    }
+    ilbm_c2p(chunky + col, width - col, planes + (col >> 3), plane_stride, num_planes);
+}
+
+static ilbm_c2p_fn ilbm_c2p_kernel = ilbm_c2p_sse2;
+
+/* A constructor rather than an ifunc resolver: resolvers run while the library is relocated,
+ * before a sanitizer runtime is set up, and crash instrumented builds. Anything decoding even
+ * earlier gets SSE2, which every x86-64 has. */
+__attribute__((constructor))
+static void ilbm_simd_init(void) {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        ilbm_p2c_row = ilbm_p2c_avx2;
+        ilbm_c2p_kernel = ilbm_c2p_avx2;
+        ilbm_simd = "avx2";
+    }else
+    if(__builtin_cpu_supports("ssse3")){
+        ilbm_p2c_row = ilbm_p2c_ssse3;
+        ilbm_simd = "ssse3";
+    }
+}
+
+void ilbm_c2p_row(const uint8_t * chunky, uint32_t width, uint8_t * planes, size_t plane_stride, uint32_t num_planes) {
+    ilbm_c2p_kernel(chunky, width, planes, plane_stride, num_planes);
+}
+#else
+static void ilbm_p2c_row(const uint8_t * planes, uint32_t row_bytes, uint8_t * dst, uint32_t width, uint32_t num_planes) {
+    ilbm_p2c(planes, row_bytes, dst, width, num_planes);
+}
+
+void ilbm_c2p_row(const uint8_t * chunky, uint32_t width, uint8_t * planes, size_t plane_stride, uint32_t num_planes) {
+    ilbm_c2p(chunky, width, planes, plane_stride, num_planes);
+}
+#endif
+
+const char * ilbm_simd_name(void) {
+#ifdef ILBM_SIMD_DISPATCH
+    return ilbm_simd;
+#else
+    return "scalar";
+#endif
+}
+
+static inline __attribute__((always_inline)) void ilbm_mask_color(const uint8_t * dst, uint8_t * alpha, uint32_t width, uint8_t trans_clr) {
+    for(uint32_t col = 0; col < width; col++){
+        if(dst[col] == trans_clr) alpha[col] = 0x00;
+    }
+}
+
+/* Converts one row of planes in scratch into pixels (and alpha) */
+static inline __attribute__((always_inline)) void ilbm_convert_ilbm(ilbm_image * p_img, uint32_t row_no, uint8_t * scratch, const uint32_t num_planes, const int mask) {
+    const uint32_t width = p_img->width;
+    const uint32_t row_bytes = ((width + 15) >> 4) << 1;
+    const uint32_t row_planes = num_planes + (mask == 1 ? 1 : 0);
+
+    uint8_t * alpha = p_img->alpha != NULL ? &p_img->alpha[row_no * width] : NULL;
+
+    if(num_planes == 24){
+        uint8_t * dst = &p_img->pixels[row_no * width * 4];
+        uint8_t * rgb = scratch + row_bytes * row_planes;
+        ilbm_p2c_row(scratch, row_bytes, rgb, width, 8);
+        ilbm_p2c_row(scratch + row_bytes * 8, row_bytes, rgb + width, width, 8);
+        ilbm_p2c_row(scratch + row_bytes * 16, row_bytes, rgb + width * 2, width, 8);
+        for(uint32_t col = 0; col < width; col++){
+            dst[col * 4 + 0] = rgb[col];
+            dst[col * 4 + 1] = rgb[width + col];
+            dst[col * 4 + 2] = rgb[width * 2 + col];
+            dst[col * 4 + 3] = 0xff;
+        }
+        if(mask == 1){
+            ilbm_p2c_row(scratch + row_bytes * 24, row_bytes, alpha, width, 1);
+            for(uint32_t col = 0; col < width; col++){
+                alpha[col] = dst[col * 4 + 3] = alpha[col] ? 0xff : 0x00;
+            }
+        }
+    }else{
+        uint8_t * dst = &p_img->pixels[row_no * width];
+        ilbm_p2c_row(scratch, row_bytes, dst, width, num_planes);
+        if(mask == 1){
+            ilbm_p2c_row(scratch + row_bytes * num_planes, row_bytes, alpha, width, 1);
+            for(uint32_t col = 0; col < width; col++){
+                alpha[col] = alpha[col] ? 0xff : 0x00;
+            }
+        }else
+        if(mask == 2){
+            ilbm_mask_color(dst, alpha, width, p_img->head.trans_clr);
+        }
+    }
+}
+
+static inline __attribute__((always_inline)) void ilbm_convert_pbm(ilbm_image * p_img, uint32_t row_no, uint8_t * scratch, const int mask) {
+    const uint32_t width = p_img->width;
+    uint8_t * dst = &p_img->pixels[row_no * width];
+
+    memcpy(dst, scratch, width);
+    if(mask == 2){
+        ilbm_mask_color(dst, &p_img->alpha[row_no * width], width, p_img->head.trans_clr);
+    }
+}
+
+/* Runs of one index are common, counting neighbouring pixels in separate lanes keeps the
+ * increments from waiting on each other. ilbm_finish_stats() folds the lanes. */
+#define ILBM_HIST_LANES 4
+
+/* Called for every row right after it was converted, while it is still in the cache */
+static inline __attribute__((always_inline)) void ilbm_row_stats(ilbm_image * p_img, uint32_t row_no) {
+    const uint32_t width = p_img->width;
+    const uint8_t * dst = &p_img->pixels[row_no * width];
+
+    if(!p_img->true_color){
+        uint8_t max_index = p_img->max_index;
+        for(uint32_t col = 0; col < width; col++){
+            max_index = dst[col] > max_index ? dst[col] : max_index;
+        }
+        p_img->max_index = max_index;
+    }
+
+    uint32_t * hist = p_img->histogram;
+    if(hist == NULL){
+        return;
+    }
+
+    if(!p_img->true_color){
+        uint32_t col = 0;
+        for(; col + ILBM_HIST_LANES <= width; col += ILBM_HIST_LANES){
+            hist[dst[col]]++;
+            hist[256 + dst[col + 1]]++;
+            hist[512 + dst[col + 2]]++;
+            hist[768 + dst[col + 3]]++;
+        }
+        for(; col < width; col++){
+            hist[dst[col]]++;
+        }
+    }
+
+    uint32_t x0 = 0;
+    uint32_t x1 = width;
+    if(p_img->alpha != NULL){
+        const uint8_t * alpha = &p_img->alpha[row_no * width];
+        while(x0 < width && alpha[x0] == 0) x0++;
+        while(x1 > x0 && alpha[x1 - 1] == 0) x1--;
+    }
+    if(x0 < x1){
+        if(x0 < p_img->opaque_x0) p_img->opaque_x0 = x0;
+        if(x1 > p_img->opaque_x1) p_img->opaque_x1 = x1;
+        if(row_no < p_img->opaque_y0) p_img->opaque_y0 = row_no;
+        p_img->opaque_y1 = row_no + 1;
+    }
+}
+
+static void ilbm_finish_stats(ilbm_image * p_img) {
+    /* Without pixels max_index can only be bounded by the planes that have any bit set */
+    if(p_img->planes != NULL && !p_img->true_color){
+        const size_t plane_size = (size_t)p_img->row_bytes * p_img->height;
+        for(uint32_t p = 0; p < p_img->head.num_planes; p++){
+            const uint8_t * plane = &p_img->planes[p * plane_size];
+            size_t i = 0;
+            while(i < plane_size && plane[i] == 0) i++;
+            p_img->max_index |= i < plane_size ? 1u << p : 0;
+        }
+    }
+
+    uint32_t * hist = p_img->histogram;
+    if(hist == NULL){
+        return;
+    }
+
+    p_img->used_colors = 0;
+    for(uint32_t i = 0; i < 256; i++){
+        hist[i] += hist[256 + i] + hist[512 + i] + hist[768 + i];
+        p_img->used_colors += hist[i] != 0;
+    }
+    if(p_img->opaque_x1 == 0){
+        p_img->opaque_x0 = 0;
+        p_img->opaque_y0 = 0;
+    }
+}
+
+static inline __attribute__((always_inline)) ILBM_ERROR ilbm_decode_ilbm(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, uint8_t * scratch, const uint32_t num_planes, const int compressed, const int mask) {
+    const uint32_t row_bytes = ((p_img->width + 15) >> 4) << 1;
+    const uint32_t row_planes = num_planes + (mask == 1 ? 1 : 0);
+
+    ilbm_unpacker u = { body, body_size, 0, 0, 0, 0, ILBM_OK, 0 };
+
+    for(uint32_t row_no = 0; row_no < p_img->height; row_no++){
+        /* Rows past the end of a short body stay zero but still go through the mask handling */
+        uint32_t got = ilbm_unpack(&u, scratch, row_bytes * row_planes, compressed);
+        memset(scratch + got, 0, row_bytes * row_planes - got);
+
+        ilbm_convert_ilbm(p_img, row_no, scratch, num_planes, mask);
+        ilbm_row_stats(p_img, row_no);
+    }
+
+    return u.error;
+}
+
+static inline __attribute__((always_inline)) ILBM_ERROR ilbm_decode_pbm(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, uint8_t * scratch, const int compressed, const int mask) {
+    const uint32_t width = p_img->width;
+
+    ilbm_unpacker u = { body, body_size, 0, 0, 0, 0, ILBM_OK, 0 };
+
+    for(uint32_t row_no = 0; row_no < p_img->height; row_no++){
+        uint8_t * dst = &p_img->pixels[row_no * width];
+        ilbm_unpack(&u, dst, width, compressed);
+        if(mask == 2){
+            ilbm_mask_color(dst, &p_img->alpha[row_no * width], width, p_img->head.trans_clr);
+        }
+        ilbm_row_stats(p_img, row_no);
+        if(width & 1){
+            ilbm_unpack(&u, scratch, 1, compressed);
+        }
+    }
+
+    return u.error;
+}
+
+typedef ILBM_ERROR (*ilbm_decode_fn)(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, uint8_t * scratch);
+
+#define ILBM_DECODER_NAME(PLANES, COMPRESSED, MASK) ilbm_decode_ilbm_##PLANES##_##COMPRESSED##_##MASK
+#define ILBM_DECODER(PLANES, COMPRESSED, MASK) \
+    static ILBM_ERROR ILBM_DECODER_NAME(PLANES, COMPRESSED, MASK)(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, uint8_t * scratch) { \
+        return ilbm_decode_ilbm(p_img, body, body_size, scratch, PLANES, COMPRESSED, MASK); \
+    }
+#define ILBM_DECODERS_MASK(PLANES, COMPRESSED) ILBM_DECODER(PLANES, COMPRESSED, 0) ILBM_DECODER(PLANES, COMPRESSED, 1) ILBM_DECODER(PLANES, COMPRESSED, 2)
+#define ILBM_DECODERS(PLANES) ILBM_DECODERS_MASK(PLANES, 0) ILBM_DECODERS_MASK(PLANES, 1)
+#define ILBM_DECODER_ROW(COMPRESSED, MASK) { \
+        ILBM_DECODER_NAME(1, COMPRESSED, MASK), ILBM_DECODER_NAME(2, COMPRESSED, MASK), ILBM_DECODER_NAME(3, COMPRESSED, MASK), \
+        ILBM_DECODER_NAME(4, COMPRESSED, MASK), ILBM_DECODER_NAME(5, COMPRESSED, MASK), ILBM_DECODER_NAME(6, COMPRESSED, MASK), \
+        ILBM_DECODER_NAME(7, COMPRESSED, MASK), ILBM_DECODER_NAME(8, COMPRESSED, MASK), ILBM_DECODER_NAME(24, COMPRESSED, MASK) }
+
+ILBM_DECODERS(1)
+ILBM_DECODERS(2)
+ILBM_DECODERS(3)
+ILBM_DECODERS(4)
+ILBM_DECODERS(5)
+ILBM_DECODERS(6)
+ILBM_DECODERS(7)
+ILBM_DECODERS(8)
+ILBM_DECODERS(24)
+
+#define PBM_DECODER_NAME(COMPRESSED, MASK) ilbm_decode_pbm_##COMPRESSED##_##MASK
+#define PBM_DECODER(COMPRESSED, MASK) \
+    static ILBM_ERROR PBM_DECODER_NAME(COMPRESSED, MASK)(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, uint8_t * scratch) { \
+        return ilbm_decode_pbm(p_img, body, body_size, scratch, COMPRESSED, MASK); \
+    }
+
+PBM_DECODER(0, 0)
+PBM_DECODER(0, 2)
+PBM_DECODER(1, 0)
+PBM_DECODER(1, 2)
+
+/* [compression][mask mode][plane count: 1-8, 24] */
+static const ilbm_decode_fn ilbm_decoders[2][3][9] = {
+    { ILBM_DECODER_ROW(0, 0), ILBM_DECODER_ROW(0, 1), ILBM_DECODER_ROW(0, 2) },
+    { ILBM_DECODER_ROW(1, 0), ILBM_DECODER_ROW(1, 1), ILBM_DECODER_ROW(1, 2) }
+};
+
+/* [compression][mask mode], a PBM mask plane is not defined and treated as no mask */
+static const ilbm_decode_fn pbm_decoders[2][3] = {
+    { PBM_DECODER_NAME(0, 0), PBM_DECODER_NAME(0, 0), PBM_DECODER_NAME(0, 2) },
+    { PBM_DECODER_NAME(1, 0), PBM_DECODER_NAME(1, 0), PBM_DECODER_NAME(1, 2) }
+};
+
+/* ilbm_ctx.planar: each row of each plane is unpacked straight to its place in planes, which
+ * start out zero for short bodies. There is nothing to convert and no mask to apply. */
+static inline __attribute__((always_inline)) ILBM_ERROR ilbm_decode_planar(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, const int compressed) {
+    const uint32_t row_bytes = p_img->row_bytes;
+    const size_t plane_size = (size_t)row_bytes * p_img->height;
+
+    ilbm_unpacker u = { body, body_size, 0, 0, 0, 0, ILBM_OK, 0 };
+
+    for(uint32_t row_no = 0; row_no < p_img->height; row_no++){
+        uint8_t * dst = &p_img->planes[(size_t)row_no * row_bytes];
+        for(uint32_t p = 0; p < p_img->plane_count; p++, dst += plane_size){
+            ilbm_unpack(&u, dst, row_bytes, compressed);
+        }
+    }
+
+    return u.error;
+}
+
+static ILBM_ERROR ilbm_decode_planar_0(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, uint8_t * scratch) {
+    (void)scratch;
+    return ilbm_decode_planar(p_img, body, body_size, 0);
+}
+
+static ILBM_ERROR ilbm_decode_planar_1(ilbm_image * p_img, const uint8_t * body, uint32_t body_size, uint8_t * scratch) {
+    (void)scratch;
+    return ilbm_decode_planar(p_img, body, body_size, 1);
+}
+
+/* [compression] */
+static const ilbm_decode_fn planar_decoders[2] = { ilbm_decode_planar_0, ilbm_decode_planar_1 };
+
+/* The same layouts one row at a time, for bodies that arrive in pieces (ilbm_feed) */
+typedef void (*ilbm_row_fn)(ilbm_image * p_img, uint32_t row_no, uint8_t * scratch);
+
+#define ILBM_ROW_NAME(PLANES, MASK) ilbm_row_ilbm_##PLANES##_##MASK
+#define ILBM_ROW(PLANES, MASK) \
+    static void ILBM_ROW_NAME(PLANES, MASK)(ilbm_image * p_img, uint32_t row_no, uint8_t * scratch) { \
+        ilbm_convert_ilbm(p_img, row_no, scratch, PLANES, MASK); \
+    }
+#define ILBM_ROWS(PLANES) ILBM_ROW(PLANES, 0) ILBM_ROW(PLANES, 1) ILBM_ROW(PLANES, 2)
+#define ILBM_ROW_ROW(MASK) { \
+        ILBM_ROW_NAME(1, MASK), ILBM_ROW_NAME(2, MASK), ILBM_ROW_NAME(3, MASK), ILBM_ROW_NAME(4, MASK), ILBM_ROW_NAME(5, MASK), \
+        ILBM_ROW_NAME(6, MASK), ILBM_ROW_NAME(7, MASK), ILBM_ROW_NAME(8, MASK), ILBM_ROW_NAME(24, MASK) }
+
+ILBM_ROWS(1)
+ILBM_ROWS(2)
+ILBM_ROWS(3)
+ILBM_ROWS(4)
+ILBM_ROWS(5)
+ILBM_ROWS(6)
+ILBM_ROWS(7)
+ILBM_ROWS(8)
+ILBM_ROWS(24)
+
+static void ilbm_row_pbm_0(ilbm_image * p_img, uint32_t row_no, uint8_t * scratch) {
+    ilbm_convert_pbm(p_img, row_no, scratch, 0);
+}
+
+static void ilbm_row_pbm_2(ilbm_image * p_img, uint32_t row_no, uint8_t * scratch) {
+    ilbm_convert_pbm(p_img, row_no, scratch, 2);
+}
+
+/* [mask mode][plane count: 1-8, 24] */
+static const ilbm_row_fn ilbm_rows[3][9] = { ILBM_ROW_ROW(0), ILBM_ROW_ROW(1), ILBM_ROW_ROW(2) };
+
+static const ilbm_row_fn pbm_rows[3] = { ilbm_row_pbm_0, ilbm_row_pbm_0, ilbm_row_pbm_2 };
+
+/* The planes of a row are interleaved in the body, each goes to its own plane buffer */
+static void ilbm_row_planar(ilbm_image * p_img, uint32_t row_no, uint8_t * scratch) {
+    const uint32_t row_bytes = p_img->row_bytes;
+    const size_t plane_size = (size_t)row_bytes * p_img->height;
+
+    uint8_t * dst = &p_img->planes[(size_t)row_no * row_bytes];
+    for(uint32_t p = 0; p < p_img->plane_count; p++, dst += plane_size){
+        memcpy(dst, scratch + p * row_bytes, row_bytes);
+    }
+}
+
+static ilbm_decode_fn ilbm_select_decoder(ILBM_FORMAT format, const ilbm_head * p_head) {
+    if(p_head->compression > 1){
+        return NULL;
+    }
+
+    /* 3 (lasso) only matters for drawing programs, the bitmap has no extra plane */
+    const uint32_t mask = p_head->mask <= 2 ? p_head->mask : 0;
+
+    if(format == ILBM_FORMAT_PBM){
+        return pbm_decoders[p_head->compression][mask];
+    }
+
+    if(p_head->num_planes >= 1 && p_head->num_planes <= 8){
+        return ilbm_decoders[p_head->compression][mask][p_head->num_planes - 1];
+    }
+    if(p_head->num_planes == 24){
+        return ilbm_decoders[p_head->compression][mask == 2 ? 0 : mask][8];
+    }
+
+    return NULL;
+}
+
+/* Row converter for a header ilbm_select_decoder() accepted, and the bytes of one row in the body */
+static ilbm_row_fn ilbm_select_row(ILBM_FORMAT format, const ilbm_head * p_head, uint32_t * p_row_len) {
+    const uint32_t mask = p_head->mask <= 2 ? p_head->mask : 0;
+    const uint32_t row_bytes = ((p_head->width + 15) >> 4) << 1;
+
+    if(format == ILBM_FORMAT_PBM){
+        *p_row_len = p_head->width + (p_head->width & 1);
+        return pbm_rows[mask];
+    }
+
+    *p_row_len = row_bytes * (p_head->num_planes + (mask == 1 ? 1 : 0));
+    if(p_head->num_planes == 24){
+        return ilbm_rows[mask == 2 ? 0 : mask][8];
+    }
+    return ilbm_rows[mask][p_head->num_planes - 1];
+}
+
+/* Bytes of row scratch a decoder needs: all planes of one row, plus three chunky rows for 24 planes */
+static uint32_t ilbm_scratch_size(const ilbm_head * p_head) {
+    const uint32_t row_bytes = ((p_head->width + 15) >> 4) << 1;
+
+    return row_bytes * (p_head->num_planes + 1) + p_head->width * 3 + 8;
+}
+
+/* Bytes ilbm_alloc_bitmap() takes: the planes in planar mode, otherwise 4 byte pixels, the mask
+ * and the histogram */
+static uint64_t ilbm_bitmap_bytes(const ilbm_ctx * p_ctx, ILBM_FORMAT format, const ilbm_head * p_head) {
+    if(p_ctx->planar && format == ILBM_FORMAT_ILBM){
+        const uint64_t row_bytes = ((p_head->width + 15) >> 4) << 1;
+        return row_bytes * p_head->height * (p_head->num_planes + (p_head->mask == 1));
+    }
+
+    return (uint64_t)p_head->width * p_head->height * (sizeof(uint32_t) + (p_head->mask != 0)) +
+           (p_ctx->collect_stats ? ILBM_HIST_LANES * 256 * sizeof(uint32_t) : 0);
+}
+
+static void ilbm_parse_hints(ilbm_image * p_img) {
+    for(ilbm_chunk * chunk = p_img->first_chunk; chunk != NULL; chunk = chunk->next_chunk){
+        const uint8_t * c = chunk->content;
+
+        if(*(uint32_t *)(chunk->name) == *(uint32_t *)"GRAB" && chunk->size >= 4){
+            p_img->has_grab = 1;
+            p_img->grab_x = (int16_t)((c[0] << 8) | c[1]);
+            p_img->grab_y = (int16_t)((c[2] << 8) | c[3]);
+        }else
+        if(*(uint32_t *)(chunk->name) == *(uint32_t *)"DEST" && chunk->size >= 8){
+            /* depth, pad1, planePick, planeOnOff, planeMask */
+            p_img->has_dest = 1;
+            p_img->dest.depth = c[0];
+            p_img->dest.plane_pick = (c[2] << 8) | c[3];
+            p_img->dest.plane_on_off = (c[4] << 8) | c[5];
+            p_img->dest.plane_mask = (c[6] << 8) | c[7];
+        }else
+        if(*(uint32_t *)(chunk->name) == *(uint32_t *)"SPRT" && chunk->size >= 2){
+            p_img->is_sprite = 1;
+            p_img->sprite_precedence = (c[0] << 8) | c[1];
+        }
+    }
+}
+
+static void ilbm_parse_cycles(ilbm_ctx * p_ctx, ilbm_image * p_img) {
+    uint32_t cycle_max = 0;
+    for(ilbm_chunk * chunk = p_img->first_chunk; chunk != NULL; chunk = chunk->next_chunk){
+        if(*(uint32_t *)(chunk->name) == *(uint32_t *)"CRNG" || *(uint32_t *)(chunk->name) == *(uint32_t *)"CCRT"){
+            cycle_max++;
+        }
+    }
+    if(cycle_max == 0){
+        return;
+    }
+
+    p_img->cycles = (ilbm_cycle *)ilbm_alloc(p_ctx, cycle_max * sizeof(ilbm_cycle));
+    if(p_img->cycles == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "cycles malloc failed");
+        return;
+    }
+
+    for(ilbm_chunk * chunk = p_img->first_chunk; chunk != NULL; chunk = chunk->next_chunk){
+        ilbm_cycle cycle;
+        const uint8_t * c = chunk->content;
+
+        if(*(uint32_t *)(chunk->name) == *(uint32_t *)"CRNG" && chunk->size >= 8){
+            /* pad1, rate (16384 = 60 steps/s), flags (1 = active, 2 = reverse), low, high */
+            int16_t  rate  = (c[2] << 8) | c[3];
+            uint16_t flags = (c[4] << 8) | c[5];
+            if(!(flags & 1) || rate <= 0){
+                continue;
+            }
+            cycle.low = c[6];
+            cycle.high = c[7];
+            cycle.direction = (flags & 2) ? -1 : 1;
+            cycle.rate = rate * 60.0 / 16384.0;
+        }else
+        if(*(uint32_t *)(chunk->name) == *(uint32_t *)"CCRT" && chunk->size >= 14){
+            /* direction (0 = off, 1 = forward, -1 = backward), start, end, seconds, microseconds */
+            int16_t  direction = (c[0] << 8) | c[1];
+            uint32_t seconds = ((uint32_t)c[4] << 24) | (c[5] << 16) | (c[6] << 8) | c[7];
+            uint32_t micros = ((uint32_t)c[8] << 24) | (c[9] << 16) | (c[10] << 8) | c[11];
+            double   step_time = seconds + micros / 1000000.0;
+            if(direction == 0 || step_time <= 0.0){
+                continue;
+            }
+            cycle.low = c[2];
+            cycle.high = c[3];
+            cycle.direction = direction > 0 ? 1 : -1;
+            cycle.rate = 1.0 / step_time;
+        }else{
+            continue;
+        }
+
+        if(cycle.high <= cycle.low || (cycle.high + 1u) > p_img->color_count){
+            continue;
+        }
+
+        ilbm_log(p_ctx, ILBM_LOG_INFO, "cycle %-6d: %3d - %3d %s %.2f steps/s", p_img->cycle_count, cycle.low, cycle.high, cycle.direction > 0 ? ">" : "<", cycle.rate);
+
+        p_img->cycles[p_img->cycle_count++] = cycle;
+    }
+}
+
+static uint32_t ilbm_cycle_shift(const ilbm_cycle * p_cycle, double t) {
+    const uint32_t len = p_cycle->high - p_cycle->low + 1;
+
+    return (uint32_t)((uint64_t)(t * p_cycle->rate) % len);
+}
+
+int ilbm_cycle_palette(ilbm_image * p_img, double t, uint8_t * palette) {
+    memcpy(palette, p_img->palette, p_img->color_count * 3);
+
+    /* Each range is a rotation of its slice of the palette, the pixels never change. */
+    for(uint32_t i = 0; i < p_img->cycle_count; i++){
+        const ilbm_cycle * p_cycle = &p_img->cycles[i];
+        const uint32_t len = p_cycle->high - p_cycle->low + 1;
+        const uint32_t shift = ilbm_cycle_shift(p_cycle, t);
+        if(shift == 0){
+            continue;
+        }
+
+        uint8_t slice[256 * 3];
+        memcpy(slice, &palette[p_cycle->low * 3], len * 3);
+
+        const uint32_t src = p_cycle->direction > 0 ? len - shift : shift;
+        memcpy(&palette[p_cycle->low * 3], &slice[src * 3], (len - src) * 3);
+        memcpy(&palette[(p_cycle->low + len - src) * 3], slice, src * 3);
+    }
+
+    return p_img->cycle_count;
+}
+
+uint32_t ilbm_cycle_frames(ilbm_image * p_img, double frame_time, uint32_t max_frames) {
+    if(p_img->cycle_count == 0){
+        return 1;
+    }
+
+    /* First frame count after which every range is back at its start, so the animation loops seamlessly. */
+    for(uint32_t frames = 1; frames < max_frames; frames++){
+        uint32_t i = 0;
+        for(; i < p_img->cycle_count; i++){
+            if(ilbm_cycle_shift(&p_img->cycles[i], frames * frame_time) != 0 || frames * frame_time * p_img->cycles[i].rate < 1.0){
+                break;
+            }
+        }
+        if(i == p_img->cycle_count){
+            return frames;
+        }
+    }
+
+    return max_frames;
+}
+
+/* Checks the FORM, finds and validates the header and picks the decoder. max_alloc only applies
+ * when the caller goes on to allocate the bitmap. On failure NULL is returned and p_img->error
+ * is set. */
+static ilbm_decode_fn ilbm_parse_head(ilbm_ctx * p_ctx, ilbm_image * p_img, ILBM_FORMAT format, uint32_t chunk_cnt, int alloc) {
+    if(p_img->form_chunk == NULL){
+        p_img->error = ILBM_ERROR_FORM_MISSING;
+        return NULL;
+    }
+
+    if(*(uint32_t *)(p_img->form_chunk->name) != *(uint32_t *)"FORM"){
+        p_img->warnings |= (1 << ILBM_WARN_FORM_BY_POSITION);        
+    }
+
+    if(format == ILBM_FORMAT_PBM || memcmp(p_img->form_chunk->content, "PBM ", 4) == 0){
+        p_img->format = ILBM_FORMAT_PBM;
+    }
+
+    /* BMHD and BODY alone are a valid true color image */
+    if(chunk_cnt < 3 && !(chunk_cnt == 2 && *(uint32_t *)(p_img->first_chunk->name) == *(uint32_t *)"BMHD")){        
+        p_img->error = ILBM_ERROR_NO_CHUNKS;
+        return NULL;
+    }
+
+    if(memcmp(p_img->form_chunk->content, "8SVX", 4) == 0){
+        p_img->error = ILBM_ERROR_IFF_8SVX;
+        return NULL;
+    }
+    if(memcmp(p_img->form_chunk->content, "SMUS", 4) == 0){
+        p_img->error = ILBM_ERROR_IFF_SMUS;
+        return NULL;
+    }
+    if(memcmp(p_img->form_chunk->content, "ANIM", 4) == 0){
+        p_img->error = ILBM_ERROR_IFF_ANIM;
+        return NULL;
+    }
+
+    ilbm_chunk * bmhd_chunk = p_img->first_chunk;
+    while(bmhd_chunk != NULL){
+        if(*(uint32_t *)(bmhd_chunk->name) == *(uint32_t *)"BMHD"){        
+            break;
+        }
+        bmhd_chunk = bmhd_chunk->next_chunk;
+    }
+    if(bmhd_chunk == NULL){
+        bmhd_chunk = p_img->first_chunk;
+        while(bmhd_chunk != NULL){
+            if(bmhd_chunk->size == sizeof(ilbm_head)) { 
+                p_img->warnings |= (1 << ILBM_WARN_BHMD_BY_POSITION);                
+                break;
+            }
+            bmhd_chunk = bmhd_chunk->next_chunk;
+        }
+    }
+    if(bmhd_chunk == NULL){
+        bmhd_chunk = p_img->first_chunk;
+        p_img->warnings |= (1 << ILBM_WARN_BHMD_BY_POSITION) | (1 << ILBM_WARN_BHMD_SIZE_MISMATCH);        
+    }
+    p_img->bmhd_chunk = bmhd_chunk;
+
+    /* Contents may be borrowed from the caller's buffer, a short header must not be read past */
+    if(bmhd_chunk->size < sizeof(ilbm_head)){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "header chunk \"%4.4s\" of %u bytes", bmhd_chunk->name, bmhd_chunk->size);
+        p_img->error = ILBM_ERROR_BMHD_MISSING;
+        return NULL;
+    }
+
+    ilbm_head bmhd;
+    memcpy(&bmhd, bmhd_chunk->content, sizeof(bmhd));
+
+    bmhd.width = UINT16_BE(bmhd.width);
+    bmhd.height = UINT16_BE(bmhd.height);
+    bmhd.x_origin = INT16_BE(bmhd.x_origin);
+    bmhd.y_origin = INT16_BE(bmhd.y_origin);
+    bmhd.trans_clr = UINT16_BE(bmhd.trans_clr);
+    bmhd.page_width = INT16_BE(bmhd.page_width);
+    bmhd.page_height = INT16_BE(bmhd.page_height);
+
+    p_img->head = bmhd;
+    
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "format      : %s", ilbm_format_strs[p_img->format]);
+
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "width       : %i", bmhd.width);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "height      : %i", bmhd.height);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "x_origin    : %i", bmhd.x_origin);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "y_origin    : %i", bmhd.y_origin);
+
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "num_planes  : %i", bmhd.num_planes);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "mask        : %i", bmhd.mask);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "compression : %i", bmhd.compression);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "pad1        : %i", bmhd.pad1);
+
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "trans_clr   : %i", bmhd.trans_clr);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "x_aspect    : %i", bmhd.x_aspect);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "y_aspect    : %i", bmhd.y_aspect);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "page_width  : %i", bmhd.page_width);
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "page_height : %i", bmhd.page_height);
+
+    p_img->width = bmhd.width;
+    p_img->height = bmhd.height;
+    p_img->size = p_img->width * p_img->height; 
+
+    if(p_img->size == 0){
+        p_img->error = ILBM_ERROR_ZERO_SIZE;
+        return NULL;
+    }
+    
+    if(p_img->width > p_ctx->limits.max_width){
+        p_img->error = ILBM_ERROR_ILLEGAL_WIDTH;
+        return NULL;
+    }
+
+    if(p_img->height > p_ctx->limits.max_height){
+        p_img->error = ILBM_ERROR_ILLEGAL_HEIGHT;
+        return NULL;
+    }
+
+    ilbm_decode_fn decode = ilbm_select_decoder(p_img->format, &bmhd);
+    if(decode == NULL){
+        p_img->error = ILBM_ERROR_UNSUPPORTED;
+        return NULL;
+    }
+
+    /* Refuse before allocating the bitmap and the row scratch */
+    const uint64_t need = ilbm_bitmap_bytes(p_ctx, p_img->format, &bmhd) + ilbm_scratch_size(&bmhd);
+    if((p_ctx->limits.max_pixels != 0 && p_img->size > p_ctx->limits.max_pixels) || need > SIZE_MAX ||
+       (alloc && p_ctx->limits.max_alloc != 0 && p_ctx->alloc_bytes + need > p_ctx->limits.max_alloc)){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "%ux%u bitmap over the limits", p_img->width, p_img->height);
+        p_img->error = ILBM_ERROR_LIMIT;
+        return NULL;
+    }
+    p_img->true_color = p_img->format == ILBM_FORMAT_ILBM && bmhd.num_planes == 24;
+
+    if(p_ctx->planar && p_img->format == ILBM_FORMAT_ILBM){
+        return planar_decoders[bmhd.compression];
+    }
+
+    return decode;
+}
+
+/* The mask is opaque where nothing clears it, pixels start out zero for short bodies. Planar
+ * mode only takes the planes. */
+static int ilbm_alloc_bitmap(ilbm_ctx * p_ctx, ilbm_image * p_img) {
+    if(p_ctx->planar && p_img->format == ILBM_FORMAT_ILBM){
+        p_img->row_bytes = ((p_img->width + 15) >> 4) << 1;
+        p_img->plane_count = p_img->head.num_planes + (p_img->head.mask == 1);
+
+        const size_t size = (size_t)p_img->row_bytes * p_img->height * p_img->plane_count;
+        p_img->planes = (uint8_t *)ilbm_alloc(p_ctx, size);
+        if(p_img->planes == NULL){
+            ilbm_log(p_ctx, ILBM_LOG_ERROR, "planes malloc failed");
+            return -1;
+        }
+        memset(p_img->planes, 0, size);
+        return 0;
+    }
+
+    if(p_img->head.mask != 0){
+        p_img->alpha = (uint8_t *)ilbm_alloc(p_ctx, p_img->size);
+        if(p_img->alpha == NULL){
+            ilbm_log(p_ctx, ILBM_LOG_ERROR, "alpha malloc failed");        
+            return -1;
+        }        
+        memset(p_img->alpha, 0xff, p_img->size);
+    }
+
+    p_img->pixels = (uint8_t *)ilbm_alloc(p_ctx, p_img->size * sizeof(uint32_t));
+    if(p_img->pixels == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "pixels malloc failed");        
+        return -1;
+    }
+    memset(p_img->pixels, 0, p_img->size * sizeof(uint32_t));
+
+    if(p_ctx->collect_stats){
+        p_img->histogram = (uint32_t *)ilbm_alloc(p_ctx, ILBM_HIST_LANES * 256 * sizeof(uint32_t));
+        if(p_img->histogram == NULL){
+            ilbm_log(p_ctx, ILBM_LOG_ERROR, "histogram malloc failed");
+            return -1;
+        }
+        memset(p_img->histogram, 0, ILBM_HIST_LANES * 256 * sizeof(uint32_t));
+        p_img->opaque_x0 = p_img->width;
+        p_img->opaque_y0 = p_img->height;
+    }
+
+    return 0;
+}
+
+static int ilbm_set_palette(ilbm_ctx * p_ctx, ilbm_image * p_img, ilbm_chunk * cmap_chunk) {
+    p_img->cmap_chunk = cmap_chunk;
+    p_img->color_count = cmap_chunk->size / 3;
+    p_img->palette = (uint8_t *)ilbm_alloc(p_ctx, cmap_chunk->size);
     if(p_img->palette == NULL){
-        log_error("palette malloc failed");        
-        return p_img;
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "palette malloc failed");        
+        return -1;
     }
     memcpy(p_img->palette, cmap_chunk->content, cmap_chunk->size);
+
+    return 0;
+}
+
+/* Finds the palette once the pixels are decoded, unless ilbm_feed() already took it from a CMAP */
+static void ilbm_parse_cmap(ilbm_ctx * p_ctx, ilbm_image * p_img) {
+    ilbm_chunk * bmhd_chunk = p_img->bmhd_chunk;
+
+    ilbm_parse_hints(p_img);
+
+    if(p_img->cmap_chunk == NULL){
+        const uint32_t color_max = p_img->max_index;
+
+        ilbm_chunk * cmap_chunk = p_img->first_chunk;
+        while(cmap_chunk != NULL){
+            if(*(uint32_t *)(cmap_chunk->name) == *(uint32_t *)"CMAP"){                
+                break;    
+            }
+            cmap_chunk = cmap_chunk->next_chunk;        
+        }
+        if(cmap_chunk == NULL && !p_img->true_color){
+            cmap_chunk = p_img->first_chunk;
+            while(cmap_chunk != NULL){                
+                if((cmap_chunk != bmhd_chunk) && (cmap_chunk->size == (1 << p_img->head.num_planes) * 3)){
+                    p_img->warnings |= (1 << ILBM_WARN_CMAP_BY_EXACT_SIZE);                
+                    break;    
+                }
+                cmap_chunk = cmap_chunk->next_chunk;        
+            }
+        }
+        if(cmap_chunk == NULL && !p_img->true_color){
+            cmap_chunk = p_img->first_chunk;
+            while(cmap_chunk != NULL){            
+                if((cmap_chunk != bmhd_chunk) && (cmap_chunk->size >= color_max * 3)){
+                    p_img->warnings |= (1 << ILBM_WARN_CMAP_BY_MIN_SIZE);                
+                    break;    
+                }
+                cmap_chunk = cmap_chunk->next_chunk;        
+            }
+        }
+
+        if(cmap_chunk == NULL && !p_img->true_color){        
+            p_img->error = ILBM_ERROR_CMAP_MISSING;
+            return;
+        }
+
+        /* True color bitmaps carry their colors in the pixels, a CMAP is optional there */
+        if(cmap_chunk != NULL && ilbm_set_palette(p_ctx, p_img, cmap_chunk) != 0){
+            return;
+        }
+    }
+
+    if(p_img->palette != NULL){
+        ilbm_parse_cycles(p_ctx, p_img);
+    }
     
-    if(log_verbosity >= 2){
+    if(p_ctx->verbosity >= 2){
         for(int warn_i = 0; warn_i < ILBM_WARN_EOL; warn_i++){
             if(p_img->warnings & (1 << warn_i)){
                 char warn_str[64];
                 int ret = ilbm_warn_snprint(warn_str, sizeof(warn_str), p_img, warn_i);
                 if(ret > 0){
-                    log_warning(warn_str);
+                    ilbm_log(p_ctx, ILBM_LOG_WARNING, "%s", warn_str);
                 }else{
-                    log_warning("%d", warn_i);
+                    ilbm_log(p_ctx, ILBM_LOG_WARNING, "%d", warn_i);
                 }
             }
         }
     }
+}
+
+/* The BODY by name, or else the largest chunk that isn't the header */
+static ilbm_chunk * ilbm_find_body(ilbm_image * p_img) {
+    ilbm_chunk * body_chunk = p_img->first_chunk;
+    while(body_chunk != NULL){
+        if(*(uint32_t *)(body_chunk->name) == *(uint32_t *)"BODY"){        
+            break;    
+        }
+        body_chunk = body_chunk->next_chunk;        
+    }
+    if(body_chunk == 0){        
+        ilbm_chunk * chunk = p_img->first_chunk;                
+        uint32_t size_max = 0;
+        while(chunk != NULL){
+            if(chunk->size >= size_max){
+                size_max = chunk->size;
+                body_chunk = chunk;
+            }
+            chunk = chunk->next_chunk;        
+        }
+        if(body_chunk != p_img->bmhd_chunk){
+            p_img->warnings |= (1 << ILBM_WARN_BODY_BY_SIZE);            
+        }else{            
+            p_img->error = ILBM_ERROR_BODY_MISSING;
+            return NULL;
+        }
+    }
+    p_img->body_chunk = body_chunk;
+
+    return body_chunk;
+}
+
+static ilbm_image * ilbm_parse(ilbm_ctx * p_ctx, ilbm_image * p_img, ILBM_FORMAT format, uint32_t chunk_cnt) {
+    ilbm_decode_fn decode = ilbm_parse_head(p_ctx, p_img, format, chunk_cnt, 1);
+    if(decode == NULL){
+        return p_img;
+    }
+
+    ilbm_chunk * body_chunk = ilbm_find_body(p_img);
+    if(body_chunk == NULL){
+        return p_img;
+    }
+
+    if(ilbm_alloc_bitmap(p_ctx, p_img) != 0){
+        return p_img;
+    }
+
+    uint8_t * scratch = ilbm_scratch(p_ctx, ilbm_scratch_size(&p_img->head));
+    if(scratch == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "scratch malloc failed");        
+        return p_img;
+    }
+
+    p_img->error = decode(p_img, body_chunk->content, body_chunk->size, scratch);
+    p_ctx->stats.pixels += p_img->size;
+
+    ilbm_finish_stats(p_img);
+
+    ilbm_parse_cmap(p_ctx, p_img);
 
     return p_img;
 }
 
+/* Walks the chunk headers like ilbm_read_mem_ctx() and adds up what ilbm_parse() will allocate,
+ * without touching the BODY. Chunks reaching past buf are stepped over by their size. */
+ILBM_ERROR ilbm_preflight(ilbm_ctx * p_ctx, const uint8_t * buf, size_t len, ILBM_FORMAT format, ilbm_estimate * p_est) {
+    memset(p_est, 0, sizeof(ilbm_estimate));
+
+    if(buf == NULL || len < 12){
+        return ILBM_ERROR_FORM_MISSING;
+    }
+    if(memcmp(buf + 8, "8SVX", 4) == 0) return ILBM_ERROR_IFF_8SVX;
+    if(memcmp(buf + 8, "SMUS", 4) == 0) return ILBM_ERROR_IFF_SMUS;
+    if(memcmp(buf + 8, "ANIM", 4) == 0) return ILBM_ERROR_IFF_ANIM;
+
+    uint32_t form_size;
+    memcpy(&form_size, buf + 4, 4);
+    form_size = UINT32_BE(form_size);
+    /* The readers go by the chunks, not by the FORM size, which some writers leave at 0 */
+    const uint64_t end = 8 + (uint64_t)form_size > len ? 8 + (uint64_t)form_size : len;
+
+    const uint8_t * first = NULL;
+    uint64_t pos = 12;
+    uint64_t body_size = 0;
+    uint64_t cmap_size = 0;
+    uint64_t size_max = 0;
+    uint32_t cycle_cnt = 0;
+    int      chunk_over = 0;
+
+    p_est->chunk_bytes = 4;
+    while(pos + 8 <= len){
+        uint32_t size;
+        memcpy(&size, buf + pos + 4, 4);
+        size = UINT32_BE(size);
+
+        if(p_est->chunk_cnt == 0){
+            first = pos + 8 + sizeof(ilbm_head) <= len ? buf + pos + 8 : NULL;
+        }
+        if(memcmp(buf + pos, "BODY", 4) == 0 && body_size == 0){
+            body_size = size;
+        }
+        if(memcmp(buf + pos, "CMAP", 4) == 0 && cmap_size == 0){
+            cmap_size = size;
+        }
+        if(memcmp(buf + pos, "CRNG", 4) == 0 || memcmp(buf + pos, "CCRT", 4) == 0){
+            cycle_cnt++;
+        }
+        if(size > size_max){
+            size_max = size;
+        }
+        chunk_over |= p_ctx->limits.max_chunk_bytes != 0 && size > p_ctx->limits.max_chunk_bytes;
+
+        p_est->chunk_cnt++;
+        p_est->chunk_bytes += size;
+        pos += 8 + (uint64_t)size + (size & 1);
+    }
+
+    /* Whatever the FORM size says lies beyond buf could be all 8 byte chunk headers */
+    if(pos + 8 <= end){
+        p_est->chunk_cnt += (end - pos) / 8;
+        p_est->chunk_bytes += end - pos;
+        size_max = end - pos > size_max ? end - pos : size_max;
+    }
+
+    if(first == NULL){
+        return ILBM_ERROR_BMHD_MISSING;
+    }
+    /* buf ends inside a chunk before any BODY and the FORM size doesn't cover the rest */
+    if(pos > len + 1 && body_size == 0 && 8 + (uint64_t)form_size <= pos){
+        return ILBM_ERROR_BODY_MISSING;
+    }
+
+    ilbm_head bmhd;
+    memcpy(&bmhd, first, sizeof(bmhd));
+    bmhd.width = UINT16_BE(bmhd.width);
+    bmhd.height = UINT16_BE(bmhd.height);
+
+    p_est->width = bmhd.width;
+    p_est->height = bmhd.height;
+    p_est->pixels = (uint64_t)bmhd.width * bmhd.height;
+
+    if(p_est->pixels == 0){
+        return ILBM_ERROR_ZERO_SIZE;
+    }
+    if(bmhd.width > p_ctx->limits.max_width){
+        return ILBM_ERROR_ILLEGAL_WIDTH;
+    }
+    if(bmhd.height > p_ctx->limits.max_height){
+        return ILBM_ERROR_ILLEGAL_HEIGHT;
+    }
+
+    const ILBM_FORMAT img_format = format == ILBM_FORMAT_PBM || memcmp(buf + 8, "PBM ", 4) == 0 ? ILBM_FORMAT_PBM : ILBM_FORMAT_ILBM;
+    if(ilbm_select_decoder(img_format, &bmhd) == NULL){
+        return ILBM_ERROR_UNSUPPORTED;
+    }
+    const int true_color = img_format == ILBM_FORMAT_ILBM && bmhd.num_planes == 24;
+
+    /* Without a CMAP the palette is taken from some other chunk, at most the largest one */
+    const uint64_t palette_size = cmap_size != 0 || true_color ? cmap_size : size_max;
+    const uint64_t planar = (uint64_t)(((bmhd.width + 15) >> 4) << 1) * (img_format == ILBM_FORMAT_PBM ? 8 : bmhd.num_planes + (bmhd.mask == 1)) * bmhd.height;
+
+    p_est->bitmap_bytes = ilbm_bitmap_bytes(p_ctx, img_format, &bmhd);
+    p_est->scratch_bytes = ilbm_scratch_size(&bmhd);
+    p_est->peak_bytes = sizeof(ilbm_image) + (p_est->chunk_cnt + 1) * sizeof(ilbm_chunk) + p_est->chunk_bytes +
+                        p_est->bitmap_bytes + p_est->scratch_bytes + palette_size + (palette_size != 0 ? cycle_cnt * sizeof(ilbm_cycle) : 0);
+    p_est->work = (body_size != 0 ? body_size : planar) + planar;
+    if(!p_ctx->planar || img_format == ILBM_FORMAT_PBM){
+        p_est->work += p_est->pixels * (true_color ? 4 : 1);
+    }
+
+    if(chunk_over || (p_ctx->limits.max_pixels != 0 && p_est->pixels > p_ctx->limits.max_pixels) ||
+       (p_ctx->limits.max_alloc != 0 && p_est->peak_bytes > p_ctx->limits.max_alloc) || p_est->peak_bytes > SIZE_MAX){
+        return ILBM_ERROR_LIMIT;
+    }
+
+    return ILBM_OK;
+}
+
+static void ilbm_check_issue(ilbm_check * p_check, ILBM_ISSUE issue, uint32_t addr, uint32_t row) {
+    if(!(p_check->issues & (1 << issue))){
+        p_check->issues |= 1 << issue;
+        p_check->issue_addr[issue] = addr;
+        p_check->issue_row[issue] = row;
+    }
+}
+
+/* Steps from control byte to control byte, literals are skipped and runs only counted. Each
+ * unit (a plane row, a PBM row) is packed on its own, left is what remains of the current one. */
+static ILBM_ERROR ilbm_check_body(ilbm_check * p_check, const uint8_t * body, uint32_t size, uint32_t unit, uint32_t row_len, uint32_t height, int compressed) {
+    const uint64_t total = (uint64_t)row_len * height;
+    const uint32_t addr = p_check->body_addr;
+
+    ILBM_ERROR error = ILBM_OK;
+    uint64_t   out = 0;
+    uint32_t   pos = 0;
+
+    if(!compressed){
+        out = size < total ? size : total;
+        pos = out;
+    }
+
+    uint32_t left = unit;
+    while(compressed && out < total && pos < size){
+        const uint32_t ctl = pos;
+        const uint8_t  byte = body[pos++];
+        uint32_t n;
+
+        if(byte > 128){
+            if(pos >= size){
+                error = ILBM_ERROR_BODY_SHORT_REPEAT;
+                break;
+            }
+            n = 257 - byte;
+            pos++;
+        }else
+        if(byte < 128){
+            n = byte + 1;
+            if(n > size - pos){
+                n = size - pos;
+                error = ILBM_ERROR_BODY_SHORT_LITERAL;
+            }
+            pos += n;
+        }else{
+            continue;
+        }
+
+        if(n < left){
+            left -= n;
+        }else
+        if(n == left){
+            left = unit;
+        }else{
+            if(out + n > total){
+                ilbm_check_issue(p_check, ILBM_ISSUE_OVERRUN, addr + ctl, out / row_len);
+            }else{
+                ilbm_check_issue(p_check, ILBM_ISSUE_CROSSED_ROW, addr + ctl, out / row_len);
+                p_check->crossed_cnt++;
+            }
+            left = unit - (out + n) % unit;
+        }
+        out += n;
+
+        if(error != ILBM_OK){
+            break;
+        }
+    }
+
+    if(out < total){
+        ilbm_check_issue(p_check, ILBM_ISSUE_UNDERRUN, addr + pos, out / row_len);
+    }else
+    if(pos < size){
+        ilbm_check_issue(p_check, ILBM_ISSUE_TRAILING, addr + pos, height);
+    }
+    p_check->expected_bytes = total;
+    p_check->unpacked_bytes = out;
+
+    return error;
+}
+
+ILBM_ERROR ilbm_validate(ilbm_ctx * p_ctx, const uint8_t * buf, size_t len, ILBM_FORMAT format, ilbm_check * p_check) {
+    memset(p_check, 0, sizeof(ilbm_check));
+
+    if(buf == NULL){
+        return ILBM_ERROR_FORM_MISSING;
+    }
+
+    ilbm_begin(p_ctx);
+
+    ilbm_image * p_img = ilbm_image_new(p_ctx);
+    if(p_img == NULL){
+        return ILBM_ERROR_LIMIT;
+    }
+
+    uint32_t chunk_cnt = ilbm_collect_mem(p_ctx, p_img, buf, len);
+
+    /* Nothing but the chunk list is allocated, max_alloc sized for decoding doesn't apply */
+    if(!p_ctx->over_limit && ilbm_parse_head(p_ctx, p_img, format, chunk_cnt, 0) != NULL && ilbm_find_body(p_img) != NULL){
+        const ilbm_chunk * body_chunk = p_img->body_chunk;
+
+        uint32_t row_len;
+        ilbm_select_row(p_img->format, &p_img->head, &row_len);
+        const uint32_t unit = p_img->format == ILBM_FORMAT_PBM ? row_len : ((p_img->width + 15) >> 4) << 1;
+
+        p_check->body_addr = body_chunk->addr + 8;
+        p_check->body_size = body_chunk->size;
+        p_img->error = ilbm_check_body(p_check, body_chunk->content, body_chunk->size, unit, row_len, p_img->height, p_img->head.compression);
+    }
+
+    if(p_img->bmhd_chunk != NULL){
+        p_check->width = p_img->width;
+        p_check->height = p_img->height;
+    }
+    p_check->warnings = p_img->warnings;
+
+    ILBM_ERROR error = p_ctx->over_limit ? ILBM_ERROR_LIMIT : p_img->error;
+
+    ilbm_free(p_img);
+
+    return error;
+}
+
+enum {
+    ILBM_PUSH_CHUNK_HEAD,
+    ILBM_PUSH_CHUNK_DATA,
+    ILBM_PUSH_BODY,
+    ILBM_PUSH_PAD,
+    ILBM_PUSH_STOPPED
+} typedef ILBM_PUSH_STATE;
+
+struct ilbm_push {
+    ilbm_ctx *      ctx;
+    ILBM_FORMAT     format;
+    ilbm_event_fn   event;
+    void *          user;
+    ilbm_image *    img;
+    ILBM_PUSH_STATE state;
+    uint32_t        addr;
+    uint8_t         head[8];
+    uint32_t        head_fill;
+    ilbm_chunk *    chunk;
+    ilbm_chunk *    last_chunk;
+    uint32_t        chunk_cnt;
+    uint32_t        c_size;
+    uint32_t        fill;
+    uint8_t         bmhd_seen;
+    uint8_t         streamed;
+    uint8_t         header_sent;
+    uint8_t         palette_sent;
+    /* A BODY decoded while it arrives, one row at a time */
+    ilbm_row_fn     row;
+    ilbm_unpacker   unpacker;
+    uint8_t         compressed;
+    uint8_t *       rows;
+    uint32_t        row_len;
+    uint32_t        row_fill;
+    uint32_t        row_no;
+};
+
+static void ilbm_push_event(ilbm_push * p_push, ILBM_EVENT event, uint32_t row_no) {
+    if(p_push->event != NULL){
+        p_push->event(p_push->user, event, p_push->img, row_no);
+    }
+}
+
+ilbm_push * ilbm_push_new(ilbm_ctx * p_ctx, ILBM_FORMAT format, ilbm_event_fn event, void * user) {
+
+    ilbm_log(p_ctx, ILBM_LOG_INFO, "libilbm %s (%s)", LIBILBM_VERSION, ilbm_simd_name());
+
+    ilbm_begin(p_ctx);
+
+    ilbm_push * p_push = (ilbm_push *)ilbm_alloc(p_ctx, sizeof(ilbm_push));
+    if(p_push == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "push malloc failed");
+        return NULL;
+    }
+    memset(p_push, 0, sizeof(ilbm_push));
+
+    p_push->img = ilbm_image_new(p_ctx);
+    if(p_push->img == NULL){
+        ilbm_release(p_ctx, p_push);
+        return NULL;
+    }
+
+    p_push->ctx = p_ctx;
+    p_push->format = format;
+    p_push->event = event;
+    p_push->user = user;
+    p_push->state = ILBM_PUSH_CHUNK_HEAD;
+
+    return p_push;
+}
+
+/* The first BODY after a BMHD is decoded on the fly, if the header is usable by then. Otherwise
+ * it is collected like any other chunk and ilbm_push_finish() parses the whole image. */
+static int ilbm_push_body(ilbm_push * p_push, ilbm_chunk * c) {
+    ilbm_ctx *   p_ctx = p_push->ctx;
+    ilbm_image * p_img = p_push->img;
+
+    if(ilbm_parse_head(p_ctx, p_img, p_push->format, p_push->chunk_cnt + 1, 1) == NULL){
+        /* Buffering the body would only postpone the same verdict */
+        if(p_img->error == ILBM_ERROR_LIMIT){
+            p_ctx->over_limit = 1;
+            return -1;
+        }
+        p_img->error = ILBM_OK;
+        p_img->warnings = 0;
+        return -1;
+    }
+
+    p_push->chunk_cnt = ilbm_append_chunk(p_ctx, p_img, p_push->last_chunk, c, p_push->chunk_cnt);
+    p_push->last_chunk = c;
+    p_img->body_chunk = c;
+    p_push->streamed = 1;
+
+    if(ilbm_alloc_bitmap(p_ctx, p_img) != 0){
+        return 0;
+    }
+    p_push->rows = (uint8_t *)ilbm_alloc(p_ctx, ilbm_scratch_size(&p_img->head));
+    if(p_push->rows == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "rows malloc failed");
+        return 0;
+    }
+    p_push->row = ilbm_select_row(p_img->format, &p_img->head, &p_push->row_len);
+    if(p_img->planes != NULL){
+        p_push->row = ilbm_row_planar;
+    }
+    p_push->compressed = p_img->head.compression;
+
+    p_push->header_sent = 1;
+    ilbm_push_event(p_push, ILBM_EVENT_HEADER, 0);
+
+    return 0;
+}
+
+static int ilbm_push_chunk(ilbm_push * p_push) {
+    ilbm_ctx *   p_ctx = p_push->ctx;
+    ilbm_image * p_img = p_push->img;
+
+    ilbm_chunk * c = (ilbm_chunk *)ilbm_alloc(p_ctx, sizeof(ilbm_chunk));
+    if(c == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "chunk malloc failed");
+        return -1;
+    }
+
+    memcpy(c->name, p_push->head, 4);
+    memcpy(&c->size, p_push->head + 4, 4);
+    c->size = UINT32_BE(c->size);
+    c->addr = p_push->addr - 8;
+    c->content = NULL;
+    c->borrowed = 0;
+    c->next_chunk = NULL;
+
+    p_push->chunk = c;
+    p_push->c_size = p_img->form_chunk == NULL ? 4 : c->size;
+    p_push->fill = 0;
+
+    if(ilbm_chunk_over_limit(p_ctx, p_push->c_size)){
+        ilbm_release(p_ctx, c);
+        p_push->chunk = NULL;
+        return -1;
+    }
+
+    if(p_img->form_chunk != NULL && p_img->body_chunk == NULL && p_push->bmhd_seen && *(uint32_t *)(c->name) == *(uint32_t *)"BODY"){
+        if(ilbm_push_body(p_push, c) == 0){
+            p_push->state = ILBM_PUSH_BODY;
+            return 0;
+        }
+        if(p_ctx->over_limit){
+            ilbm_release(p_ctx, c);
+            p_push->chunk = NULL;
+            return -1;
+        }
+    }
+
+    c->content = (uint8_t *)ilbm_alloc(p_ctx, p_push->c_size);
+    if(c->content == NULL){
+        ilbm_log(p_ctx, ILBM_LOG_ERROR, "content malloc failed");
+        ilbm_release(p_ctx, c);
+        p_push->chunk = NULL;
+        return -1;
+    }
+    p_push->state = ILBM_PUSH_CHUNK_DATA;
+
+    return 0;
+}
+
+static void ilbm_push_complete(ilbm_push * p_push) {
+    ilbm_ctx *   p_ctx = p_push->ctx;
+    ilbm_image * p_img = p_push->img;
+    ilbm_chunk * c = p_push->chunk;
+
+    if(p_push->state == ILBM_PUSH_CHUNK_DATA){
+        if(p_img->form_chunk == NULL){
+            p_img->form_chunk = c;
+        }else{
+            p_push->chunk_cnt = ilbm_append_chunk(p_ctx, p_img, p_push->last_chunk, c, p_push->chunk_cnt);
+            p_push->last_chunk = c;
+
+            /* A short BMHD fragment is left to ilbm_push_finish(), which reports it */
+            if(*(uint32_t *)(c->name) == *(uint32_t *)"BMHD" && c->size >= sizeof(ilbm_head)){
+                p_push->bmhd_seen = 1;
+            }
+            if(*(uint32_t *)(c->name) == *(uint32_t *)"CMAP" && p_img->cmap_chunk == NULL && ilbm_set_palette(p_ctx, p_img, c) == 0){
+                p_push->palette_sent = 1;
+                ilbm_push_event(p_push, ILBM_EVENT_PALETTE, 0);
+            }
+        }
+    }
+
+    p_push->chunk = NULL;
+    p_push->state = (p_push->c_size & 1) ? ILBM_PUSH_PAD : ILBM_PUSH_CHUNK_HEAD;
+}
+
+static void ilbm_push_row(ilbm_push * p_push) {
+    p_push->row(p_push->img, p_push->row_no, p_push->rows);
+    if(p_push->img->pixels != NULL){
+        ilbm_row_stats(p_push->img, p_push->row_no);
+    }
+    ilbm_push_event(p_push, ILBM_EVENT_ROW, p_push->row_no);
+
+    p_push->row_no++;
+    p_push->row_fill = 0;
+}
+
+static void ilbm_push_rows(ilbm_push * p_push, const uint8_t * buf, uint32_t len) {
+    ilbm_unpacker * u = &p_push->unpacker;
+
+    u->src = buf;
+    u->size = len;
+    u->pos = 0;
+
+    while(p_push->row_no < p_push->img->height){
+        p_push->row_fill += ilbm_unpack_piece(u, p_push->rows + p_push->row_fill, p_push->row_len - p_push->row_fill, p_push->compressed);
+        if(p_push->row_fill < p_push->row_len){
+            break;
+        }
+        ilbm_push_row(p_push);
+    }
+}
+
+int ilbm_feed(ilbm_push * p_push, const uint8_t * buf, size_t len) {
+    if(p_push->state == ILBM_PUSH_STOPPED){
+        return -1;
+    }
+
+    p_push->ctx->stats.bytes += len;
+
+    while(len > 0){
+        uint32_t n = 0;
+
+        switch(p_push->state){
+            case ILBM_PUSH_CHUNK_HEAD:
+                n = 8 - p_push->head_fill < len ? 8 - p_push->head_fill : len;
+                memcpy(p_push->head + p_push->head_fill, buf, n);
+                p_push->head_fill += n;
+                break;
+            case ILBM_PUSH_CHUNK_DATA:
+            case ILBM_PUSH_BODY:
+                n = p_push->c_size - p_push->fill < len ? p_push->c_size - p_push->fill : len;
+                if(p_push->state == ILBM_PUSH_CHUNK_DATA){
+                    memcpy(p_push->chunk->content + p_push->fill, buf, n);
+                }else
+                if(p_push->row != NULL){
+                    ilbm_push_rows(p_push, buf, n);
+                }
+                p_push->fill += n;
+                break;
+            case ILBM_PUSH_PAD:
+                n = 1;
+                p_push->state = ILBM_PUSH_CHUNK_HEAD;
+                break;
+            case ILBM_PUSH_STOPPED:
+                return -1;
+        }
+        buf += n;
+        len -= n;
+        p_push->addr += n;
+
+        if(p_push->state == ILBM_PUSH_CHUNK_HEAD && p_push->head_fill == 8){
+            p_push->head_fill = 0;
+            if(ilbm_push_chunk(p_push) != 0){
+                p_push->state = ILBM_PUSH_STOPPED;
+                return -1;
+            }
+        }
+        if((p_push->state == ILBM_PUSH_CHUNK_DATA || p_push->state == ILBM_PUSH_BODY) && p_push->fill == p_push->c_size){
+            ilbm_push_complete(p_push);
+        }
+    }
+
+    return 0;
+}
+
+ilbm_image * ilbm_push_finish(ilbm_push * p_push) {
+    ilbm_ctx *   p_ctx = p_push->ctx;
+    ilbm_image * p_img = p_push->img;
+
+    /* Like ilbm_read(), a chunk cut short by the end of the input is dropped */
+    if(p_push->state == ILBM_PUSH_CHUNK_DATA){
+        ilbm_release(p_ctx, p_push->chunk->content);
+        ilbm_release(p_ctx, p_push->chunk);
+    }
+
+    if(p_push->streamed){
+        if(p_push->row != NULL){
+            ilbm_unpacker * u = &p_push->unpacker;
+            if(p_push->row_no < p_img->height){
+                if(u->pending){
+                    p_img->error = ILBM_ERROR_BODY_SHORT_REPEAT;
+                }else
+                if(u->run > 0 && u->literal){
+                    p_img->error = ILBM_ERROR_BODY_SHORT_LITERAL;
+                }
+            }
+
+            /* Rows past the end of a short body stay zero but still go through the mask handling */
+            while(p_push->row_no < p_img->height){
+                memset(p_push->rows + p_push->row_fill, 0, p_push->row_len - p_push->row_fill);
+                ilbm_push_row(p_push);
+            }
+            p_ctx->stats.pixels += p_img->size;
+
+            ilbm_finish_stats(p_img);
+            ilbm_parse_cmap(p_ctx, p_img);
+        }
+    }else
+    if(!p_ctx->over_limit){
+        ilbm_parse(p_ctx, p_img, p_push->format, p_push->chunk_cnt);
+
+        if(p_img->pixels != NULL || p_img->planes != NULL){
+            p_push->header_sent = 1;
+            ilbm_push_event(p_push, ILBM_EVENT_HEADER, 0);
+        }
+    }
+
+    if(p_img->palette != NULL && !p_push->palette_sent){
+        ilbm_push_event(p_push, ILBM_EVENT_PALETTE, 0);
+    }
+    if(!p_push->streamed && (p_img->pixels != NULL || p_img->planes != NULL)){
+        for(uint32_t row_no = 0; row_no < p_img->height; row_no++){
+            ilbm_push_event(p_push, ILBM_EVENT_ROW, row_no);
+        }
+    }
+
+    ilbm_release(p_ctx, p_push->rows);
+    ilbm_release(p_ctx, p_push);
+
+    return ilbm_account(p_ctx, p_img);
+}
+
 void ilbm_free(ilbm_image * p_first_img) {
     ilbm_image * p_img = p_first_img;
 
     while(p_img != NULL){
+        /* Everything was allocated through the hooks of the context that read the image */
+        ilbm_release_fn release = p_img->release;
+        void * user = p_img->release_user;
+
         ilbm_chunk * p_chunk = p_img->first_chunk;
         while(p_chunk != NULL){
             ilbm_chunk * p_tmp = (void *)p_chunk;                    
 
-            if(p_chunk->content != NULL) free(p_chunk->content);
+            if(p_chunk->content != NULL && !p_chunk->borrowed) release(user, p_chunk->content);
             p_chunk = p_chunk->next_chunk;
-            free(p_tmp);
+            release(user, p_tmp);
+        }
+
+        if(p_img->form_chunk != NULL){
+            if(!p_img->form_chunk->borrowed) release(user, p_img->form_chunk->content);
+            release(user, p_img->form_chunk);
         }
         
-        if(p_img->pixels != NULL) free((void *)p_img->pixels);
-        if(p_img->palette != NULL) free((void *)p_img->palette);
-        if(p_img->alpha != NULL) free((void *)p_img->alpha);
+        if(p_img->pixels != NULL) release(user, (void *)p_img->pixels);
+        if(p_img->planes != NULL) release(user, (void *)p_img->planes);
+        if(p_img->palette != NULL) release(user, (void *)p_img->palette);
+        if(p_img->alpha != NULL) release(user, (void *)p_img->alpha);
+        if(p_img->cycles != NULL) release(user, (void *)p_img->cycles);
+        if(p_img->histogram != NULL) release(user, (void *)p_img->histogram);
         
         ilbm_image * p_tmp = p_img;        
         
         p_img = p_img->next_image;
 
-        free((void *)p_tmp);        
+        release(user, (void *)p_tmp);        
     }
 }
 
@@ -523,6 +2169,8 @@ int ilbm_error_snprint(char *buf, size_t len, ilbm_image * p_img) {
         case ILBM_ERROR_CMAP_MISSING: return snprintf(buf, len, "Palette chunk \"CMAP\" missing");
         case ILBM_ERROR_BODY_SHORT_REPEAT: return snprintf(buf, len, "Overflow in stream repeat");
         case ILBM_ERROR_BODY_SHORT_LITERAL: return snprintf(buf, len, "Overflow in stream literal");
+        case ILBM_ERROR_UNSUPPORTED: return snprintf(buf, len, "Unsupported plane count or compression");
+        case ILBM_ERROR_LIMIT: return snprintf(buf, len, "Decode would exceed the context limits");
     }
     return 0;
 }
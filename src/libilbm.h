@@ -42,7 +42,7 @@ enum {
     ILBM_FORMAT_EOL
 } typedef ILBM_FORMAT;
 
-const char * ilbm_format_strs[] = { "ILBM", "PBM" };
+extern const char * ilbm_format_strs[];
 
 enum {
     ILBM_BMHD,
@@ -74,10 +74,12 @@ enum {
     ILBM_ERROR_IFF_8SVX,  
     ILBM_ERROR_IFF_SMUS,  
     ILBM_ERROR_IFF_ANIM,  
+    ILBM_ERROR_UNSUPPORTED,
+    ILBM_ERROR_LIMIT,
     ILBM_ERROR_EOL
 } typedef ILBM_ERROR;
 
-const char * ilbm_error_strs[] = { "OK", "Zero size", "Illegal width", "Illegal height", "No chunks found", "Magic missing", "Header missing", "Body missing", "Colormap missing", "Short repeat in body", "Short literal in body", "Unsupported 8SVX sound format", "Unsupported SMUS music format", "Unsupported ANIM animation format" };
+extern const char * ilbm_error_strs[];
 
 enum {
     ILBM_WARN_FORM_BY_POSITION,
@@ -89,12 +91,23 @@ enum {
     ILBM_WARN_EOL
 } typedef ILBM_WARNING;
 
+enum {
+    ILBM_ISSUE_CROSSED_ROW,
+    ILBM_ISSUE_OVERRUN,
+    ILBM_ISSUE_UNDERRUN,
+    ILBM_ISSUE_TRAILING,
+    ILBM_ISSUE_EOL
+} typedef ILBM_ISSUE;
+
+extern const char * ilbm_issue_strs[];
+
 struct ilbm_chunk {
     const ILBM_CHUNK    type;
     char                name[4];
     uint32_t            addr;
     uint32_t            size;    
     uint8_t           * content;
+    uint8_t             borrowed;
     struct ilbm_chunk * next_chunk;
 } typedef ilbm_chunk;
 
@@ -114,15 +127,137 @@ struct __attribute__((packed)) {
     int16_t  page_height;
 } typedef ilbm_head;
 
+/* DEST: where the planes of this image go when it is merged into a deeper bitmap */
+struct {
+    uint8_t  depth;
+    uint16_t plane_pick;
+    uint16_t plane_on_off;
+    uint16_t plane_mask;
+} typedef ilbm_dest;
+
+struct {
+    uint8_t  low;
+    uint8_t  high;
+    int8_t   direction;
+    double   rate;
+} typedef ilbm_cycle;
+
+enum {
+    ILBM_LOG_ERROR = 1,
+    ILBM_LOG_WARNING,
+    ILBM_LOG_INFO,
+    ILBM_LOG_DEV
+} typedef ILBM_LOG_LEVEL;
+
+typedef void * (*ilbm_alloc_fn)(void * user, size_t size);
+typedef void   (*ilbm_release_fn)(void * user, void * ptr);
+typedef void   (*ilbm_log_fn)(void * user, ILBM_LOG_LEVEL level, const char * msg);
+
+/* A decode crossing a limit stops with ILBM_ERROR_LIMIT before allocating for it. 0 turns the
+ * pixel, chunk and allocation limits off. max_alloc covers everything one decode allocates,
+ * including a growing scratch buffer. */
+struct {
+    uint32_t max_width;
+    uint32_t max_height;
+    uint64_t max_pixels;
+    uint64_t max_chunk_bytes;
+    uint64_t max_alloc;
+} typedef ilbm_limits;
+
+struct {
+    uint64_t images;
+    uint64_t failed;
+    uint64_t bytes;
+    uint64_t pixels;
+    uint64_t allocs;
+    uint64_t scratch_grows;
+} typedef ilbm_stats;
+
+/* Everything a decode needs besides its input. With collect_stats set every image also gets
+ * its histogram, used_colors and opaque box, counted in the decoder's row loop. With planar
+ * set ILBM bodies are only unpacked into ilbm_image.planes, see there. The _ctx entry points
+ * touch no globals, so threads with their own context decode concurrently with their own
+ * settings. The scratch buffer is kept between decodes and only grows, a warm context doesn't
+ * allocate for it. */
+struct {
+    ilbm_alloc_fn   alloc;
+    ilbm_release_fn release;
+    ilbm_log_fn     log;
+    void *          user;
+    int             verbosity;
+    ilbm_limits     limits;
+    uint8_t         collect_stats;
+    uint8_t         planar;
+    ilbm_stats      stats;
+    uint8_t *       scratch;
+    size_t          scratch_size;
+    uint64_t        alloc_bytes;
+    uint8_t         over_limit;
+} typedef ilbm_ctx;
+
+/* What a decode of the file will cost, worked out from its chunk headers alone. peak_bytes is
+ * an upper bound for ilbm_read_ctx() with a cold context, a little above what the decode takes
+ * when the chunk list up to the BODY header was passed and further off when it was cut shorter.
+ * ilbm_read_mem_ctx() borrows the chunk contents and needs chunk_bytes less. */
+struct {
+    uint32_t width;
+    uint32_t height;
+    uint64_t pixels;
+    uint32_t chunk_cnt;
+    uint64_t chunk_bytes;
+    uint64_t bitmap_bytes;
+    uint64_t scratch_bytes;
+    uint64_t peak_bytes;
+    uint64_t work;
+} typedef ilbm_estimate;
+
+/* What ilbm_validate() found in the BODY, offsets are from the start of the buffer. Every issue
+ * set in issues comes with the offset and image row of its first occurrence. CROSSED_ROW: a run
+ * reaches into the next plane row (PBM: row), the decoder takes it but the format doesn't allow
+ * it. OVERRUN: the last run reaches past the end of the bitmap. UNDERRUN: the body ends before
+ * the last row, the rest decodes as zero. TRAILING: bytes are left after the last row. */
+struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t warnings;
+    uint32_t body_addr;
+    uint32_t body_size;
+    uint64_t expected_bytes;
+    uint64_t unpacked_bytes;
+    uint32_t issues;
+    uint32_t crossed_cnt;
+    uint32_t issue_addr[ILBM_ISSUE_EOL];
+    uint32_t issue_row[ILBM_ISSUE_EOL];
+} typedef ilbm_check;
+
 struct ilbm_image {
     ILBM_FORMAT         format;
+    ilbm_head           head;
     uint32_t            width;
     uint32_t            height;
     uint32_t            size;
+    uint8_t             true_color;
     uint8_t *           pixels;
+    /* Planar mode (ilbm_ctx.planar, ILBM only, PBM bodies still go to pixels): the unpacked
+     * bitplanes instead of pixels and alpha, which stay NULL. plane_count planes one after the
+     * other, each height rows of row_bytes (width rounded up to 16 pixels), the mask plane last
+     * for head.mask 1. There are no stats and max_index is only an upper bound. */
+    uint8_t *           planes;
+    uint32_t            plane_count;
+    uint32_t            row_bytes;
     uint32_t            color_count;
     uint8_t *           palette;    
     uint8_t *           alpha;
+    uint32_t            cycle_count;
+    ilbm_cycle *        cycles;
+    /* GRAB hotspot, DEST plane merging and SPRT precedence, set where the chunk was present */
+    uint8_t             has_grab;
+    int16_t             grab_x;
+    int16_t             grab_y;
+    uint8_t             has_dest;
+    ilbm_dest           dest;
+    uint8_t             is_sprite;
+    uint16_t            sprite_precedence;
     ilbm_chunk *        first_chunk;
     ilbm_chunk *        form_chunk;
     ilbm_chunk *        bmhd_chunk;
@@ -130,17 +265,94 @@ struct ilbm_image {
     ilbm_chunk *        cmap_chunk;
     ILBM_ERROR          error;    
     uint32_t            warnings;
+    /* Gathered while the rows are decoded. max_index is always set (0 for true color), the rest
+     * only with ilbm_ctx.collect_stats: 256 counts per index, how many of them are non-zero,
+     * and the box around all pixels that aren't masked out, x1/y1 exclusive, empty if
+     * opaque_x1 is 0. */
+    uint32_t            max_index;
+    uint32_t *          histogram;
+    uint32_t            used_colors;
+    uint32_t            opaque_x0;
+    uint32_t            opaque_y0;
+    uint32_t            opaque_x1;
+    uint32_t            opaque_y1;
     struct ilbm_image * next_image;
+    ilbm_release_fn     release;
+    void *              release_user;
 } typedef ilbm_image;
 
+enum {
+    ILBM_EVENT_HEADER,
+    ILBM_EVENT_PALETTE,
+    ILBM_EVENT_ROW
+} typedef ILBM_EVENT;
+
+/* HEADER: size and layout are known and pixels (and alpha) are allocated, PALETTE: palette
+ * and color_count are set, ROW: row row_no of pixels (and alpha) is decoded. */
+typedef void (*ilbm_event_fn)(void * user, ILBM_EVENT event, ilbm_image * p_img, uint32_t row_no);
+
+struct ilbm_push typedef ilbm_push;
+
+/* malloc/free, stdout logging, LIBILBM_VERBOSITY and the default 9999x9999 limits, no others */
+void ilbm_ctx_init(ilbm_ctx * p_ctx);
+
+/* Frees the scratch buffer, the context can be initialized again afterwards */
+void ilbm_ctx_release(ilbm_ctx * p_ctx);
+
+/* Fills p_est from the start of a file, the first few hundred bytes usually hold all chunk
+ * headers up to the BODY. Returns ILBM_OK, the header error a decode would stop with,
+ * ILBM_ERROR_BODY_MISSING when buf ends before the BODY header and the FORM size can't bound
+ * the rest, or ILBM_ERROR_LIMIT when the decode would cross one of p_ctx's limits. */
+ILBM_ERROR ilbm_preflight(ilbm_ctx * p_ctx, const uint8_t * buf, size_t len, ILBM_FORMAT format, ilbm_estimate * p_est);
+
+/* Tells whether an image in memory would decode cleanly without decoding it: the chunks are
+ * parsed like ilbm_read_mem_ctx() does, then only the control bytes of the BODY are read and the
+ * run lengths added up, nothing is expanded or allocated for the bitmap. Returns the error the
+ * decode would end with, a palette the decoder would only find by its size is not looked for.
+ * The pixel and chunk limits apply, max_alloc doesn't since no bitmap is allocated. */
+ILBM_ERROR ilbm_validate(ilbm_ctx * p_ctx, const uint8_t * buf, size_t len, ILBM_FORMAT format, ilbm_check * p_check);
+
+ilbm_image * ilbm_read_ctx(ilbm_ctx * p_ctx, FILE * file_p, ILBM_FORMAT format);
+
+ilbm_image * ilbm_read_mem_ctx(ilbm_ctx * p_ctx, const uint8_t * buf, size_t len, ILBM_FORMAT format);
+
+/* Push parser for input that arrives in pieces of any size (pipes, sockets, decompressors).
+ * Nothing is seeked and the BODY is not buffered: rows are decoded and reported to event as
+ * soon as their bytes were fed. Files with non-standard chunk names are collected and parsed
+ * by ilbm_push_finish(), which reports all events then. The parser uses p_ctx until then. */
+ilbm_push * ilbm_push_new(ilbm_ctx * p_ctx, ILBM_FORMAT format, ilbm_event_fn event, void * user);
+
+/* Returns 0, or -1 once the parser stopped taking input (out of memory) */
+int ilbm_feed(ilbm_push * p_push, const uint8_t * buf, size_t len);
+
+/* Ends the input and frees the parser, rows missing from a short BODY are decoded as zero */
+ilbm_image * ilbm_push_finish(ilbm_push * p_push);
+
 ilbm_image * ilbm_read(FILE *file_p, ILBM_FORMAT format);
 
+ilbm_image * ilbm_read_mem(const uint8_t * buf, size_t len, ILBM_FORMAT format);
+
+int ilbm_sniff(const uint8_t * buf, size_t len);
+
 void ilbm_free(ilbm_image * p_img);
 
+int ilbm_cycle_palette(ilbm_image * p_img, double t, uint8_t * palette);
+
+uint32_t ilbm_cycle_frames(ilbm_image * p_img, double frame_time, uint32_t max_frames);
+
 int ilbm_error_snprint(char *buf, size_t len, ilbm_image * p_img);
 
 int ilbm_warn_snprint(char *buf, size_t len, ilbm_image * p_img, ILBM_WARNING warning);
 
+/* Name of the planar to chunky kernel picked for this CPU: "avx2", "ssse3", "sse2" or "scalar". */
+const char * ilbm_simd_name(void);
+
+/* Chunky to planar, the way back for encoders: width indices go to num_planes (1 to 8) plane
+ * rows, plane p at planes + p * plane_stride. (width + 7) / 8 bytes are written per plane, the
+ * first pixel in the top bit, unused bits of the last byte zero. A stride of the row bytes writes
+ * an interleaved BODY row, row bytes times height the layout of ilbm_image.planes. */
+void ilbm_c2p_row(const uint8_t * chunky, uint32_t width, uint8_t * planes, size_t plane_stride, uint32_t num_planes);
+
 void log_set_verbosity(int verbosity);
 
 void log_dev(const char *format, ...);
@@ -0,0 +1,643 @@
+/* prefetch.c
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define PREFETCH_URING
+#endif
+#endif
+#endif
+
+#include "prefetch.h"
+
+#ifdef PREFETCH_URING
+/* One read in flight, resubmitted for the rest after a short read */
+struct {
+    prefetch_item * item;
+    int             fd;
+    size_t          done;
+    struct iovec    iov;
+} typedef prefetch_slot;
+
+/* The two rings shared with the kernel, set up without liburing */
+struct {
+    int                   fd;
+    uint32_t *            sq_head;
+    uint32_t *            sq_tail;
+    uint32_t *            sq_mask;
+    uint32_t *            sq_array;
+    struct io_uring_sqe * sqes;
+    uint32_t *            cq_head;
+    uint32_t *            cq_tail;
+    uint32_t *            cq_mask;
+    struct io_uring_cqe * cqes;
+    void *                sq_map;
+    size_t                sq_map_size;
+    void *                cq_map;
+    size_t                cq_map_size;
+    size_t                sqes_size;
+    uint32_t              unsubmitted;
+} typedef prefetch_ring;
+#endif
+
+struct prefetch {
+    pthread_mutex_t  lock;
+    /* Consumers wait for read files, the reading side for paths and for released bytes */
+    pthread_cond_t   ready_cond;
+    pthread_cond_t   work_cond;
+    pthread_cond_t   room_cond;
+    prefetch_item *  pending_head;
+    prefetch_item *  pending_tail;
+    prefetch_item *  ready_head;
+    prefetch_item *  ready_tail;
+    uint32_t         active;
+    int              ended;
+    uint64_t         bytes;
+    uint64_t         max_bytes;
+    uint32_t         depth;
+    prefetch_want_cb want;
+    void *           user;
+    pthread_t *      threads;
+    uint32_t         thread_cnt;
+    int              uring;
+#ifdef PREFETCH_URING
+    prefetch_ring    ring;
+    prefetch_slot *  slots;
+#endif
+};
+
+struct {
+    char *  name;
+    uint8_t type;
+} typedef walk_entry;
+
+static int walk_entry_cmp(const void * a, const void * b) {
+    return strcmp(((const walk_entry *)a)->name, ((const walk_entry *)b)->name);
+}
+
+uint32_t prefetch_walk(const char * path, prefetch_walk_cb found, void * user) {
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode)){
+        found(user, path);
+        return 1;
+    }
+
+    /* The directory is listed and closed before descending, deep trees don't pile up fds */
+    DIR * dir_p = opendir(path);
+    if(dir_p == NULL){
+        return 0;
+    }
+
+    walk_entry *    entries = NULL;
+    uint32_t        entry_cnt = 0;
+    uint32_t        entry_max = 0;
+    struct dirent * ent;
+    while((ent = readdir(dir_p)) != NULL){
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0){
+            continue;
+        }
+        if(entry_cnt == entry_max){
+            entry_max = entry_max ? entry_max * 2 : 64;
+            walk_entry * grown = (walk_entry *)realloc(entries, entry_max * sizeof(walk_entry));
+            if(grown == NULL){
+                break;
+            }
+            entries = grown;
+        }
+        if((entries[entry_cnt].name = strdup(ent->d_name)) == NULL){
+            break;
+        }
+        entries[entry_cnt].type = ent->d_type;
+        entry_cnt++;
+    }
+    closedir(dir_p);
+
+    qsort(entries, entry_cnt, sizeof(walk_entry), walk_entry_cmp);
+
+    const size_t path_len = strlen(path);
+    const char * sep = path_len > 0 && path[path_len - 1] == '/' ? "" : "/";
+    uint32_t     file_cnt = 0;
+
+    for(uint32_t i = 0; i < entry_cnt; i++){
+        char * child = (char *)malloc(path_len + strlen(entries[i].name) + 2);
+        if(child != NULL){
+            sprintf(child, "%s%s%s", path, sep, entries[i].name);
+
+            uint8_t type = entries[i].type;
+            if(type == DT_UNKNOWN || type == DT_LNK){
+                const int is_link = type == DT_LNK;
+                type = stat(child, &st) != 0 ? DT_UNKNOWN : S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) && !is_link ? DT_DIR : DT_UNKNOWN;
+            }
+
+            if(type == DT_DIR){
+                file_cnt += prefetch_walk(child, found, user);
+            }else
+            if(type == DT_REG){
+                found(user, child);
+                file_cnt++;
+            }
+            free(child);
+        }
+        free(entries[i].name);
+    }
+    free(entries);
+
+    return file_cnt;
+}
+
+/* The next queued path, NULL if there is none. Called with the lock held, like the rest of the
+ * queue helpers. */
+static prefetch_item * prefetch_pop(prefetch * p_prefetch) {
+    prefetch_item * p_item = p_prefetch->pending_head;
+    if(p_item != NULL){
+        p_prefetch->pending_head = p_item->next;
+        if(p_prefetch->pending_head == NULL){
+            p_prefetch->pending_tail = NULL;
+        }
+        p_item->next = NULL;
+        p_prefetch->active++;
+    }
+    return p_item;
+}
+
+static void prefetch_ready(prefetch * p_prefetch, prefetch_item * p_item) {
+    if(p_prefetch->ready_tail != NULL){
+        p_prefetch->ready_tail->next = p_item;
+    }else{
+        p_prefetch->ready_head = p_item;
+    }
+    p_prefetch->ready_tail = p_item;
+    p_prefetch->active--;
+
+    if(p_prefetch->ended && p_prefetch->pending_head == NULL && p_prefetch->active == 0){
+        pthread_cond_broadcast(&p_prefetch->ready_cond);
+    }else{
+        pthread_cond_signal(&p_prefetch->ready_cond);
+    }
+}
+
+/* Hands over what could not be read, or was not wanted, as a path only */
+static void prefetch_unread(prefetch * p_prefetch, prefetch_item * p_item) {
+    free(p_item->data);
+    p_item->data = NULL;
+    p_item->size = 0;
+    prefetch_ready(p_prefetch, p_item);
+}
+
+/* Returns the descriptor to read the file from, or -1 if it is handed over unread. Called
+ * without the lock, the want callback may take its time. */
+static int prefetch_open(prefetch * p_prefetch, prefetch_item * p_item) {
+    const int fd = open(p_item->path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || (uint64_t)st.st_size > p_prefetch->max_bytes / 4 ||
+       (p_prefetch->want != NULL && !p_prefetch->want(p_prefetch->user, p_item->path, &st))){
+        close(fd);
+        return -1;
+    }
+    p_item->size = st.st_size;
+    p_item->mtime = st.st_mtime;
+
+    return fd;
+}
+
+/* The budget counts the files in flight and those read but not released yet. A file that is
+ * larger than what is left waits, unless nothing is held at all. */
+static int prefetch_fits(const prefetch * p_prefetch, size_t size) {
+    return p_prefetch->bytes == 0 || p_prefetch->bytes + size <= p_prefetch->max_bytes;
+}
+
+static void * prefetch_reader(void * arg) {
+    prefetch * p_prefetch = (prefetch *)arg;
+
+    pthread_mutex_lock(&p_prefetch->lock);
+    while(1){
+        while(p_prefetch->pending_head == NULL && !p_prefetch->ended){
+            pthread_cond_wait(&p_prefetch->work_cond, &p_prefetch->lock);
+        }
+        prefetch_item * p_item = prefetch_pop(p_prefetch);
+        if(p_item == NULL){
+            break;
+        }
+
+        pthread_mutex_unlock(&p_prefetch->lock);
+        const int fd = prefetch_open(p_prefetch, p_item);
+        pthread_mutex_lock(&p_prefetch->lock);
+
+        if(fd < 0){
+            prefetch_unread(p_prefetch, p_item);
+            continue;
+        }
+
+        while(!prefetch_fits(p_prefetch, p_item->size)){
+            pthread_cond_wait(&p_prefetch->room_cond, &p_prefetch->lock);
+        }
+        const size_t size = p_item->size;
+        p_prefetch->bytes += size;
+        pthread_mutex_unlock(&p_prefetch->lock);
+
+        size_t  done = 0;
+        ssize_t n = 0;
+        p_item->data = (uint8_t *)malloc(size);
+        while(p_item->data != NULL && done < size){
+            n = pread(fd, p_item->data + done, size - done, done);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                break;
+            }
+            done += n;
+        }
+        close(fd);
+
+        /* A file that shrank since the stat is handed over as it is now */
+        const int failed = p_item->data == NULL || n < 0 || done == 0;
+
+        pthread_mutex_lock(&p_prefetch->lock);
+        p_prefetch->bytes -= failed ? size : size - done;
+        if(failed || done < size){
+            pthread_cond_broadcast(&p_prefetch->room_cond);
+        }
+        p_item->size = done;
+        if(failed){
+            prefetch_unread(p_prefetch, p_item);
+        }else{
+            prefetch_ready(p_prefetch, p_item);
+        }
+    }
+    pthread_mutex_unlock(&p_prefetch->lock);
+
+    return NULL;
+}
+
+#ifdef PREFETCH_URING
+static int ring_setup(prefetch_ring * p_ring, uint32_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(p_ring, 0, sizeof(prefetch_ring));
+
+    p_ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(p_ring->fd < 0){
+        return -1;
+    }
+
+    p_ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    p_ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(p_ring->cq_map_size > p_ring->sq_map_size){
+            p_ring->sq_map_size = p_ring->cq_map_size;
+        }
+        p_ring->cq_map_size = 0;
+    }
+    p_ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    p_ring->sq_map = mmap(NULL, p_ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_SQ_RING);
+    p_ring->cq_map = p_ring->cq_map_size == 0 ? p_ring->sq_map :
+                     mmap(NULL, p_ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_CQ_RING);
+    p_ring->sqes = (struct io_uring_sqe *)mmap(NULL, p_ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_SQES);
+    if(p_ring->sq_map == MAP_FAILED || p_ring->cq_map == MAP_FAILED || p_ring->sqes == MAP_FAILED){
+        if(p_ring->sq_map != MAP_FAILED) munmap(p_ring->sq_map, p_ring->sq_map_size);
+        if(p_ring->cq_map_size != 0 && p_ring->cq_map != MAP_FAILED) munmap(p_ring->cq_map, p_ring->cq_map_size);
+        if(p_ring->sqes != MAP_FAILED) munmap(p_ring->sqes, p_ring->sqes_size);
+        close(p_ring->fd);
+        return -1;
+    }
+
+    uint8_t * sq = (uint8_t *)p_ring->sq_map;
+    uint8_t * cq = (uint8_t *)p_ring->cq_map;
+    p_ring->sq_head = (uint32_t *)(sq + params.sq_off.head);
+    p_ring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+    p_ring->sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+    p_ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+    p_ring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+    p_ring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+    p_ring->cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+    p_ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+static void ring_close(prefetch_ring * p_ring) {
+    munmap(p_ring->sqes, p_ring->sqes_size);
+    if(p_ring->cq_map_size != 0){
+        munmap(p_ring->cq_map, p_ring->cq_map_size);
+    }
+    munmap(p_ring->sq_map, p_ring->sq_map_size);
+    close(p_ring->fd);
+}
+
+/* READV rather than READ, it is in every kernel that has io_uring at all */
+static void ring_read(prefetch_ring * p_ring, prefetch_slot * p_slot, uint64_t user_data) {
+    const uint32_t tail = *p_ring->sq_tail;
+    const uint32_t idx = tail & *p_ring->sq_mask;
+    struct io_uring_sqe * p_sqe = &p_ring->sqes[idx];
+
+    p_slot->iov.iov_base = p_slot->item->data + p_slot->done;
+    p_slot->iov.iov_len = p_slot->item->size - p_slot->done;
+
+    memset(p_sqe, 0, sizeof(struct io_uring_sqe));
+    p_sqe->opcode = IORING_OP_READV;
+    p_sqe->fd = p_slot->fd;
+    p_sqe->addr = (uint64_t)(uintptr_t)&p_slot->iov;
+    p_sqe->len = 1;
+    p_sqe->off = p_slot->done;
+    p_sqe->user_data = user_data;
+
+    p_ring->sq_array[idx] = idx;
+    __atomic_store_n(p_ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    p_ring->unsubmitted++;
+}
+
+/* Submits what was queued and waits for at least one completion */
+static void ring_wait(prefetch_ring * p_ring) {
+    while(1){
+        const long ret = syscall(__NR_io_uring_enter, p_ring->fd, p_ring->unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret >= 0){
+            p_ring->unsubmitted -= ret;
+            return;
+        }
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            return;
+        }
+    }
+}
+
+/* One thread opens the files, keeps up to depth reads in the ring and hands over what completed */
+static void * prefetch_ring_main(void * arg) {
+    prefetch *      p_prefetch = (prefetch *)arg;
+    prefetch_ring * p_ring = &p_prefetch->ring;
+    uint32_t        inflight = 0;
+    prefetch_item * p_held = NULL;
+    int             held_fd = -1;
+
+    pthread_mutex_lock(&p_prefetch->lock);
+    while(1){
+        while(inflight < p_prefetch->depth){
+            if(p_held == NULL){
+                if((p_held = prefetch_pop(p_prefetch)) == NULL){
+                    break;
+                }
+                pthread_mutex_unlock(&p_prefetch->lock);
+                held_fd = prefetch_open(p_prefetch, p_held);
+                pthread_mutex_lock(&p_prefetch->lock);
+                if(held_fd < 0){
+                    prefetch_unread(p_prefetch, p_held);
+                    p_held = NULL;
+                    continue;
+                }
+            }
+            if(!prefetch_fits(p_prefetch, p_held->size)){
+                break;
+            }
+
+            p_held->data = (uint8_t *)malloc(p_held->size);
+            if(p_held->data == NULL){
+                close(held_fd);
+                prefetch_unread(p_prefetch, p_held);
+                p_held = NULL;
+                continue;
+            }
+            p_prefetch->bytes += p_held->size;
+
+            uint32_t s = 0;
+            while(p_prefetch->slots[s].item != NULL){
+                s++;
+            }
+            p_prefetch->slots[s].item = p_held;
+            p_prefetch->slots[s].fd = held_fd;
+            p_prefetch->slots[s].done = 0;
+            ring_read(p_ring, &p_prefetch->slots[s], s);
+            inflight++;
+            p_held = NULL;
+        }
+
+        if(inflight == 0){
+            if(p_held == NULL && p_prefetch->pending_head == NULL && p_prefetch->ended){
+                break;
+            }
+            pthread_cond_wait(p_held != NULL ? &p_prefetch->room_cond : &p_prefetch->work_cond, &p_prefetch->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&p_prefetch->lock);
+        ring_wait(p_ring);
+        pthread_mutex_lock(&p_prefetch->lock);
+
+        uint32_t head = *p_ring->cq_head;
+        while(head != __atomic_load_n(p_ring->cq_tail, __ATOMIC_ACQUIRE)){
+            const struct io_uring_cqe * p_cqe = &p_ring->cqes[head & *p_ring->cq_mask];
+            prefetch_slot * p_slot = &p_prefetch->slots[p_cqe->user_data];
+            const int res = p_cqe->res;
+            head++;
+
+            if(res == -EINTR || res == -EAGAIN){
+                ring_read(p_ring, p_slot, p_cqe->user_data);
+                continue;
+            }
+            if(res > 0){
+                p_slot->done += res;
+                if(p_slot->done < p_slot->item->size){
+                    ring_read(p_ring, p_slot, p_cqe->user_data);
+                    continue;
+                }
+            }
+
+            /* Done, failed, or the file shrank since the stat and is handed over as it is now */
+            prefetch_item * p_item = p_slot->item;
+            close(p_slot->fd);
+            p_slot->item = NULL;
+            inflight--;
+
+            p_prefetch->bytes -= p_item->size - p_slot->done;
+            p_item->size = p_slot->done;
+            if(res < 0 || p_slot->done == 0){
+                p_prefetch->bytes -= p_slot->done;
+                prefetch_unread(p_prefetch, p_item);
+            }else{
+                prefetch_ready(p_prefetch, p_item);
+            }
+        }
+        __atomic_store_n(p_ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&p_prefetch->lock);
+
+    return NULL;
+}
+#endif
+
+prefetch * prefetch_new(uint32_t depth, uint64_t max_bytes, prefetch_want_cb want, void * user) {
+    prefetch * p_prefetch = (prefetch *)calloc(1, sizeof(prefetch));
+    if(p_prefetch == NULL){
+        return NULL;
+    }
+    p_prefetch->depth = depth ? depth : 1;
+    p_prefetch->max_bytes = max_bytes;
+    p_prefetch->want = want;
+    p_prefetch->user = user;
+    pthread_mutex_init(&p_prefetch->lock, NULL);
+    pthread_cond_init(&p_prefetch->ready_cond, NULL);
+    pthread_cond_init(&p_prefetch->work_cond, NULL);
+    pthread_cond_init(&p_prefetch->room_cond, NULL);
+
+    p_prefetch->threads = (pthread_t *)malloc(p_prefetch->depth * sizeof(pthread_t));
+    if(p_prefetch->threads == NULL){
+        prefetch_free(p_prefetch);
+        return NULL;
+    }
+
+#ifdef PREFETCH_URING
+    p_prefetch->slots = (prefetch_slot *)calloc(p_prefetch->depth, sizeof(prefetch_slot));
+    if(p_prefetch->slots != NULL && ring_setup(&p_prefetch->ring, p_prefetch->depth) == 0){
+        p_prefetch->uring = 1;
+        if(pthread_create(&p_prefetch->threads[0], NULL, prefetch_ring_main, p_prefetch) == 0){
+            p_prefetch->thread_cnt = 1;
+            return p_prefetch;
+        }
+        ring_close(&p_prefetch->ring);
+        p_prefetch->uring = 0;
+    }
+#endif
+
+    /* Kernels without io_uring, or where it is turned off */
+    for(; p_prefetch->thread_cnt < p_prefetch->depth; p_prefetch->thread_cnt++){
+        if(pthread_create(&p_prefetch->threads[p_prefetch->thread_cnt], NULL, prefetch_reader, p_prefetch) != 0){
+            break;
+        }
+    }
+    if(p_prefetch->thread_cnt == 0){
+        prefetch_free(p_prefetch);
+        return NULL;
+    }
+
+    return p_prefetch;
+}
+
+int prefetch_add(prefetch * p_prefetch, const char * path) {
+    prefetch_item * p_item = (prefetch_item *)calloc(1, sizeof(prefetch_item));
+    if(p_item == NULL || (p_item->path = strdup(path)) == NULL){
+        free(p_item);
+        return -1;
+    }
+
+    pthread_mutex_lock(&p_prefetch->lock);
+    if(p_prefetch->pending_tail != NULL){
+        p_prefetch->pending_tail->next = p_item;
+    }else{
+        p_prefetch->pending_head = p_item;
+    }
+    p_prefetch->pending_tail = p_item;
+    pthread_cond_signal(&p_prefetch->work_cond);
+    pthread_mutex_unlock(&p_prefetch->lock);
+
+    return 0;
+}
+
+void prefetch_end(prefetch * p_prefetch) {
+    pthread_mutex_lock(&p_prefetch->lock);
+    p_prefetch->ended = 1;
+    pthread_cond_broadcast(&p_prefetch->work_cond);
+    pthread_cond_broadcast(&p_prefetch->ready_cond);
+    pthread_mutex_unlock(&p_prefetch->lock);
+}
+
+prefetch_item * prefetch_next(prefetch * p_prefetch) {
+    pthread_mutex_lock(&p_prefetch->lock);
+    while(p_prefetch->ready_head == NULL && !(p_prefetch->ended && p_prefetch->pending_head == NULL && p_prefetch->active == 0)){
+        pthread_cond_wait(&p_prefetch->ready_cond, &p_prefetch->lock);
+    }
+
+    prefetch_item * p_item = p_prefetch->ready_head;
+    if(p_item != NULL){
+        p_prefetch->ready_head = p_item->next;
+        if(p_prefetch->ready_head == NULL){
+            p_prefetch->ready_tail = NULL;
+        }
+        p_item->next = NULL;
+    }
+    pthread_mutex_unlock(&p_prefetch->lock);
+
+    return p_item;
+}
+
+void prefetch_release(prefetch * p_prefetch, prefetch_item * p_item) {
+    if(p_item->data != NULL){
+        pthread_mutex_lock(&p_prefetch->lock);
+        p_prefetch->bytes -= p_item->size;
+        pthread_cond_broadcast(&p_prefetch->room_cond);
+        pthread_mutex_unlock(&p_prefetch->lock);
+    }
+    free(p_item->data);
+    free(p_item->path);
+    free(p_item);
+}
+
+void prefetch_free(prefetch * p_prefetch) {
+    if(p_prefetch == NULL){
+        return;
+    }
+
+    prefetch_end(p_prefetch);
+    for(uint32_t i = 0; i < p_prefetch->thread_cnt; i++){
+        pthread_join(p_prefetch->threads[i], NULL);
+    }
+
+    prefetch_item * lists[] = { p_prefetch->pending_head, p_prefetch->ready_head };
+    for(uint32_t l = 0; l < 2; l++){
+        while(lists[l] != NULL){
+            prefetch_item * p_next = lists[l]->next;
+            free(lists[l]->data);
+            free(lists[l]->path);
+            free(lists[l]);
+            lists[l] = p_next;
+        }
+    }
+
+#ifdef PREFETCH_URING
+    if(p_prefetch->uring){
+        ring_close(&p_prefetch->ring);
+    }
+    free(p_prefetch->slots);
+#endif
+    free(p_prefetch->threads);
+    pthread_cond_destroy(&p_prefetch->room_cond);
+    pthread_cond_destroy(&p_prefetch->work_cond);
+    pthread_cond_destroy(&p_prefetch->ready_cond);
+    pthread_mutex_destroy(&p_prefetch->lock);
+    free(p_prefetch);
+}
+
+const char * prefetch_backend(const prefetch * p_prefetch) {
+    return p_prefetch->uring ? "io_uring" : "pread";
+}
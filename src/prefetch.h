@@ -0,0 +1,73 @@
+/* prefetch.h
+ * Copyright (C) 2024 Sascha Klick <sascha.klick@github.com>
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define PREFETCH_DEPTH 32
+#define PREFETCH_BYTES (64 << 20)
+
+/* Called on the reading side with the stat of each file. Returns whether it is read ahead, files
+ * that aren't are handed over as their path only. */
+typedef int (*prefetch_want_cb)(void * user, const char * path, const struct stat * p_st);
+
+typedef void (*prefetch_walk_cb)(void * user, const char * path);
+
+struct prefetch_item {
+    char *                 path;
+    uint8_t *              data;
+    size_t                 size;
+    time_t                 mtime;
+    struct prefetch_item * next;
+} typedef prefetch_item;
+
+struct prefetch typedef prefetch;
+
+/* Calls found for every regular file below path, a directory walked depth first with the entries
+ * of each directory sorted, or for path itself if it is none. Symbolic links to directories are
+ * not followed. Returns the number of files. */
+uint32_t prefetch_walk(const char * path, prefetch_walk_cb found, void * user);
+
+/* Reads up to depth files at a time, holding at most max_bytes of read but not yet released data.
+ * Files larger than a quarter of that, empty ones and those that fail to read are handed over
+ * unread. Uses io_uring where the kernel allows it, a pool of pread threads otherwise. */
+prefetch * prefetch_new(uint32_t depth, uint64_t max_bytes, prefetch_want_cb want, void * user);
+
+/* Queues a path, safe to call while the reading and the consumers are running */
+int prefetch_add(prefetch * p_prefetch, const char * path);
+
+/* No more paths will be added */
+void prefetch_end(prefetch * p_prefetch);
+
+/* Blocks until a file was read, in the order they complete. Returns NULL once everything
+ * added before prefetch_end() was handed out. */
+prefetch_item * prefetch_next(prefetch * p_prefetch);
+
+void prefetch_release(prefetch * p_prefetch, prefetch_item * p_item);
+
+/* Waits for the reading side to finish, call after the consumers are done */
+void prefetch_free(prefetch * p_prefetch);
+
+const char * prefetch_backend(const prefetch * p_prefetch);
+
+#endif